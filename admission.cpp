@@ -0,0 +1,173 @@
+//
+// admission.cpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include "admission.hpp"
+#include "connector.hpp"
+#include "stats.hpp"
+
+namespace http {
+    namespace server3 {
+
+        admission::admission(std::size_t max, int lease_timeout)
+            : max_(max), lease_timeout_(lease_timeout), limit_(static_cast<double>(max)),
+              in_flight_(0), rejected_(0), samples_(0), average_(0), baseline_(0),
+              baseline_at_(0), lowered_at_(0)
+        {
+        }
+
+        bool admission::enter()
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            if (in_flight_ >= static_cast<std::size_t>(limit_))
+            {
+                ++rejected_;
+                return false;
+            }
+            ++in_flight_;
+            return true;
+        }
+
+        void admission::leave(boost::uint64_t ns, bool leased)
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            std::size_t in_flight = in_flight_--;
+            boost::uint64_t now = stats::now();
+
+            bool overloaded = !leased;
+            if (leased)
+            {
+                double sample = static_cast<double>(ns);
+                average_ = (samples_ == 0) ? sample : average_ + (sample - average_) / ADMISSION_SMOOTHING;
+
+                // Until the average means something, only learn.
+                if (++samples_ < ADMISSION_SMOOTHING)
+                    return;
+
+                // The baseline is the best average seen lately; it is raised to
+                // the average now and then, so that it follows a database that
+                // got slower for good instead of keeping the limit down forever.
+                if ((baseline_ == 0) || (average_ < baseline_) ||
+                    (now - baseline_at_ > ADMISSION_BASELINE_NS))
+                {
+                    baseline_ = average_;
+                    baseline_at_ = now;
+                }
+
+                overloaded = average_ > ADMISSION_TOLERANCE * baseline_;
+            }
+
+            if (overloaded)
+            {
+                // Lower at most once per average latency: the requests still in
+                // flight were admitted under the old limit.
+                if (now - lowered_at_ > static_cast<boost::uint64_t>(average_))
+                {
+                    limit_ = std::max(1.0, limit_ * ADMISSION_BACKOFF);
+                    lowered_at_ = now;
+                }
+            }
+            else if (in_flight >= static_cast<std::size_t>(limit_))
+            {
+                // Grow by one per limit's worth of requests, and only while the
+                // limit is what holds requests back.
+                limit_ = std::min(static_cast<double>(max_), limit_ + 1.0 / limit_);
+            }
+        }
+
+        int admission::lease_timeout() const
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            if (average_ == 0)
+                return lease_timeout_;
+
+            int timeout = static_cast<int>(std::ceil(ADMISSION_LEASE_FACTOR * average_ / 1e6));
+            return std::max(ADMISSION_LEASE_MIN, std::min(lease_timeout_, timeout));
+        }
+
+        unsigned admission::retry_after() const
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+
+            // About the time the requests in flight need to drain.
+            return 1 + static_cast<unsigned>(average_ * in_flight_ / limit_ / 1e9);
+        }
+
+        void admission::report(std::string& out, bool prometheus) const
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            std::stringstream s;
+
+            if (prometheus)
+            {
+                s << "# TYPE lisa_admission_limit gauge\n"
+                  << "lisa_admission_limit " << limit_ << "\n"
+                  << "# TYPE lisa_admission_in_flight gauge\n"
+                  << "lisa_admission_in_flight " << in_flight_ << "\n"
+                  << "# TYPE lisa_admission_rejected_total counter\n"
+                  << "lisa_admission_rejected_total " << rejected_ << "\n"
+                  << "# TYPE lisa_admission_latency_seconds gauge\n"
+                  << "lisa_admission_latency_seconds{kind=\"average\"} " << average_ / 1e9 << "\n"
+                  << "lisa_admission_latency_seconds{kind=\"baseline\"} " << baseline_ / 1e9 << "\n";
+            }
+            else
+            {
+                s << "admission limit=" << std::fixed << std::setprecision(1) << limit_
+                  << " in_flight=" << in_flight_
+                  << " rejected=" << rejected_
+                  << std::setprecision(0)
+                  << " latency=" << average_ / 1e3 << "us"
+                  << " baseline=" << baseline_ / 1e3 << "us\n";
+            }
+
+            out += s.str();
+        }
+
+        lease::lease(soci::connection_pool& pool, admission* admit, connector* connect)
+            : pool_(pool), admit_(admit), connect_(connect), admitted_(false),
+              acquired_(false), lost_(false), position_(0), leased_(0)
+        {
+            if (admit_ && !admit_->enter())
+                return;
+            admitted_ = (admit_ != 0);
+
+            // Without admission control wait as long as it takes.
+            acquired_ = pool_.try_lease(position_, admit_ ? admit_->lease_timeout() : -1);
+            if (acquired_)
+            {
+                leased_ = stats::now();
+            }
+            else if (admitted_)
+            {
+                admit_->leave(0, false);
+                admitted_ = false;
+            }
+        }
+
+        lease::~lease()
+        {
+            if (acquired_ && lost_)
+                connect_->reopen(position_);
+            else if (acquired_)
+                pool_.give_back(position_);
+            if (admitted_)
+                admit_->leave(stats::now() - leased_, true);
+        }
+
+        void lease::failed(const std::exception& e)
+        {
+            lost_ = connect_ && connector::lost(e);
+        }
+
+    } // namespace server3
+} // namespace http
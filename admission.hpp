@@ -0,0 +1,141 @@
+//
+// admission.hpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_ADMISSION_HPP
+#define HTTP_SERVER3_ADMISSION_HPP
+
+#include <cstddef>
+#include <exception>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "soci.h"
+
+#define ADMISSION_TOLERANCE     2.0     // latency over baseline taken as overload
+#define ADMISSION_BACKOFF       0.9     // limit kept on overload
+#define ADMISSION_SMOOTHING     16      // samples in the latency average
+#define ADMISSION_BASELINE_NS   10000000000ULL  // baseline forgotten after 10s
+#define ADMISSION_LEASE_FACTOR  4       // lease deadline in average latencies
+#define ADMISSION_LEASE_MIN     1       // ms
+
+namespace http {
+    namespace server3 {
+
+        class connector;
+
+/// Admission control in front of the database. At most limit requests use
+/// the database at once and a session must be leased within a deadline; the
+/// others are turned away at once (503 and Retry-After), so that an I/O
+/// thread never sits behind a database that cannot keep up. The limit adapts
+/// to the database latency, additive increase while it stays close to the
+/// best seen recently and multiplicative decrease when it does not; the lease
+/// deadline follows the average latency.
+        class admission
+            : private boost::noncopyable
+        {
+        public:
+            /// Allow up to max concurrent requests and wait up to lease_timeout
+            /// milliseconds for a session.
+            admission(std::size_t max, int lease_timeout);
+
+            /// Admit a request, or return false if it must be turned away.
+            bool enter();
+
+            /// Account for the end of an admitted request that held a session
+            /// for ns nanoseconds, or none if leased is false.
+            void leave(boost::uint64_t ns, bool leased);
+
+            /// Milliseconds to wait for a session.
+            int lease_timeout() const;
+
+            /// Seconds a turned away client should wait before retrying.
+            unsigned retry_after() const;
+
+            /// Append the current state to a /stats report.
+            void report(std::string& out, bool prometheus) const;
+
+        private:
+            /// Protects everything below.
+            mutable boost::mutex mutex_;
+
+            /// Upper bound of the limit.
+            std::size_t max_;
+
+            /// Upper bound of the lease deadline, in milliseconds.
+            int lease_timeout_;
+
+            /// Concurrent requests allowed (fractional while growing).
+            double limit_;
+
+            /// Requests admitted and not finished.
+            std::size_t in_flight_;
+
+            /// Requests turned away so far.
+            boost::uint64_t rejected_;
+
+            /// Latency samples seen so far.
+            boost::uint64_t samples_;
+
+            /// Average and best recent database latency, in nanoseconds.
+            double average_;
+            double baseline_;
+
+            /// When the baseline was last reset and the limit last lowered.
+            boost::uint64_t baseline_at_;
+            boost::uint64_t lowered_at_;
+        };
+
+/// A database session leased for the lifetime of the object, after the
+/// request was admitted. A session found lost is handed to the connector to
+/// be reopened instead of going back to the pool.
+        class lease
+            : private boost::noncopyable
+        {
+        public:
+            /// Lease a session from the pool, through admission control if any.
+            lease(soci::connection_pool& pool, admission* admit, connector* connect);
+
+            /// Give the session back.
+            ~lease();
+
+            /// Look at an error raised by the session, to reopen it if it was
+            /// lost.
+            void failed(const std::exception& e);
+
+            /// Whether a session was leased; if not, the request must be turned
+            /// away.
+            bool acquired() const
+            {
+                return acquired_;
+            }
+
+            /// The leased session.
+            soci::session& session()
+            {
+                return pool_.at(position_);
+            }
+
+        private:
+            soci::connection_pool& pool_;
+            admission* admit_;
+            connector* connect_;
+            bool admitted_;
+            bool acquired_;
+            bool lost_;
+            std::size_t position_;
+            boost::uint64_t leased_;
+        };
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_ADMISSION_HPP
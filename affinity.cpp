@@ -0,0 +1,118 @@
+//
+// affinity.cpp
+// ~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <cstring>
+#include <sstream>
+#include <boost/lexical_cast.hpp>
+#include "affinity.hpp"
+#include "globals.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace http {
+    namespace server3 {
+
+        bool affinity::parse(const std::string& list, std::vector<int>& cpus)
+        {
+            cpus.clear();
+            if (list.empty())
+                return true;
+
+            std::string::size_type begin = 0;
+            while (begin <= list.size())
+            {
+                std::string::size_type end = list.find(',', begin);
+                if (end == std::string::npos)
+                    end = list.size();
+
+                std::string item(list, begin, end - begin);
+                std::string::size_type dash = item.find('-');
+                try
+                {
+                    int lo = boost::lexical_cast<int>(item.substr(0, dash));
+                    int hi = (dash == std::string::npos) ? lo : boost::lexical_cast<int>(item.substr(dash + 1));
+                    if ((lo < 0) || (hi < lo) || (hi >= CPU_SETSIZE))
+                        return false;
+                    for (int cpu = lo; cpu <= hi; ++cpu)
+                        cpus.push_back(cpu);
+                }
+                catch (boost::bad_lexical_cast&)
+                {
+                    return false;
+                }
+
+                begin = end + 1;
+            }
+            return true;
+        }
+
+        bool affinity::pin(const std::vector<int>& cpus)
+        {
+            if (cpus.empty())
+                return true;
+
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (std::size_t i = 0; i < cpus.size(); ++i)
+                CPU_SET(cpus[i], &set);
+
+            int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            if (error)
+            {
+                LIERR("affinity: cannot pin to cpus " + format(cpus) + ": " + std::strerror(error));
+                return false;
+            }
+            return true;
+        }
+
+        std::string affinity::where()
+        {
+            std::vector<int> allowed;
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+            {
+                for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+                    if (CPU_ISSET(cpu, &set))
+                        allowed.push_back(cpu);
+            }
+
+            unsigned cpu = 0, node = 0;
+            std::stringstream s;
+            s << "cpus=" << format(allowed);
+            if (::syscall(SYS_getcpu, &cpu, &node, 0) == 0)
+                s << " cpu=" << cpu << " node=" << node;
+            return s.str();
+        }
+
+        std::string affinity::format(const std::vector<int>& cpus)
+        {
+            std::stringstream s;
+            for (std::size_t i = 0; i < cpus.size(); )
+            {
+                std::size_t j = i;
+                while ((j + 1 < cpus.size()) && (cpus[j + 1] == cpus[j] + 1))
+                    ++j;
+
+                if (i)
+                    s << ",";
+                s << cpus[i];
+                if (j > i)
+                    s << "-" << cpus[j];
+                i = j + 1;
+            }
+            return s.str();
+        }
+
+    } // namespace server3
+} // namespace http
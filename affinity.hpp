@@ -0,0 +1,47 @@
+//
+// affinity.hpp
+// ~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_AFFINITY_HPP
+#define HTTP_SERVER3_AFFINITY_HPP
+
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+namespace http {
+    namespace server3 {
+
+/// Placement of threads on CPUs. Memory is allocated on the NUMA node of
+/// the thread that first touches it (the kernel default), so a thread
+/// pinned before it allocates its buffers keeps them on its own node.
+        class affinity
+            : private boost::noncopyable
+        {
+        public:
+            /// Parse a CPU list "0-3,8,10-11", in the order given. An empty list
+            /// is no placement. Returns false if invalid.
+            static bool parse(const std::string& list, std::vector<int>& cpus);
+
+            /// Restrict the calling thread to the given CPUs (no-op if empty).
+            /// Returns false, after logging why, if the kernel refused.
+            static bool pin(const std::vector<int>& cpus);
+
+            /// The CPUs the calling thread may run on, and the CPU and NUMA node
+            /// it runs on now: "cpus=0-3 cpu=2 node=0".
+            static std::string where();
+
+            /// Format a CPU list with ranges.
+            static std::string format(const std::vector<int>& cpus);
+        };
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_AFFINITY_HPP
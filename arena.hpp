@@ -0,0 +1,191 @@
+//
+// arena.hpp
+// ~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_ARENA_HPP
+#define HTTP_SERVER3_ARENA_HPP
+
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <boost/aligned_storage.hpp>
+#include <boost/noncopyable.hpp>
+
+#define ARENA_BLOCK_SIZE 2048
+
+namespace http {
+    namespace server3 {
+
+/// Bump allocator for per-request data. Memory is handed out linearly from an
+/// in-object block, then from heap chunks that are kept across resets, and is
+/// only given back all at once by reset(). Not thread safe: an arena belongs to
+/// a single connection.
+        class arena
+            : private boost::noncopyable
+        {
+        public:
+            arena()
+                : current_(static_cast<char*>(block_.address())), left_(ARENA_BLOCK_SIZE), chunk_(0)
+            {
+            }
+
+            ~arena()
+            {
+                for (std::size_t i = 0; i < chunks_.size(); ++i)
+                    delete [] chunks_[i].first;
+            }
+
+            /// Allocate n bytes aligned for any fundamental type.
+            void* allocate(std::size_t n)
+            {
+                const std::size_t align = sizeof(void*) * 2;
+                n = (n + align - 1) & ~(align - 1);
+
+                while (n > left_)
+                {
+                    if (chunk_ == chunks_.size())
+                    {
+                        std::size_t size = (n > ARENA_BLOCK_SIZE * 4) ? n : ARENA_BLOCK_SIZE * 4;
+                        chunks_.push_back(std::make_pair(new char[size], size));
+                    }
+                    current_ = chunks_[chunk_].first;
+                    left_ = chunks_[chunk_].second;
+                    ++chunk_;
+                }
+
+                void* p = current_;
+                current_ += n;
+                left_ -= n;
+                return p;
+            }
+
+            /// Release everything allocated so far. Heap chunks are kept for reuse.
+            void reset()
+            {
+                current_ = static_cast<char*>(block_.address());
+                left_ = ARENA_BLOCK_SIZE;
+                chunk_ = 0;
+            }
+
+        private:
+            /// The in-object block served first.
+            boost::aligned_storage<ARENA_BLOCK_SIZE, sizeof(void*) * 2> block_;
+
+            /// Next free byte.
+            char* current_;
+
+            /// Bytes left after current_ in the block being used.
+            std::size_t left_;
+
+            /// Heap chunks (address, size) obtained when the block ran out.
+            std::vector<std::pair<char*, std::size_t> > chunks_;
+
+            /// Index of the next chunk to use.
+            std::size_t chunk_;
+        };
+
+/// Standard allocator adaptor over an arena. Without an arena it falls back to
+/// the global heap, so containers using it can still be created standalone.
+        template <typename T>
+        class arena_allocator
+        {
+        public:
+            typedef T value_type;
+            typedef T* pointer;
+            typedef const T* const_pointer;
+            typedef T& reference;
+            typedef const T& const_reference;
+            typedef std::size_t size_type;
+            typedef std::ptrdiff_t difference_type;
+
+            template <typename U>
+            struct rebind
+            {
+                typedef arena_allocator<U> other;
+            };
+
+            arena_allocator()
+                : arena_(0)
+            {
+            }
+
+            explicit arena_allocator(arena* a)
+                : arena_(a)
+            {
+            }
+
+            template <typename U>
+            arena_allocator(const arena_allocator<U>& other)
+                : arena_(other.get_arena())
+            {
+            }
+
+            arena* get_arena() const
+            {
+                return arena_;
+            }
+
+            pointer allocate(size_type n, const void* = 0)
+            {
+                if (arena_)
+                    return static_cast<pointer>(arena_->allocate(n * sizeof(T)));
+                return static_cast<pointer>(::operator new(n * sizeof(T)));
+            }
+
+            void deallocate(pointer p, size_type)
+            {
+                if (!arena_)
+                    ::operator delete(p);
+            }
+
+            size_type max_size() const
+            {
+                return static_cast<size_type>(-1) / sizeof(T);
+            }
+
+            void construct(pointer p, const T& value)
+            {
+                new (p) T(value);
+            }
+
+            void destroy(pointer p)
+            {
+                p->~T();
+            }
+
+            pointer address(reference r) const
+            {
+                return &r;
+            }
+
+            const_pointer address(const_reference r) const
+            {
+                return &r;
+            }
+
+        private:
+            arena* arena_;
+        };
+
+        template <typename T, typename U>
+        bool operator==(const arena_allocator<T>& a, const arena_allocator<U>& b)
+        {
+            return a.get_arena() == b.get_arena();
+        }
+
+        template <typename T, typename U>
+        bool operator!=(const arena_allocator<T>& a, const arena_allocator<U>& b)
+        {
+            return a.get_arena() != b.get_arena();
+        }
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_ARENA_HPP
@@ -0,0 +1,662 @@
+//
+// bench.cpp
+// ~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/array.hpp>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/program_options.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include "frame.hpp"
+#include "stats.hpp"
+
+#define DEFAULT_ADDRESS     "127.0.0.1"
+#define DEFAULT_PORT        "1972"
+#define DEFAULT_BINARY_PORT "1973"
+#define DEFAULT_PROTOCOL    "http"
+#define DEFAULT_CONNECTIONS 10
+#define DEFAULT_THREADS     2
+#define DEFAULT_RATE        0
+#define DEFAULT_DURATION    10
+#define DEFAULT_MIX         "enqueue:50,dequeue:50"
+#define DEFAULT_SIZE        "16"
+#define DEFAULT_PRIORITY    "0"
+
+#define HELP "\nLISA benchmark: open-loop load generator for the HTTP and binary protocols\n\nAllowed Options"
+
+using boost::asio::ip::tcp;
+using http::server3::histogram;
+using http::server3::stats;
+using http::server3::frame;
+
+namespace {
+
+    struct options
+    {
+        std::string address;
+        std::string port;
+        std::string binary_port;
+        std::string protocol;
+        int connections;
+        int threads;
+        double rate;
+        double duration;
+        std::string mix;
+        std::string size;
+        std::string priority;
+        bool no_reuse;
+        bool no_check;
+    };
+
+    typedef boost::random::mt19937 generator;
+
+    /// A value drawn from "v" (fixed), "a-b" (uniform) or "v:w,v:w,..."
+    /// (weighted) specifications; keys are converted by a caller function.
+    class choice
+    {
+    public:
+        choice(const std::string& spec, int (*key)(const std::string&))
+            : low_(0), high_(0), total_(0)
+        {
+            std::string::size_type dash = spec.find('-', 1);
+            if ((spec.find(':') == std::string::npos) && (dash != std::string::npos))
+            {
+                low_ = key(spec.substr(0, dash));
+                high_ = key(spec.substr(dash + 1));
+                if (high_ < low_)
+                    throw std::runtime_error("bad range: " + spec);
+                return;
+            }
+
+            std::stringstream in(spec);
+            std::string item;
+            while (std::getline(in, item, ','))
+            {
+                std::string::size_type colon = item.find(':');
+                unsigned weight = (colon == std::string::npos) ? 1 :
+                    boost::lexical_cast<unsigned>(item.substr(colon + 1));
+                if (weight == 0)
+                    continue;
+                total_ += weight;
+                values_.push_back(key(item.substr(0, colon)));
+                cumulative_.push_back(total_);
+            }
+            if (values_.empty())
+                throw std::runtime_error("bad specification: " + spec);
+        }
+
+        int pick(generator& g) const
+        {
+            if (values_.empty())
+                return boost::random::uniform_int_distribution<int>(low_, high_)(g);
+
+            unsigned r = boost::random::uniform_int_distribution<unsigned>(0, total_ - 1)(g);
+            std::size_t i = 0;
+            while (cumulative_[i] <= r)
+                ++i;
+            return values_[i];
+        }
+
+        int max() const
+        {
+            int m = high_;
+            for (std::size_t i = 0; i < values_.size(); ++i)
+                m = std::max(m, values_[i]);
+            return m;
+        }
+
+    private:
+        std::vector<int> values_;
+        std::vector<unsigned> cumulative_;
+        int low_;
+        int high_;
+        unsigned total_;
+    };
+
+    int number(const std::string& s)
+    {
+        return boost::lexical_cast<int>(s);
+    }
+
+    int operation(const std::string& s)
+    {
+        if (s == "enqueue")
+            return stats::enqueue;
+        if (s == "dequeue")
+            return stats::dequeue;
+        if (s == "spy")
+            return stats::spy;
+        throw std::runtime_error("unknown operation: " + s);
+    }
+
+    /// What every connection draws its requests from.
+    struct workload
+    {
+        explicit workload(const options& o)
+            : mix(o.mix, operation), size(o.size, number), priority(o.priority, number),
+              data(std::max(size.max(), 0), 'x'), binary(o.protocol == "binary"),
+              reuse(!o.no_reuse)
+        {
+        }
+
+        choice mix;
+        choice size;
+        choice priority;
+        std::string data;
+        bool binary;
+        bool reuse;
+    };
+
+    /// Per-connection results; each connection is its only writer.
+    struct result
+        : private boost::noncopyable
+    {
+        result()
+            : enqueued(0), dequeued(0), empty(0), errors(0)
+        {
+        }
+
+        /// Latency from the intended send time, per operation.
+        histogram latency[stats::operations];
+
+        /// Latency from the actual send time, all operations.
+        histogram service;
+
+        std::size_t enqueued;
+        std::size_t dequeued;
+        std::size_t empty;
+        std::size_t errors;
+    };
+
+    /// One client connection sending requests on a fixed schedule. A request
+    /// that should have been sent while the previous one was still in flight
+    /// goes out late, but its latency is still measured from when it was due,
+    /// so server stalls are not hidden (coordinated omission).
+    class client
+        : public boost::enable_shared_from_this<client>,
+          private boost::noncopyable
+    {
+    public:
+        client(boost::asio::io_service& io_service, const workload& w,
+               const tcp::endpoint& endpoint, std::size_t id, result& r)
+            : workload_(w), endpoint_(endpoint), socket_(io_service), timer_(io_service),
+              generator_(static_cast<boost::uint32_t>(id + 1)), result_(r),
+              next_(0), sent_(0), interval_(0), end_(0), op_(0)
+        {
+        }
+
+        /// Send the first request at first, then one every interval nanoseconds
+        /// (back to back when interval is zero) until end.
+        void start(boost::uint64_t first, boost::uint64_t interval, boost::uint64_t end)
+        {
+            next_ = first;
+            interval_ = interval;
+            end_ = end;
+            schedule();
+        }
+
+    private:
+        enum outcome { ok, empty, failed };
+
+        void schedule()
+        {
+            boost::uint64_t now = stats::now();
+            if (interval_ == 0)
+                next_ = now;
+            if ((next_ >= end_) || (now >= end_))
+            {
+                close();
+                return;
+            }
+
+            if (next_ > now)
+            {
+                timer_.expires_from_now(boost::posix_time::microseconds((next_ - now) / 1000));
+                timer_.async_wait(boost::bind(&client::handle_timer, shared_from_this(),
+                                              boost::asio::placeholders::error));
+            }
+            else
+            {
+                send();
+            }
+        }
+
+        void handle_timer(const boost::system::error_code& e)
+        {
+            if (!e)
+                send();
+        }
+
+        void send()
+        {
+            op_ = workload_.mix.pick(generator_);
+            request_.clear();
+            response_.clear();
+
+            if (workload_.binary)
+                build_frame();
+            else
+                build_http();
+
+            sent_ = stats::now();
+            if (socket_.is_open())
+                write();
+            else
+                socket_.async_connect(endpoint_,
+                                      boost::bind(&client::handle_connect, shared_from_this(),
+                                                  boost::asio::placeholders::error));
+        }
+
+        void build_http()
+        {
+            if (op_ == stats::enqueue)
+            {
+                std::string data(workload_.data, 0, workload_.size.pick(generator_));
+                std::stringstream s;
+                s << "POST /" << workload_.priority.pick(generator_) << " HTTP/1.0\r\n"
+                  << "Content-Type: application/x-www-form-urlencoded\r\n"
+                  << "Content-Length: " << (data.size() + 2) << "\r\n\r\n"
+                  << "d=" << data;
+                request_ = s.str();
+            }
+            else
+            {
+                request_ = (op_ == stats::spy) ? "GET /spy HTTP/1.0\r\n\r\n" : "GET / HTTP/1.0\r\n\r\n";
+            }
+        }
+
+        void build_frame()
+        {
+            frame f;
+            f.tag = 0;
+            if (op_ == stats::enqueue)
+            {
+                f.code = frame::enqueue;
+                frame::put_u32(f.body, static_cast<boost::uint32_t>(workload_.priority.pick(generator_)));
+                f.body.append(workload_.data, 0, workload_.size.pick(generator_));
+            }
+            else
+            {
+                f.code = (op_ == stats::spy) ? frame::peek : frame::dequeue;
+            }
+            f.encode(request_);
+        }
+
+        void handle_connect(const boost::system::error_code& e)
+        {
+            if (e)
+            {
+                complete(failed);
+                return;
+            }
+            socket_.set_option(tcp::no_delay(true));
+            write();
+        }
+
+        void write()
+        {
+            boost::asio::async_write(socket_, boost::asio::buffer(request_),
+                                     boost::bind(&client::handle_write, shared_from_this(),
+                                                 boost::asio::placeholders::error));
+        }
+
+        void handle_write(const boost::system::error_code& e)
+        {
+            if (e)
+            {
+                complete(failed);
+                return;
+            }
+
+            if (workload_.binary)
+                boost::asio::async_read(socket_, boost::asio::buffer(header_),
+                                        boost::bind(&client::handle_read_header, shared_from_this(),
+                                                    boost::asio::placeholders::error));
+            else
+                socket_.async_read_some(boost::asio::buffer(buffer_),
+                                        boost::bind(&client::handle_read_http, shared_from_this(),
+                                                    boost::asio::placeholders::error,
+                                                    boost::asio::placeholders::bytes_transferred));
+        }
+
+        // HTTP/1.0: the reply ends when lisa closes the connection.
+        void handle_read_http(const boost::system::error_code& e, std::size_t bytes_transferred)
+        {
+            response_.append(buffer_.data(), bytes_transferred);
+            if (!e)
+            {
+                socket_.async_read_some(boost::asio::buffer(buffer_),
+                                        boost::bind(&client::handle_read_http, shared_from_this(),
+                                                    boost::asio::placeholders::error,
+                                                    boost::asio::placeholders::bytes_transferred));
+                return;
+            }
+
+            if ((e != boost::asio::error::eof) || (response_.compare(0, 9, "HTTP/1.0 ") != 0))
+            {
+                complete(failed);
+                return;
+            }
+
+            int status = std::atoi(response_.c_str() + 9);
+            if (status == 200)
+                complete(ok);
+            else if ((status == 404) && (op_ != stats::enqueue))
+                complete(empty);
+            else
+                complete(failed);
+        }
+
+        void handle_read_header(const boost::system::error_code& e)
+        {
+            std::size_t length = frame::get_u32(header_.data());
+            if (e || (length < FRAME_HEADER_SIZE) || (length > FRAME_MAX_SIZE))
+            {
+                complete(failed);
+                return;
+            }
+
+            response_.resize(length - FRAME_HEADER_SIZE);
+            if (response_.empty())
+            {
+                handle_read_body(e);
+                return;
+            }
+            boost::asio::async_read(socket_, boost::asio::buffer(&response_[0], response_.size()),
+                                    boost::bind(&client::handle_read_body, shared_from_this(),
+                                                boost::asio::placeholders::error));
+        }
+
+        void handle_read_body(const boost::system::error_code& e)
+        {
+            if (e)
+            {
+                complete(failed);
+                return;
+            }
+
+            switch (static_cast<unsigned char>(header_[FRAME_LENGTH_SIZE]))
+            {
+                case frame::ok:
+                    complete(ok);
+                    break;
+                case frame::empty:
+                    complete(empty);
+                    break;
+                default:
+                    complete(failed);
+                    break;
+            }
+        }
+
+        void complete(outcome o)
+        {
+            boost::uint64_t now = stats::now();
+            result_.latency[op_].record((now - next_) / 1000);
+            result_.service.record((now - sent_) / 1000);
+
+            if (o == failed)
+                ++result_.errors;
+            else if (o == empty)
+                ++result_.empty;
+            else if (op_ == stats::enqueue)
+                ++result_.enqueued;
+            else if (op_ == stats::dequeue)
+                ++result_.dequeued;
+
+            if (!workload_.binary || !workload_.reuse || (o == failed))
+                close();
+
+            next_ += interval_;
+            schedule();
+        }
+
+        void close()
+        {
+            boost::system::error_code ignored_ec;
+            socket_.close(ignored_ec);
+        }
+
+        const workload& workload_;
+        const tcp::endpoint& endpoint_;
+        tcp::socket socket_;
+        boost::asio::deadline_timer timer_;
+        generator generator_;
+        result& result_;
+
+        /// When the current request was due, and actually sent.
+        boost::uint64_t next_;
+        boost::uint64_t sent_;
+
+        boost::uint64_t interval_;
+        boost::uint64_t end_;
+        int op_;
+
+        std::string request_;
+        std::string response_;
+        boost::array<char, 8192> buffer_;
+        boost::array<char, FRAME_LENGTH_SIZE + FRAME_HEADER_SIZE> header_;
+    };
+
+    tcp::endpoint resolve(const std::string& address, const std::string& port)
+    {
+        boost::asio::io_service io_service;
+        tcp::resolver resolver(io_service);
+        tcp::resolver::query query(address, port);
+        return *resolver.resolve(query);
+    }
+
+    /// Number of queued items, asked over the protocol under test.
+    std::size_t count(const tcp::endpoint& endpoint, bool binary)
+    {
+        boost::asio::io_service io_service;
+        tcp::socket socket(io_service);
+        socket.connect(endpoint);
+
+        if (binary)
+        {
+            frame f;
+            f.code = frame::count;
+            f.tag = 0;
+            std::string request;
+            f.encode(request);
+            boost::asio::write(socket, boost::asio::buffer(request));
+
+            boost::array<char, FRAME_LENGTH_SIZE + FRAME_HEADER_SIZE + 4> reply;
+            boost::asio::read(socket, boost::asio::buffer(reply));
+            if (reply[FRAME_LENGTH_SIZE] != frame::ok)
+                throw std::runtime_error("count failed");
+            return frame::get_u32(reply.data() + FRAME_LENGTH_SIZE + FRAME_HEADER_SIZE);
+        }
+
+        boost::asio::write(socket, boost::asio::buffer(std::string("GET /count HTTP/1.0\r\n\r\n")));
+
+        std::string response;
+        boost::array<char, 4096> buf;
+        boost::system::error_code ec;
+        while (!ec)
+        {
+            std::size_t n = socket.read_some(boost::asio::buffer(buf), ec);
+            response.append(buf.data(), n);
+        }
+
+        std::string::size_type body = response.find("\r\n\r\n");
+        if ((response.compare(0, 12, "HTTP/1.0 200") != 0) || (body == std::string::npos))
+            throw std::runtime_error("count failed");
+        return boost::lexical_cast<std::size_t>(response.substr(body + 4));
+    }
+
+    void print(const std::string& name, const std::vector<boost::uint64_t>& counts,
+               boost::uint64_t sum)
+    {
+        boost::uint64_t total = 0, max = 0;
+        for (std::size_t i = 0; i < counts.size(); ++i)
+        {
+            total += counts[i];
+            if (counts[i])
+                max = histogram::upper_bound(i);
+        }
+        if (total == 0)
+            return;
+
+        std::cout << "  " << std::left << std::setw(18) << name << std::right
+                  << " count=" << total
+                  << " mean=" << (sum / total) << "us"
+                  << " p50=" << histogram::quantile(counts, total, 0.5) << "us"
+                  << " p90=" << histogram::quantile(counts, total, 0.9) << "us"
+                  << " p99=" << histogram::quantile(counts, total, 0.99) << "us"
+                  << " p999=" << histogram::quantile(counts, total, 0.999) << "us"
+                  << " max=" << max << "us" << std::endl;
+    }
+
+    /// Run the load and print the report; false when the item count check fails.
+    bool run(const options& o)
+    {
+        bool binary = (o.protocol == "binary");
+        tcp::endpoint endpoint = resolve(o.address, binary ? o.binary_port : o.port);
+        workload w(o);
+
+        std::size_t before = o.no_check ? 0 : count(endpoint, binary);
+
+        boost::asio::io_service io_service;
+        std::vector<boost::shared_ptr<result> > results;
+        boost::uint64_t interval = (o.rate > 0) ? static_cast<boost::uint64_t>(1e9 * o.connections / o.rate) : 0;
+        boost::uint64_t start = stats::now();
+        boost::uint64_t end = start + static_cast<boost::uint64_t>(o.duration * 1e9);
+
+        for (int i = 0; i < o.connections; ++i)
+        {
+            boost::shared_ptr<result> r(new result());
+            results.push_back(r);
+
+            // Spread the connections over one interval so the load is smooth.
+            boost::shared_ptr<client> c(new client(io_service, w, endpoint, i, *r));
+            c->start(start + interval * i / o.connections, interval, end);
+        }
+
+        boost::thread_group threads;
+        for (int i = 0; i < o.threads; ++i)
+            threads.create_thread(boost::bind(&boost::asio::io_service::run, &io_service));
+        threads.join_all();
+
+        double seconds = (stats::now() - start) / 1e9;
+
+        const char* names[] = { "enqueue", "dequeue", "spy" };
+        std::vector<boost::uint64_t> all, service;
+        boost::uint64_t all_sum = 0, service_sum = 0;
+        std::size_t enqueued = 0, dequeued = 0, empty = 0, errors = 0, requests = 0;
+
+        for (std::size_t i = 0; i < results.size(); ++i)
+        {
+            results[i]->service.merge(service, service_sum);
+            for (int op = 0; op < stats::count; ++op)
+                results[i]->latency[op].merge(all, all_sum);
+            enqueued += results[i]->enqueued;
+            dequeued += results[i]->dequeued;
+            empty += results[i]->empty;
+            errors += results[i]->errors;
+        }
+        for (std::size_t i = 0; i < all.size(); ++i)
+            requests += all[i];
+
+        std::cout << o.protocol << ": " << requests << " requests in " << std::fixed
+                  << std::setprecision(2) << seconds << "s = " << std::setprecision(1)
+                  << (requests / seconds) << "/s";
+        if (o.rate > 0)
+            std::cout << " (target " << o.rate << "/s)";
+        std::cout << ", " << o.connections << " connections, " << errors << " errors, "
+                  << empty << " empty" << std::endl;
+
+        std::cout << "latency (from intended send time):" << std::endl;
+        for (int op = 0; op < stats::count; ++op)
+        {
+            std::vector<boost::uint64_t> counts;
+            boost::uint64_t sum = 0;
+            for (std::size_t i = 0; i < results.size(); ++i)
+                results[i]->latency[op].merge(counts, sum);
+            print(names[op], counts, sum);
+        }
+        print("all", all, all_sum);
+        std::cout << "service time (from actual send time):" << std::endl;
+        print("all", service, service_sum);
+
+        if (o.no_check)
+            return true;
+
+        std::size_t after = count(endpoint, binary);
+        bool ok = (after + dequeued == before + enqueued);
+        std::cout << "count check: before=" << before << " enqueued=" << enqueued
+                  << " dequeued=" << dequeued << " after=" << after
+                  << (ok ? " ok" : " MISMATCH") << std::endl;
+        return ok;
+    }
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        namespace po = boost::program_options;
+
+        options o;
+        po::options_description desc(HELP);
+        desc.add_options()
+            ("help,h", "help message")
+            ("address,a", po::value<std::string>(&o.address)->default_value(DEFAULT_ADDRESS), "server address")
+            ("port,p", po::value<std::string>(&o.port)->default_value(DEFAULT_PORT), "HTTP port")
+            ("binary-port,b", po::value<std::string>(&o.binary_port)->default_value(DEFAULT_BINARY_PORT), "binary protocol port")
+            ("protocol,P", po::value<std::string>(&o.protocol)->default_value(DEFAULT_PROTOCOL), "http or binary")
+            ("connections,c", po::value<int>(&o.connections)->default_value(DEFAULT_CONNECTIONS), "concurrent connections")
+            ("threads,t", po::value<int>(&o.threads)->default_value(DEFAULT_THREADS), "client I/O threads")
+            ("rate,r", po::value<double>(&o.rate)->default_value(DEFAULT_RATE), "target requests/s over all connections, 0 sends back to back")
+            ("duration,d", po::value<double>(&o.duration)->default_value(DEFAULT_DURATION), "seconds to send requests for")
+            ("mix,m", po::value<std::string>(&o.mix)->default_value(DEFAULT_MIX), "operation weights (enqueue, dequeue, spy)")
+            ("size,s", po::value<std::string>(&o.size)->default_value(DEFAULT_SIZE), "payload bytes: n, min-max or n:weight,...")
+            ("priority,q", po::value<std::string>(&o.priority)->default_value(DEFAULT_PRIORITY), "priorities: n, min-max or n:weight,...")
+            ("no-reuse,n", po::bool_switch(&o.no_reuse), "open a new binary connection per request")
+            ("no-check,k", po::bool_switch(&o.no_check), "skip the queue count check");
+
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+
+        if (vm.count("help") || (o.connections < 1) || (o.threads < 1) ||
+            (o.rate < 0) || (o.duration <= 0) ||
+            ((o.protocol != "http") && (o.protocol != "binary")))
+        {
+            std::cout << desc << std::endl;
+            return 1;
+        }
+
+        if (!run(o))
+            return 2;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "exception: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
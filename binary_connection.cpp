@@ -0,0 +1,173 @@
+//
+// binary_connection.cpp
+// ~~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <boost/bind.hpp>
+#include "binary_connection.hpp"
+#include "globals.hpp"
+
+namespace http {
+    namespace server3 {
+
+        binary_connection::binary_connection(boost::asio::io_service& io_service, request_handler& handler,
+                                             timer_wheel& wheel, bool use_strand)
+            : strand_(io_service),
+              use_strand_(use_strand),
+              socket_(io_service),
+              request_handler_(handler),
+              wheel_(wheel),
+              timeout_(stats::idle_deadline),
+              open_(false)
+        {
+        }
+
+        binary_connection::~binary_connection()
+        {
+            if (open_)
+                g_stats.connection_closed();
+        }
+
+        boost::asio::ip::tcp::socket& binary_connection::socket()
+        {
+            return socket_;
+        }
+
+        void binary_connection::arm(stats::deadline d, long seconds)
+        {
+            timeout_ = d;
+            wheel_.set(shared_from_this(), seconds * 1000);
+        }
+
+        void binary_connection::arm_read()
+        {
+            if (frame_parser_.idle())
+                arm(stats::idle_deadline, DEADLINE_IDLE);
+            else if (frame_parser_.in_body())
+                arm(stats::body_deadline, DEADLINE_BODY);
+            else
+                arm(stats::header_deadline, DEADLINE_HEADER);
+        }
+
+        void binary_connection::expire(std::size_t armed)
+        {
+            strand_.post(boost::bind(&binary_connection::handle_deadline, shared_from_this(), armed));
+        }
+
+        void binary_connection::handle_deadline(std::size_t armed)
+        {
+            if (armed != this->armed())
+                return;
+
+            g_stats.timed_out(timeout_);
+
+            boost::system::error_code ignored_ec;
+            socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
+            socket_.close(ignored_ec);
+        }
+
+        template <typename Handler>
+        void binary_connection::async_read(Handler handler)
+        {
+            if (use_strand_)
+                socket_.async_read_some(boost::asio::buffer(buffer_),
+                                        strand_.wrap(make_custom_alloc_handler(allocator_, handler)));
+            else
+                socket_.async_read_some(boost::asio::buffer(buffer_),
+                                        make_custom_alloc_handler(allocator_, handler));
+        }
+
+        template <typename Handler>
+        void binary_connection::async_write(Handler handler)
+        {
+            if (use_strand_)
+                boost::asio::async_write(socket_, boost::asio::buffer(output_),
+                                         strand_.wrap(make_custom_alloc_handler(allocator_, handler)));
+            else
+                boost::asio::async_write(socket_, boost::asio::buffer(output_),
+                                         make_custom_alloc_handler(allocator_, handler));
+        }
+
+        void binary_connection::start()
+        {
+            open_ = true;
+            g_stats.connection_opened();
+
+            arm(stats::idle_deadline, DEADLINE_IDLE);
+            read();
+        }
+
+        void binary_connection::read()
+        {
+            async_read(boost::bind(&binary_connection::handle_read, shared_from_this(),
+                                   boost::asio::placeholders::error,
+                                   boost::asio::placeholders::bytes_transferred));
+        }
+
+        void binary_connection::handle_read(const boost::system::error_code& e,
+                                            std::size_t bytes_transferred)
+        {
+            if (e)
+                return;
+
+            g_stats.bytes_in(bytes_transferred);
+
+            // Serve every complete frame of this read before writing anything, so
+            // pipelined requests share one write.
+            const char* begin = buffer_.data();
+            const char* end = buffer_.data() + bytes_transferred;
+            while (begin != end)
+            {
+                boost::tribool result;
+                boost::tie(result, begin) = frame_parser_.parse(request_, begin, end);
+
+                if (result)
+                {
+                    request_handler_.handle_frame(request_, reply_);
+                    reply_.encode(output_);
+                }
+                else if (!result)
+                {
+                    // Framing is lost; there is no way to resynchronise.
+                    boost::system::error_code ignored_ec;
+                    socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
+                    return;
+                }
+            }
+
+            if (output_.empty())
+            {
+                // A stage keeps its deadline across the reads it takes.
+                if ((timeout_ == stats::idle_deadline) ||
+                    (frame_parser_.in_body() && (timeout_ == stats::header_deadline)))
+                    arm_read();
+                read();
+                return;
+            }
+
+            g_stats.bytes_out(output_.size());
+            arm(stats::write_deadline, DEADLINE_WRITE);
+            async_write(boost::bind(&binary_connection::handle_write, shared_from_this(),
+                                    boost::asio::placeholders::error));
+        }
+
+        void binary_connection::handle_write(const boost::system::error_code& e)
+        {
+            if (!e)
+            {
+                output_.clear();
+                arm_read();
+                read();
+            }
+
+            // On error no new asynchronous operations are started, so the last
+            // shared_ptr reference goes away and the destructor closes the socket.
+        }
+
+    } // namespace server3
+} // namespace http
@@ -0,0 +1,135 @@
+//
+// binary_connection.hpp
+// ~~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_BINARY_CONNECTION_HPP
+#define HTTP_SERVER3_BINARY_CONNECTION_HPP
+
+#include <string>
+#include <boost/asio.hpp>
+#include <boost/array.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include "frame.hpp"
+#include "frame_parser.hpp"
+#include "handler_allocator.hpp"
+#include "request_handler.hpp"
+#include "stats.hpp"
+#include "timer_wheel.hpp"
+
+namespace http {
+    namespace server3 {
+
+/// Represents a single binary protocol connection from a client. The
+/// connection is persistent: every complete frame found in a read is served in
+/// order and all of the responses are flushed with a single write. Between
+/// frames the connection may stay idle for DEADLINE_IDLE seconds; a frame
+/// started must be in within DEADLINE_HEADER seconds for its fixed header
+/// and DEADLINE_BODY more for its body, and responses written within
+/// DEADLINE_WRITE.
+        class binary_connection
+            : public boost::enable_shared_from_this<binary_connection>,
+              public timer_wheel::client,
+              private boost::noncopyable
+        {
+        public:
+            /// Construct a connection with the given io_service, whose deadlines are
+            /// kept by wheel. The strand may be skipped when the io_service is run
+            /// by a single thread.
+            binary_connection(boost::asio::io_service& io_service, request_handler& handler,
+                              timer_wheel& wheel, bool use_strand = true);
+
+            /// Destroy the connection.
+            ~binary_connection();
+
+            /// Get the socket associated with the connection.
+            boost::asio::ip::tcp::socket& socket();
+
+            /// Start the first asynchronous operation for the connection.
+            void start();
+
+            /// A deadline passed.
+            void expire(std::size_t armed);
+
+        private:
+            /// Start reading more frames.
+            void read();
+
+            /// Read into buffer_, through the strand if needed.
+            template <typename Handler>
+            void async_read(Handler handler);
+
+            /// Write output_, through the strand if needed.
+            template <typename Handler>
+            void async_write(Handler handler);
+
+            /// Handle completion of a read operation.
+            void handle_read(const boost::system::error_code& e,
+                             std::size_t bytes_transferred);
+
+            /// Handle completion of a write operation.
+            void handle_write(const boost::system::error_code& e);
+
+            /// Give the client seconds to get past a stage.
+            void arm(stats::deadline d, long seconds);
+
+            /// Arm the deadline of the stage the next frame is at.
+            void arm_read();
+
+            /// Close the connection if the deadline armed is still the current one.
+            void handle_deadline(std::size_t armed);
+
+            /// Strand to ensure the connection's handlers are not called concurrently.
+            boost::asio::io_service::strand strand_;
+
+            /// Whether handlers must be dispatched through strand_.
+            bool use_strand_;
+
+            /// Socket for the connection.
+            boost::asio::ip::tcp::socket socket_;
+
+            /// The handler used to process the incoming frames.
+            request_handler& request_handler_;
+
+            /// Keeps the deadlines of the connections of the io_service.
+            timer_wheel& wheel_;
+
+            /// The stage the current deadline limits.
+            stats::deadline timeout_;
+
+            /// Storage for the read and write handlers, so that the steady-state
+            /// read/write loop does not touch the heap.
+            handler_allocator allocator_;
+
+            /// Buffer for incoming data.
+            boost::array<char, 8192> buffer_;
+
+            /// The frame being received.
+            frame request_;
+
+            /// The response to the last frame.
+            frame reply_;
+
+            /// The parser for the incoming frames.
+            frame_parser frame_parser_;
+
+            /// Encoded responses waiting to be written.
+            std::string output_;
+
+            /// Whether start() was called.
+            bool open_;
+        };
+
+        typedef boost::shared_ptr<binary_connection> binary_connection_ptr;
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_BINARY_CONNECTION_HPP
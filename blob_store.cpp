@@ -0,0 +1,90 @@
+//
+// blob_store.cpp
+// ~~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <stdexcept>
+#include <boost/static_assert.hpp>
+#include <boost/uuid/detail/sha1.hpp>
+#include "blob_store.hpp"
+#include "soci-mysql.h"
+
+namespace http {
+    namespace server3 {
+
+        blob_store::blob_store(std::size_t threshold)
+            : threshold_(threshold)
+        {
+        }
+
+        bool blob_store::spill(soci::session& sql, const std::string& stored, std::string& ref) const
+        {
+            // A small item that looks like a reference is spilled as well, so
+            // that every row looking like one is one.
+            if (!spilled(stored) && ((threshold_ == 0) || (stored.size() < threshold_)))
+                return false;
+
+            boost::uuids::detail::sha1 sha;
+            boost::uuids::detail::sha1::digest_type digest;
+            sha.process_bytes(stored.data(), stored.size());
+            sha.get_digest(digest);
+
+            // Older Boost gives the digest as five 32 bit words, newer as twenty
+            // bytes. Words go out big endian, which is the byte order, so
+            // references stored by either build are found by the other.
+            const std::size_t width = sizeof(digest[0]);
+            BOOST_STATIC_ASSERT(sizeof(digest) == BLOB_DIGEST_SIZE);
+            BOOST_STATIC_ASSERT((sizeof(digest[0]) == 1) || (sizeof(digest[0]) == 4));
+
+            ref.assign(BLOB_MAGIC, BLOB_MAGIC_SIZE);
+            for (std::size_t i = 0; i < BLOB_DIGEST_SIZE / width; ++i)
+            {
+                for (std::size_t shift = 8 * width; shift > 0; shift -= 8)
+                    ref += static_cast<char>((digest[i] >> (shift - 8)) & 0xff);
+            }
+
+            std::string h(ref, BLOB_MAGIC_SIZE);
+            sql << "INSERT INTO b(h, n, d) VALUES (:h, 1, :d) ON DUPLICATE KEY UPDATE n = n + 1",
+                soci::use(h), soci::use(stored);
+            return true;
+        }
+
+        bool blob_store::spilled(const std::string& stored)
+        {
+            return (stored.size() == BLOB_REF_SIZE) &&
+                (stored.compare(0, BLOB_MAGIC_SIZE, BLOB_MAGIC, BLOB_MAGIC_SIZE) == 0);
+        }
+
+        void blob_store::fetch(soci::session& sql, std::string& stored, bool release)
+        {
+            if (!spilled(stored))
+                return;
+
+            std::string ref;
+            ref.swap(stored);
+            std::string h(ref, BLOB_MAGIC_SIZE);
+
+            // The item goes straight into the caller's buffer.
+            soci::indicator ind;
+            sql << "SELECT d FROM b WHERE h = :h", soci::use(h), soci::into(stored, ind);
+            if (!sql.got_data() || (ind != soci::i_ok))
+                throw std::runtime_error("blob: missing item for a spilled row");
+
+            if (release)
+                blob_store::release(sql, ref);
+        }
+
+        void blob_store::release(soci::session& sql, const std::string& ref)
+        {
+            std::string h(ref, BLOB_MAGIC_SIZE);
+            sql << "UPDATE b SET n = n - 1 WHERE h = :h", soci::use(h);
+            sql << "DELETE FROM b WHERE h = :h AND n = 0", soci::use(h);
+        }
+
+    } // namespace server3
+} // namespace http
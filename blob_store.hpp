@@ -0,0 +1,65 @@
+//
+// blob_store.hpp
+// ~~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_BLOB_STORE_HPP
+#define HTTP_SERVER3_BLOB_STORE_HPP
+
+#include <cstddef>
+#include <string>
+#include <boost/noncopyable.hpp>
+#include "soci.h"
+
+// A spilled item is stored in q as BLOB_MAGIC followed by the SHA-1 of its
+// stored form, the key of its row in b.
+#define BLOB_MAGIC          "\0B"
+#define BLOB_MAGIC_SIZE     2
+#define BLOB_DIGEST_SIZE    20
+#define BLOB_REF_SIZE       (BLOB_MAGIC_SIZE + BLOB_DIGEST_SIZE)
+
+namespace http {
+    namespace server3 {
+
+/// Large items kept out of the rows of q, so that its pages hold many rows
+/// and the head scans and counts touch few of them. The stored form of a
+/// large item goes to table b, keyed by its digest and counting the rows
+/// that refer to it, so equal items are stored once; the row in q keeps only
+/// the reference.
+        class blob_store
+            : private boost::noncopyable
+        {
+        public:
+            /// Spill stored items of at least threshold bytes; 0 disables spilling.
+            explicit blob_store(std::size_t threshold);
+
+            /// Store a stored item in b if it is large enough, or if it would
+            /// otherwise be taken for a reference, and set ref to the reference
+            /// the row keeps. Returns false if the item stays in the row. The
+            /// caller owns the transaction.
+            bool spill(soci::session& sql, const std::string& stored, std::string& ref) const;
+
+            /// Whether a row holds a reference rather than the item.
+            static bool spilled(const std::string& stored);
+
+            /// Replace a reference with the stored item it refers to, releasing
+            /// the reference if requested. Other items are left as they are.
+            /// Throws std::runtime_error if the item is missing.
+            static void fetch(soci::session& sql, std::string& stored, bool release);
+
+            /// Drop one reference, and the item with the last one.
+            static void release(soci::session& sql, const std::string& ref);
+
+        private:
+            std::size_t threshold_;
+        };
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_BLOB_STORE_HPP
@@ -0,0 +1,406 @@
+//
+// cluster.cpp
+// ~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/lexical_cast.hpp>
+#include "cluster.hpp"
+#include "globals.hpp"
+
+namespace http {
+    namespace server3 {
+
+        namespace {
+
+            /// Statuses a reply can carry; anything else is a bad gateway.
+            bool known(int status)
+            {
+                switch (status)
+                {
+                    case reply::ok:
+                    case reply::created:
+                    case reply::accepted:
+                    case reply::no_content:
+                    case reply::multiple_choices:
+                    case reply::moved_permanently:
+                    case reply::moved_temporarily:
+                    case reply::not_modified:
+                    case reply::bad_request:
+                    case reply::unauthorized:
+                    case reply::forbidden:
+                    case reply::not_found:
+                    case reply::method_not_allowed:
+                    case reply::internal_server_error:
+                    case reply::not_implemented:
+                    case reply::bad_gateway:
+                    case reply::service_unavailable:
+                        return true;
+                    default:
+                        return false;
+                }
+            }
+
+        } // namespace
+
+/// One request proxied to its owner: resolve, connect, send, then read the
+/// answer to the end (HTTP/1.0, the owner closes once it has answered). It
+/// runs on the io_service of the client's connection, in a strand of its
+/// own, and every step shares a single deadline.
+        class cluster::exchange
+            : public boost::enable_shared_from_this<exchange>,
+              private boost::noncopyable
+        {
+        public:
+            exchange(cluster& shard, boost::asio::io_service& io_service,
+                     const std::string& owner, const std::string& out, proxy_handler handler)
+                : shard_(shard),
+                  owner_(owner),
+                  out_(out),
+                  handler_(handler),
+                  strand_(io_service),
+                  resolver_(io_service),
+                  socket_(io_service),
+                  deadline_(io_service),
+                  expired_(false)
+            {
+            }
+
+            void start()
+            {
+                deadline_.expires_from_now(boost::posix_time::seconds(CLUSTER_TIMEOUT));
+                deadline_.async_wait(strand_.wrap(
+                                         boost::bind(&exchange::handle_deadline, shared_from_this(),
+                                                     boost::asio::placeholders::error)));
+
+                std::string::size_type colon = owner_.rfind(':');
+                boost::asio::ip::tcp::resolver::query query(owner_.substr(0, colon), owner_.substr(colon + 1));
+                resolver_.async_resolve(query, strand_.wrap(
+                                            boost::bind(&exchange::handle_resolve, shared_from_this(),
+                                                        boost::asio::placeholders::error,
+                                                        boost::asio::placeholders::iterator)));
+            }
+
+        private:
+            void handle_resolve(const boost::system::error_code& e,
+                                boost::asio::ip::tcp::resolver::iterator endpoints)
+            {
+                if (e || expired_)
+                    return finish(e);
+
+                boost::asio::async_connect(socket_, endpoints, strand_.wrap(
+                                               boost::bind(&exchange::handle_connect, shared_from_this(),
+                                                           boost::asio::placeholders::error)));
+            }
+
+            void handle_connect(const boost::system::error_code& e)
+            {
+                if (e || expired_)
+                    return finish(e);
+
+                boost::asio::async_write(socket_, boost::asio::buffer(out_), strand_.wrap(
+                                             boost::bind(&exchange::handle_write, shared_from_this(),
+                                                         boost::asio::placeholders::error)));
+            }
+
+            void handle_write(const boost::system::error_code& e)
+            {
+                if (e || expired_)
+                    return finish(e);
+
+                boost::asio::async_read(socket_, answer_, boost::asio::transfer_all(), strand_.wrap(
+                                            boost::bind(&exchange::handle_read, shared_from_this(),
+                                                        boost::asio::placeholders::error)));
+            }
+
+            void handle_read(const boost::system::error_code& e)
+            {
+                finish((e == boost::asio::error::eof) ? boost::system::error_code() : e);
+            }
+
+            void handle_deadline(const boost::system::error_code& e)
+            {
+                if (e == boost::asio::error::operation_aborted)
+                    return;
+
+                expired_ = true;
+                boost::system::error_code ignored_ec;
+                resolver_.cancel();
+                socket_.close(ignored_ec);
+            }
+
+            /// Hand the answer, or a bad gateway, to the connection.
+            void finish(boost::system::error_code e)
+            {
+                boost::system::error_code ignored_ec;
+                deadline_.cancel(ignored_ec);
+                socket_.close(ignored_ec);
+
+                if (expired_)
+                    e = boost::asio::error::timed_out;
+
+                reply rep;
+                if (e)
+                {
+                    LIERR("cluster: " + owner_ + ": " + e.message());
+                }
+                else
+                {
+                    std::string in(boost::asio::buffers_begin(answer_.data()),
+                                   boost::asio::buffers_end(answer_.data()));
+                    if (!parse_reply(in, rep))
+                    {
+                        LIERR("cluster: " + owner_ + ": malformed reply");
+                        e = boost::asio::error::invalid_argument;
+                    }
+                }
+
+                if (e)
+                {
+                    ++shard_.failed_;
+                    rep = reply::stock_reply(reply::bad_gateway);
+                }
+                else
+                {
+                    ++shard_.proxied_;
+                }
+                handler_(rep);
+            }
+
+            cluster& shard_;
+            std::string owner_;
+            std::string out_;
+            proxy_handler handler_;
+            boost::asio::io_service::strand strand_;
+            boost::asio::ip::tcp::resolver resolver_;
+            boost::asio::ip::tcp::socket socket_;
+            boost::asio::deadline_timer deadline_;
+            boost::asio::streambuf answer_;
+
+            /// The deadline passed; whatever completes next is a timeout.
+            bool expired_;
+        };
+
+        bool cluster::parse(const std::string& list, std::vector<std::string>& members)
+        {
+            members.clear();
+            if (list.empty())
+                return true;
+
+            std::string::size_type begin = 0;
+            while (begin <= list.size())
+            {
+                std::string::size_type end = list.find(',', begin);
+                if (end == std::string::npos)
+                    end = list.size();
+
+                std::string member(list, begin, end - begin);
+                std::string::size_type colon = member.rfind(':');
+                if ((colon == std::string::npos) || (colon == 0) || (colon + 1 == member.size()))
+                    return false;
+                try
+                {
+                    int port = boost::lexical_cast<int>(member.substr(colon + 1));
+                    if ((port <= 0) || (port > 65535))
+                        return false;
+                }
+                catch (boost::bad_lexical_cast&)
+                {
+                    return false;
+                }
+
+                if (std::find(members.begin(), members.end(), member) != members.end())
+                    return false;
+                members.push_back(member);
+
+                begin = end + 1;
+            }
+
+            return members.size() <= CLUSTER_MAX_MEMBERS;
+        }
+
+        cluster::cluster(const settings& cfg)
+            : self_(cfg.self),
+              proxy_(cfg.proxy),
+              redirected_(0),
+              proxied_(0),
+              failed_(0)
+        {
+            if (!parse(cfg.cluster, members_))
+                throw std::invalid_argument("invalid cluster members: " + cfg.cluster);
+
+            if (enabled() && (std::find(members_.begin(), members_.end(), self_) == members_.end()))
+                throw std::invalid_argument("not a cluster member: " + self_);
+
+            // Points depend on the member name only, so every node builds the
+            // same ring from the same list, in any order.
+            for (std::size_t i = 0; i < members_.size(); ++i)
+            {
+                for (std::size_t j = 0; j < CLUSTER_POINTS; ++j)
+                {
+                    std::string point(members_[i] + "#" + boost::lexical_cast<std::string>(j));
+                    ring_[hash(point)] = i;
+                }
+            }
+        }
+
+        const std::string& cluster::owner(const std::string& key) const
+        {
+            std::map<boost::uint64_t, std::size_t>::const_iterator i = ring_.lower_bound(hash(key));
+            if (i == ring_.end())
+                i = ring_.begin();
+            return members_[i->second];
+        }
+
+        bool cluster::forward(const request& req, const std::string& key, reply& rep)
+        {
+            if (!enabled() || req.find_header(CLUSTER_FORWARDED))
+                return false;
+
+            const std::string& to = owner(key);
+            if (to == self_)
+                return false;
+
+            req.timing.op = -1;
+
+            if (proxy_)
+            {
+                rep.proxy_to = to;
+                return true;
+            }
+
+            ++redirected_;
+            rep = reply::stock_reply(reply::moved_temporarily);
+
+            header hl;
+            hl.name = LOCATION;
+            hl.value = "http://" + to + req.uri;
+            rep.headers.push_back(hl);
+
+            return true;
+        }
+
+        void cluster::report(std::string& out, bool prometheus) const
+        {
+            if (!enabled())
+                return;
+
+            std::stringstream s;
+            if (prometheus)
+            {
+                s << "# TYPE lisa_cluster_members gauge\n"
+                  << "lisa_cluster_members " << members_.size() << "\n"
+                  << "# TYPE lisa_cluster_redirected_total counter\n"
+                  << "lisa_cluster_redirected_total " << redirected_.load() << "\n"
+                  << "# TYPE lisa_cluster_proxied_total counter\n"
+                  << "lisa_cluster_proxied_total " << proxied_.load() << "\n"
+                  << "# TYPE lisa_cluster_proxy_failures_total counter\n"
+                  << "lisa_cluster_proxy_failures_total " << failed_.load() << "\n";
+            }
+            else
+            {
+                s << "cluster members=" << members_.size()
+                  << " self=" << self_
+                  << " redirected=" << redirected_.load()
+                  << " proxied=" << proxied_.load()
+                  << " failures=" << failed_.load() << "\n";
+            }
+            out += s.str();
+        }
+
+        void cluster::proxy(boost::asio::io_service& io_service, const request& req,
+                            const std::string& owner, proxy_handler handler)
+        {
+            boost::make_shared<exchange>(boost::ref(*this), boost::ref(io_service),
+                                         owner, message(req, owner), handler)->start();
+        }
+
+        std::string cluster::message(const request& req, const std::string& owner) const
+        {
+            std::string out;
+            out.reserve(256 + req.post_data.size());
+            out += req.method + " " + req.uri + " HTTP/1.0\r\n";
+            out += "Host: " + owner + "\r\n";
+            out += CLUSTER_FORWARDED;
+            out += ": " + self_ + "\r\n";
+            for (std::size_t i = 0; i < req.headers.size(); ++i)
+            {
+                const header& h = req.headers[i];
+                if (boost::algorithm::iequals(h.name, "Host") ||
+                    boost::algorithm::iequals(h.name, "Connection"))
+                    continue;
+                out += h.name + ": " + h.value + "\r\n";
+            }
+            out += "\r\n";
+            out += req.post_data;
+            return out;
+        }
+
+        bool cluster::parse_reply(const std::string& in, reply& rep)
+        {
+            // Status line, headers, body.
+            std::string::size_type end = in.find("\r\n\r\n");
+            std::string::size_type line = in.find("\r\n");
+            std::string::size_type space = in.find(' ');
+            if ((end == std::string::npos) || (space == std::string::npos) || (space > line))
+                return false;
+
+            int status = std::atoi(in.c_str() + space + 1);
+            if (!known(status))
+                status = reply::bad_gateway;
+
+            rep.clear();
+            rep.status = static_cast<reply::status_type>(status);
+            while (line < end)
+            {
+                std::string::size_type next = in.find("\r\n", line + 2);
+                std::string::size_type colon = in.find(':', line + 2);
+                if ((colon != std::string::npos) && (colon < next))
+                {
+                    header h;
+                    h.name.assign(in, line + 2, colon - line - 2);
+                    std::string::size_type value = in.find_first_not_of(' ', colon + 1);
+                    h.value.assign(in, value, next - value);
+                    if (!boost::algorithm::iequals(h.name, "Server") &&
+                        !boost::algorithm::iequals(h.name, "Connection"))
+                        rep.headers.push_back(h);
+                }
+                line = next;
+            }
+            rep.content.assign(in, end + 4, std::string::npos);
+
+            return true;
+        }
+
+        boost::uint64_t cluster::hash(const std::string& key)
+        {
+            boost::uint64_t h = 14695981039346656037ULL;
+            for (std::size_t i = 0; i < key.size(); ++i)
+            {
+                h ^= static_cast<unsigned char>(key[i]);
+                h *= 1099511628211ULL;
+            }
+
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ULL;
+            h ^= h >> 33;
+            return h;
+        }
+
+    } // namespace server3
+} // namespace http
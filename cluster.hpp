@@ -0,0 +1,111 @@
+//
+// cluster.hpp
+// ~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_CLUSTER_HPP
+#define HTTP_SERVER3_CLUSTER_HPP
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include "reply.hpp"
+#include "request.hpp"
+#include "settings.hpp"
+
+#define CLUSTER_MAX_MEMBERS     256
+#define CLUSTER_POINTS          128     // ring points per member
+#define CLUSTER_TIMEOUT         5       // seconds to wait for the owner when proxying
+#define CLUSTER_FORWARDED       "X-Lisa-Forwarded"
+#define LOCATION                "Location"
+
+namespace http {
+    namespace server3 {
+
+/// Cluster mode. Every node gets the same static member list, and topics
+/// are mapped to members by a consistent-hash ring: each member owns the
+/// ranges before its CLUSTER_POINTS points, so adding or removing a member
+/// only moves the topics of the ranges it gains or loses. A request for a
+/// topic owned by another member is redirected there (302 and Location),
+/// or proxied to it without blocking the I/O thread. A request already
+/// forwarded once is always served locally, so members with different
+/// lists cannot bounce it around.
+        class cluster
+            : private boost::noncopyable
+        {
+        public:
+            /// Parse a member list "host:port,host:port,...". An empty list is
+            /// no cluster. Returns false if invalid.
+            static bool parse(const std::string& list, std::vector<std::string>& members);
+
+            /// Construct from cfg.cluster, already checked with parse, with
+            /// cfg.self naming this member.
+            explicit cluster(const settings& cfg);
+
+            /// Whether cluster mode is on.
+            bool enabled() const
+            {
+                return !members_.empty();
+            }
+
+            /// The member owning a key.
+            const std::string& owner(const std::string& key) const;
+
+            /// Called with the answer of the owner of a proxied request, or a 502.
+            typedef boost::function<void (const reply&)> proxy_handler;
+
+            /// If another member owns the key and the request was not forwarded
+            /// already, return true with rep redirecting the request there, or
+            /// naming the member to proxy it to in rep.proxy_to.
+            bool forward(const request& req, const std::string& key, reply& rep);
+
+            /// Send a request to its owner and call handler with the answer, all
+            /// asynchronously on io_service, within CLUSTER_TIMEOUT.
+            void proxy(boost::asio::io_service& io_service, const request& req,
+                       const std::string& owner, proxy_handler handler);
+
+            /// Append the current state to a /stats report.
+            void report(std::string& out, bool prometheus) const;
+
+        private:
+            /// One request proxied to its owner.
+            class exchange;
+
+            /// The request as sent to its owner.
+            std::string message(const request& req, const std::string& owner) const;
+
+            /// Copy the answer of an owner into rep. Returns false if it is
+            /// malformed.
+            static bool parse_reply(const std::string& in, reply& rep);
+
+            /// 64 bit FNV-1a, finished with a mixer so that similar names
+            /// land far apart on the ring.
+            static boost::uint64_t hash(const std::string& key);
+
+            std::vector<std::string> members_;
+            std::string self_;
+            bool proxy_;
+
+            /// Ring point to index in members_.
+            std::map<boost::uint64_t, std::size_t> ring_;
+
+            boost::atomic<boost::uint64_t> redirected_;
+            boost::atomic<boost::uint64_t> proxied_;
+            boost::atomic<boost::uint64_t> failed_;
+        };
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_CLUSTER_HPP
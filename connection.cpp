@@ -8,34 +8,229 @@
 // file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 //
 
+#include <algorithm>
+#include <cstdio>
+#include <limits>
 #include <vector>
 #include <boost/bind.hpp>
 #include "connection.hpp"
+#include "globals.hpp"
 #include "request_handler.hpp"
 
 namespace http {
     namespace server3 {
 
-        connection::connection(boost::asio::io_service& io_service,
-                               request_handler& handler)
-            : strand_(io_service),
+        connection::connection(boost::asio::io_service& io_service, request_handler& handler,
+                               timer_wheel& wheel, bool use_strand, uring* ring)
+            : io_service_(io_service),
+              strand_(io_service),
+              use_strand_(use_strand),
               socket_(io_service),
-              request_handler_(handler)
+              ring_(ring),
+              stream_(0),
+              request_handler_(handler),
+              wheel_(wheel),
+              timeout_(stats::idle_deadline),
+              request_(arena_),
+              reply_(arena_),
+              open_(false),
+              started_(0),
+              write_started_(0),
+              timer_(io_service),
+              poll_ms_(STREAM_POLL_MIN),
+              pending_(false),
+              streaming_(false),
+              ending_(false),
+              stopped_(false),
+              credit_(0),
+              grant_(0)
         {
         }
 
+        connection::~connection()
+        {
+            closed();
+        }
+
+        void connection::closed()
+        {
+            if (open_)
+            {
+                open_ = false;
+                g_stats.connection_closed();
+            }
+        }
+
         boost::asio::ip::tcp::socket& connection::socket()
         {
             return socket_;
         }
 
+        void connection::arm(stats::deadline d, long seconds)
+        {
+            timeout_ = d;
+            wheel_.set(shared_from_this(), seconds * 1000);
+        }
+
+        void connection::disarm()
+        {
+            wheel_.set(shared_from_this(), 0);
+        }
+
+        void connection::expire(std::size_t armed)
+        {
+            // Through the strand even without concurrent handlers: the wheel
+            // runs on whichever thread its timer fires.
+            strand_.post(boost::bind(&connection::handle_deadline, shared_from_this(), armed));
+        }
+
+        void connection::handle_deadline(std::size_t armed)
+        {
+            if ((armed != this->armed()) || stopped_)
+                return;
+
+            g_stats.timed_out(timeout_);
+
+            // A client out of credit still gets a complete stream; one that
+            // does not read what is written is cut.
+            if (streaming_ && (timeout_ == stats::idle_deadline))
+            {
+                end_stream();
+                return;
+            }
+
+            // Closing ends every outstanding operation, streamed or not.
+            stop_stream();
+        }
+
+        void connection::drain()
+        {
+            strand_.post(boost::bind(&connection::handle_drain, shared_from_this()));
+        }
+
+        void connection::handle_drain()
+        {
+            if (streaming_)
+                end_stream();
+        }
+
+        void connection::reset()
+        {
+            boost::system::error_code ignored_ec;
+            socket_.close(ignored_ec);
+            if (stream_)
+            {
+                ring_->release(stream_);
+                stream_ = 0;
+            }
+            closed();
+            forget();
+            timeout_ = stats::idle_deadline;
+            started_ = 0;
+            write_started_ = 0;
+            timer_.cancel(ignored_ec);
+            poll_ms_ = STREAM_POLL_MIN;
+            pending_ = false;
+            streaming_ = false;
+            ending_ = false;
+            stopped_ = false;
+            credit_ = 0;
+            grant_ = 0;
+            items_.clear();
+            chunk_sizes_.clear();
+            chunks_.clear();
+            request_parser_.reset();
+            request_.clear();
+            reply_.clear();
+            arena_.reset();
+        }
+
+        template <typename Handler>
+        void connection::async_read(Handler handler)
+        {
+            if (stream_)
+            {
+                if (use_strand_)
+                    ring_->async_read_some(stream_, buffer_.data(), buffer_.size(), read_allocator_,
+                                           strand_.wrap(make_custom_alloc_handler(read_allocator_, handler)));
+                else
+                    ring_->async_read_some(stream_, buffer_.data(), buffer_.size(), read_allocator_,
+                                           handler);
+                return;
+            }
+
+            if (use_strand_)
+                socket_.async_read_some(boost::asio::buffer(buffer_),
+                                        strand_.wrap(make_custom_alloc_handler(read_allocator_, handler)));
+            else
+                socket_.async_read_some(boost::asio::buffer(buffer_),
+                                        make_custom_alloc_handler(read_allocator_, handler));
+        }
+
+        template <typename Buffers, typename Handler>
+        void connection::async_write(const Buffers& buffers, Handler handler)
+        {
+            if (stream_)
+            {
+                if (use_strand_)
+                    ring_->async_write(stream_, buffers, allocator_,
+                                       strand_.wrap(make_custom_alloc_handler(allocator_, handler)));
+                else
+                    ring_->async_write(stream_, buffers, allocator_, handler);
+                return;
+            }
+
+            if (use_strand_)
+                boost::asio::async_write(socket_, buffers,
+                                         strand_.wrap(make_custom_alloc_handler(allocator_, handler)));
+            else
+                boost::asio::async_write(socket_, buffers,
+                                         make_custom_alloc_handler(allocator_, handler));
+        }
+
+        void connection::shutdown()
+        {
+            boost::system::error_code ignored_ec;
+            if (stream_)
+                ring_->shutdown(stream_);
+            else
+                socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
+        }
+
+        void connection::close()
+        {
+            // The ring closes its socket once the connection lets it go.
+            boost::system::error_code ignored_ec;
+            if (stream_)
+                ring_->shutdown(stream_);
+            else
+                socket_.close(ignored_ec);
+        }
+
+        template <typename Handler>
+        void connection::async_wait(Handler handler)
+        {
+            if (use_strand_)
+                timer_.async_wait(strand_.wrap(make_custom_alloc_handler(allocator_, handler)));
+            else
+                timer_.async_wait(make_custom_alloc_handler(allocator_, handler));
+        }
+
         void connection::start()
         {
-            socket_.async_read_some(boost::asio::buffer(buffer_),
-                                    strand_.wrap(
-                                        boost::bind(&connection::handle_read, shared_from_this(),
-                                                    boost::asio::placeholders::error,
-                                                    boost::asio::placeholders::bytes_transferred)));
+            open_ = true;
+            g_stats.connection_opened();
+
+            arm(stats::idle_deadline, DEADLINE_IDLE);
+            async_read(boost::bind(&connection::handle_read, shared_from_this(),
+                                   boost::asio::placeholders::error,
+                                   boost::asio::placeholders::bytes_transferred));
+        }
+
+        void connection::start(int fd)
+        {
+            stream_ = ring_->open(fd);
+            start();
         }
 
         void connection::handle_read(const boost::system::error_code& e,
@@ -43,33 +238,56 @@ namespace http {
         {
             if (!e)
             {
+                if (!started_)
+                {
+                    started_ = stats::now();
+                    arm(stats::header_deadline, DEADLINE_HEADER);
+                }
+                g_stats.bytes_in(bytes_transferred);
+
                 boost::tribool result;
                 boost::tie(result, boost::tuples::ignore) = request_parser_.parse(
                     request_, buffer_.data(), buffer_.data() + bytes_transferred);
 
                 if (result)
                 {
+                    request_.timing.ns[stats::parse] = stats::now() - started_;
                     request_handler_.handle_request(request_, reply_);
-                    boost::asio::async_write(socket_, reply_.to_buffers(),
-                                             strand_.wrap(
-                                                 boost::bind(&connection::handle_write, shared_from_this(),
-                                                             boost::asio::placeholders::error)));
+                    if (!reply_.proxy_to.empty())
+                    {
+                        // The owner answers within CLUSTER_TIMEOUT, under
+                        // DEADLINE_WRITE; the I/O thread serves others meanwhile.
+                        arm(stats::write_deadline, DEADLINE_WRITE);
+                        cluster::proxy_handler handler(boost::bind(&connection::handle_proxy,
+                                                                   shared_from_this(), _1));
+                        if (use_strand_)
+                            handler = strand_.wrap(handler);
+                        request_handler_.handle_proxy(io_service_, request_, reply_, handler);
+                        return;
+                    }
+                    write_started_ = stats::now();
+                    arm(stats::write_deadline, DEADLINE_WRITE);
+                    async_write(reply_.to_buffers(), boost::bind(&connection::handle_write, shared_from_this(),
+                                            boost::asio::placeholders::error,
+                                            boost::asio::placeholders::bytes_transferred));
                 }
                 else if (!result)
                 {
                     reply_ = reply::stock_reply(reply::bad_request);
-                    boost::asio::async_write(socket_, reply_.to_buffers(),
-                                             strand_.wrap(
-                                                 boost::bind(&connection::handle_write, shared_from_this(),
-                                                             boost::asio::placeholders::error)));
+                    write_started_ = stats::now();
+                    arm(stats::write_deadline, DEADLINE_WRITE);
+                    async_write(reply_.to_buffers(), boost::bind(&connection::handle_write, shared_from_this(),
+                                            boost::asio::placeholders::error,
+                                            boost::asio::placeholders::bytes_transferred));
                 }
                 else
                 {
-                    socket_.async_read_some(boost::asio::buffer(buffer_),
-                                            strand_.wrap(
-                                                boost::bind(&connection::handle_read, shared_from_this(),
-                                                            boost::asio::placeholders::error,
-                                                            boost::asio::placeholders::bytes_transferred)));
+                    // The body gets its own time once the headers are in.
+                    if (request_parser_.in_body() && (timeout_ == stats::header_deadline))
+                        arm(stats::body_deadline, DEADLINE_BODY);
+                    async_read(boost::bind(&connection::handle_read, shared_from_this(),
+                                           boost::asio::placeholders::error,
+                                           boost::asio::placeholders::bytes_transferred));
                 }
             }
 
@@ -79,13 +297,37 @@ namespace http {
             // handler returns. The connection class's destructor closes the socket.
         }
 
-        void connection::handle_write(const boost::system::error_code& e)
+        void connection::handle_proxy(const reply& answer)
         {
+            reply_ = answer;
+            write_started_ = stats::now();
+            async_write(reply_.to_buffers(), boost::bind(&connection::handle_write, shared_from_this(),
+                                    boost::asio::placeholders::error,
+                                    boost::asio::placeholders::bytes_transferred));
+        }
+
+        void connection::handle_write(const boost::system::error_code& e,
+                                      std::size_t bytes_transferred)
+        {
+            boost::uint64_t finished = stats::now();
+            request_.timing.ns[stats::write] = finished - write_started_;
+            request_.timing.ns[stats::total] = finished - started_;
+            g_stats.record(request_.timing);
+            g_stats.status(reply_.status);
+            g_stats.bytes_out(bytes_transferred);
+
+            disarm();
+
+            if (!e && reply_.stream_window)
+            {
+                start_stream();
+                return;
+            }
+
             if (!e)
             {
                 // Initiate graceful connection closure.
-                boost::system::error_code ignored_ec;
-                socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
+                shutdown();
             }
 
             // No new asynchronous operations are started. This means that all shared_ptr
@@ -94,5 +336,204 @@ namespace http {
             // destructor closes the socket.
         }
 
+        void connection::start_stream()
+        {
+            streaming_ = true;
+            credit_ = reply_.stream_credit;
+
+            // The client may grant more credit at any time, and its closing
+            // the connection ends the stream.
+            async_read(boost::bind(&connection::handle_credit, shared_from_this(),
+                                   boost::asio::placeholders::error,
+                                   boost::asio::placeholders::bytes_transferred));
+            next_batch();
+        }
+
+        void connection::next_batch()
+        {
+            pending_ = false;
+
+            std::size_t n = std::min(reply_.stream_window, credit_);
+            if (stopped_ || ending_)
+                return;
+
+            // A client out of credit has as long to grant more as an idle one.
+            if (n == 0)
+            {
+                arm(stats::idle_deadline, DEADLINE_IDLE);
+                return;
+            }
+
+            items_.clear();
+            if (!request_handler_.handle_stream(request_, n, items_))
+            {
+                end_stream();
+                return;
+            }
+
+            pending_ = true;
+
+            if (items_.empty())
+            {
+                disarm();
+                timer_.expires_from_now(boost::posix_time::milliseconds(poll_ms_));
+                poll_ms_ = std::min(poll_ms_ * 2, static_cast<long>(STREAM_POLL_MAX));
+                async_wait(boost::bind(&connection::handle_poll, shared_from_this(),
+                                       boost::asio::placeholders::error));
+                return;
+            }
+
+            poll_ms_ = STREAM_POLL_MIN;
+            if (credit_ != std::numeric_limits<std::size_t>::max())
+                credit_ -= items_.size();
+
+            // One chunk per item, all of them in a single gathered write. The
+            // size lines are laid out first so that the buffers stay valid.
+            static const char crlf[] = { '\r', '\n' };
+            std::vector<std::size_t> offsets;
+            chunk_sizes_.clear();
+            for (std::size_t i = 0; i < items_.size(); ++i)
+            {
+                char line[32];
+                int size = std::sprintf(line, "%lx\r\n", static_cast<unsigned long>(items_[i].size()));
+                offsets.push_back(chunk_sizes_.size());
+                chunk_sizes_.append(line, size);
+            }
+            offsets.push_back(chunk_sizes_.size());
+
+            chunks_.clear();
+            for (std::size_t i = 0; i < items_.size(); ++i)
+            {
+                chunks_.push_back(boost::asio::buffer(chunk_sizes_.data() + offsets[i],
+                                                      offsets[i + 1] - offsets[i]));
+                chunks_.push_back(boost::asio::buffer(items_[i]));
+                chunks_.push_back(boost::asio::buffer(crlf));
+            }
+
+            arm(stats::write_deadline, DEADLINE_WRITE);
+            async_write(chunks_, boost::bind(&connection::handle_stream_write, shared_from_this(),
+                                             boost::asio::placeholders::error,
+                                             boost::asio::placeholders::bytes_transferred));
+        }
+
+        void connection::handle_stream_write(const boost::system::error_code& e,
+                                             std::size_t bytes_transferred)
+        {
+            g_stats.bytes_out(bytes_transferred);
+
+            if (e)
+            {
+                stop_stream();
+                return;
+            }
+
+            if (ending_)
+                finish_stream();
+            else
+                next_batch();
+        }
+
+        void connection::handle_poll(const boost::system::error_code& e)
+        {
+            // An ending stream cancels its poll.
+            if (ending_)
+                finish_stream();
+            else if (!e)
+                next_batch();
+        }
+
+        void connection::handle_credit(const boost::system::error_code& e,
+                                       std::size_t bytes_transferred)
+        {
+            // A client that stops granting credit may still read the end.
+            if (e)
+            {
+                end_stream();
+                return;
+            }
+
+            g_stats.bytes_in(bytes_transferred);
+
+            // Credit comes as decimal numbers, one per line.
+            const std::size_t max = std::numeric_limits<std::size_t>::max();
+            for (std::size_t i = 0; i < bytes_transferred; ++i)
+            {
+                char c = buffer_[i];
+                if ((c >= '0') && (c <= '9'))
+                {
+                    grant_ = (grant_ > (max - 9) / 10) ? max : grant_ * 10 + (c - '0');
+                }
+                else if (c == '\n')
+                {
+                    credit_ = (credit_ > max - grant_) ? max : credit_ + grant_;
+                    grant_ = 0;
+                }
+            }
+
+            // Resume a stream that ran out of credit.
+            if (!pending_)
+                next_batch();
+
+            async_read(boost::bind(&connection::handle_credit, shared_from_this(),
+                                   boost::asio::placeholders::error,
+                                   boost::asio::placeholders::bytes_transferred));
+        }
+
+        void connection::end_stream()
+        {
+            if (stopped_ || ending_)
+                return;
+            ending_ = true;
+
+            if (!pending_)
+            {
+                finish_stream();
+                return;
+            }
+
+            // A write in flight is followed by the last chunk; a poll is cut
+            // short.
+            boost::system::error_code ignored_ec;
+            timer_.cancel(ignored_ec);
+        }
+
+        void connection::finish_stream()
+        {
+            if (stopped_)
+                return;
+
+            static const char last_chunk[] = { '0', '\r', '\n', '\r', '\n' };
+            pending_ = true;
+            arm(stats::write_deadline, DEADLINE_WRITE);
+            async_write(boost::asio::buffer(last_chunk),
+                        boost::bind(&connection::handle_last_chunk, shared_from_this(),
+                                    boost::asio::placeholders::error,
+                                    boost::asio::placeholders::bytes_transferred));
+        }
+
+        void connection::handle_last_chunk(const boost::system::error_code& e,
+                                           std::size_t bytes_transferred)
+        {
+            g_stats.bytes_out(bytes_transferred);
+
+            // The stream is complete either way.
+            (void)e;
+            stop_stream();
+        }
+
+        void connection::stop_stream()
+        {
+            if (stopped_)
+                return;
+            stopped_ = true;
+
+            // Outstanding operations complete with an error and let go of the
+            // connection.
+            boost::system::error_code ignored_ec;
+            timer_.cancel(ignored_ec);
+            shutdown();
+            close();
+        }
+
     } // namespace server3
 } // namespace http
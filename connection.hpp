@@ -11,28 +11,48 @@
 #ifndef HTTP_SERVER3_CONNECTION_HPP
 #define HTTP_SERVER3_CONNECTION_HPP
 
+#include <string>
+#include <vector>
 #include <boost/asio.hpp>
 #include <boost/array.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include "arena.hpp"
+#include "handler_allocator.hpp"
 #include "reply.hpp"
 #include "request.hpp"
 #include "request_handler.hpp"
 #include "request_parser.hpp"
+#include "stats.hpp"
+#include "timer_wheel.hpp"
+#include "uring.hpp"
+
+#define STREAM_POLL_MIN     5
+#define STREAM_POLL_MAX     500
 
 namespace http {
     namespace server3 {
 
-/// Represents a single connection from a client.
+/// Represents a single connection from a client. A client gets
+/// DEADLINE_IDLE seconds to start a request, DEADLINE_HEADER more for its
+/// headers, DEADLINE_BODY more for its body and DEADLINE_WRITE to take each
+/// write of the reply, or the connection is closed.
         class connection
             : public boost::enable_shared_from_this<connection>,
+              public timer_wheel::client,
               private boost::noncopyable
         {
         public:
-            /// Construct a connection with the given io_service.
-            explicit connection(boost::asio::io_service& io_service,
-                                request_handler& handler);
+            /// Construct a connection with the given io_service, whose deadlines are
+            /// kept by wheel. The strand may be skipped when the io_service is run
+            /// by a single thread. With ring, the socket is read and written
+            /// through io_uring instead of socket().
+            connection(boost::asio::io_service& io_service, request_handler& handler,
+                       timer_wheel& wheel, bool use_strand = true, uring* ring = 0);
+
+            /// Destroy the connection.
+            ~connection();
 
             /// Get the socket associated with the connection.
             boost::asio::ip::tcp::socket& socket();
@@ -40,26 +60,135 @@ namespace http {
             /// Start the first asynchronous operation for the connection.
             void start();
 
+            /// Start the connection on the socket fd accepted through the ring.
+            void start(int fd);
+
+            /// Close the socket and forget the last request so the object can be
+            /// reused for another client.
+            void reset();
+
+            /// A deadline passed.
+            void expire(std::size_t armed);
+
+            /// End the stream, if the connection is one, as the server hands
+            /// over to its successor.
+            void drain();
+
         private:
+            /// Read into buffer_, through the strand if needed.
+            template <typename Handler>
+            void async_read(Handler handler);
+
+            /// Write buffers, through the strand if needed.
+            template <typename Buffers, typename Handler>
+            void async_write(const Buffers& buffers, Handler handler);
+
+            /// Shut the socket down: the reads and writes in flight complete.
+            void shutdown();
+
+            /// Close the socket, ending the reads and writes in flight.
+            void close();
+
+            /// Wait for timer_, through the strand if needed.
+            template <typename Handler>
+            void async_wait(Handler handler);
+
             /// Handle completion of a read operation.
             void handle_read(const boost::system::error_code& e,
                              std::size_t bytes_transferred);
 
+            /// Send the answer of the member a request was passed on to.
+            void handle_proxy(const reply& answer);
+
             /// Handle completion of a write operation.
-            void handle_write(const boost::system::error_code& e);
+            void handle_write(const boost::system::error_code& e,
+                              std::size_t bytes_transferred);
+
+            /// Account for the end of a client connection, once.
+            void closed();
+
+            /// Give the client seconds to get past a stage, or no limit.
+            void arm(stats::deadline d, long seconds);
+            void disarm();
+
+            /// Close the connection if the deadline armed is still the current one.
+            /// A stream whose client ran out of credit is ended instead.
+            void handle_deadline(std::size_t armed);
+
+            /// Handle the server handing over to its successor.
+            void handle_drain();
+
+            /// Turn the connection into a stream of items, once its headers
+            /// are sent.
+            void start_stream();
+
+            /// Send the next batch of items, or poll again later when there is
+            /// none, unless the client has no credit left.
+            void next_batch();
+
+            /// Handle completion of a batch write.
+            void handle_stream_write(const boost::system::error_code& e,
+                                     std::size_t bytes_transferred);
+
+            /// Handle the end of a wait for items.
+            void handle_poll(const boost::system::error_code& e);
+
+            /// Handle credit granted by the client, or its going away.
+            void handle_credit(const boost::system::error_code& e,
+                               std::size_t bytes_transferred);
+
+            /// End the stream with its last chunk, once the write or poll in
+            /// flight completes.
+            void end_stream();
+
+            /// Write the last chunk.
+            void finish_stream();
+
+            /// Handle completion of the last chunk write.
+            void handle_last_chunk(const boost::system::error_code& e,
+                                   std::size_t bytes_transferred);
+
+            /// Close the stream: no new operation is started after this.
+            void stop_stream();
+
+            /// The io_service the connection runs on.
+            boost::asio::io_service& io_service_;
 
             /// Strand to ensure the connection's handlers are not called concurrently.
             boost::asio::io_service::strand strand_;
 
+            /// Whether handlers must be dispatched through strand_.
+            bool use_strand_;
+
             /// Socket for the connection.
             boost::asio::ip::tcp::socket socket_;
 
+            /// The io_uring transport and the socket on it, instead of socket_.
+            uring* ring_;
+            uring::stream* stream_;
+
             /// The handler used to process the incoming request.
             request_handler& request_handler_;
 
+            /// Keeps the deadlines of the connections of the io_service.
+            timer_wheel& wheel_;
+
+            /// The stage the current deadline limits.
+            stats::deadline timeout_;
+
+            /// Storage for the read handlers, and for the write and poll handlers,
+            /// so that the steady-state read/write loop does not touch the heap.
+            /// A stream keeps its credit read in flight with a write or a poll,
+            /// so the two chains cannot share one allocator.
+            handler_allocator read_allocator_;
+            handler_allocator allocator_;
+
             /// Buffer for incoming data.
             boost::array<char, 8192> buffer_;
 
+            /// Storage for the request and reply headers, reset between requests.
+            arena arena_;
+
             /// The incoming request.
             request request_;
 
@@ -68,6 +197,44 @@ namespace http {
 
             /// The reply to be sent back to the client.
             reply reply_;
+
+            /// Whether start() was called since construction or the last reset().
+            bool open_;
+
+            /// When the first bytes of the request arrived.
+            boost::uint64_t started_;
+
+            /// When the reply write was started.
+            boost::uint64_t write_started_;
+
+            /// Timer between polls of an empty queue while streaming.
+            boost::asio::deadline_timer timer_;
+
+            /// Current poll interval in milliseconds.
+            long poll_ms_;
+
+            /// Whether a stream write or poll wait is in flight.
+            bool pending_;
+
+            /// Whether the reply headers are sent and items are streamed.
+            bool streaming_;
+
+            /// Whether the stream is ending with its last chunk.
+            bool ending_;
+
+            /// Whether the stream ended.
+            bool stopped_;
+
+            /// Items the client still accepts (max means no limit).
+            std::size_t credit_;
+
+            /// Credit digits read so far, not yet ended by a newline.
+            std::size_t grant_;
+
+            /// The batch being written, with its chunk size lines.
+            std::vector<std::string> items_;
+            std::string chunk_sizes_;
+            std::vector<boost::asio::const_buffer> chunks_;
         };
 
         typedef boost::shared_ptr<connection> connection_ptr;
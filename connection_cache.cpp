@@ -0,0 +1,81 @@
+//
+// connection_cache.cpp
+// ~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <boost/bind.hpp>
+#include "connection_cache.hpp"
+
+namespace http {
+    namespace server3 {
+
+        connection_cache::connection_cache(boost::asio::io_service& io_service,
+                                           request_handler& handler, timer_wheel& wheel, bool use_strand,
+                                           uring* ring, std::size_t max_size)
+            : io_service_(io_service),
+              request_handler_(handler),
+              wheel_(wheel),
+              use_strand_(use_strand),
+              ring_(ring),
+              max_size_(max_size)
+        {
+        }
+
+        connection_cache::~connection_cache()
+        {
+            for (std::size_t i = 0; i < free_.size(); ++i)
+                delete free_[i];
+        }
+
+        connection_ptr connection_cache::acquire()
+        {
+            connection* c = 0;
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                if (!free_.empty())
+                {
+                    c = free_.back();
+                    free_.pop_back();
+                }
+            }
+
+            if (!c)
+                c = new connection(io_service_, request_handler_, wheel_, use_strand_, ring_);
+
+            return connection_ptr(c, boost::bind(&connection_cache::release,
+                                                 boost::weak_ptr<connection_cache>(shared_from_this()), _1));
+        }
+
+        void connection_cache::release(boost::weak_ptr<connection_cache> cache, connection* c)
+        {
+            // Connections outliving the cache (e.g. handlers destroyed with the
+            // io_service at shutdown) are simply deleted.
+            connection_cache_ptr owner = cache.lock();
+            if (owner)
+                owner->put(c);
+            else
+                delete c;
+        }
+
+        void connection_cache::put(connection* c)
+        {
+            c->reset();
+
+            boost::mutex::scoped_lock lock(mutex_);
+            if (free_.size() < max_size_)
+            {
+                free_.push_back(c);
+                return;
+            }
+            lock.unlock();
+
+            delete c;
+        }
+
+    } // namespace server3
+} // namespace http
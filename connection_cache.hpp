@@ -0,0 +1,85 @@
+//
+// connection_cache.hpp
+// ~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_CONNECTION_CACHE_HPP
+#define HTTP_SERVER3_CONNECTION_CACHE_HPP
+
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/thread/mutex.hpp>
+#include "connection.hpp"
+
+#define CONNECTION_CACHE_SIZE 1024
+
+namespace http {
+    namespace server3 {
+
+/// Free list of idle connection objects bound to one io_service. Connections
+/// handed out by acquire() come back here, reset, when their last reference
+/// goes away instead of being deleted.
+        class connection_cache
+            : public boost::enable_shared_from_this<connection_cache>,
+              private boost::noncopyable
+        {
+        public:
+            /// Construct an empty cache for connections on the given io_service,
+            /// whose deadlines are kept by wheel, on ring if not null.
+            connection_cache(boost::asio::io_service& io_service,
+                             request_handler& handler, timer_wheel& wheel, bool use_strand,
+                             uring* ring, std::size_t max_size = CONNECTION_CACHE_SIZE);
+
+            /// Delete every idle connection.
+            ~connection_cache();
+
+            /// Get an idle connection, or a new one if none is left.
+            connection_ptr acquire();
+
+        private:
+            /// Deleter of acquired connections; recycles them while the cache lives.
+            static void release(boost::weak_ptr<connection_cache> cache, connection* c);
+
+            /// Put a connection back on the free list, or delete it when full.
+            void put(connection* c);
+
+            /// The io_service every cached connection belongs to.
+            boost::asio::io_service& io_service_;
+
+            /// The handler given to new connections.
+            request_handler& request_handler_;
+
+            /// The deadlines of every cached connection.
+            timer_wheel& wheel_;
+
+            /// Whether new connections dispatch through a strand.
+            bool use_strand_;
+
+            /// The io_uring transport of new connections, if any.
+            uring* ring_;
+
+            /// Maximum number of idle connections kept.
+            std::size_t max_size_;
+
+            /// Protects free_.
+            boost::mutex mutex_;
+
+            /// Idle connections.
+            std::vector<connection*> free_;
+        };
+
+        typedef boost::shared_ptr<connection_cache> connection_cache_ptr;
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_CONNECTION_CACHE_HPP
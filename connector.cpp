@@ -0,0 +1,229 @@
+//
+// connector.cpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include "affinity.hpp"
+#include "connector.hpp"
+#include "globals.hpp"
+#include "stats.hpp"
+
+#include "soci-mysql.h"
+
+namespace http {
+    namespace server3 {
+
+        connector::connector(soci::connection_pool& pool, std::size_t size,
+                             const std::string& database, const std::string& cpus)
+            : pool_(pool), database_(database), ready_(0), opening_(0),
+              failures_(0), stopped_(false)
+        {
+            affinity::parse(cpus, cpus_);
+
+            // Nobody else can lease a session until it is open.
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                slot s;
+                s.position = pool_.lease();
+                s.due = 0;
+                s.backoff = CONNECTOR_BACKOFF_MIN;
+                pending_.push_back(s);
+            }
+
+            // The first connection also initializes the MySQL client library,
+            // which must not happen in several threads at once.
+            slot first = pending_.back();
+            pending_.pop_back();
+            if (open(first.position, last_error_))
+            {
+                ++ready_;
+                pool_.give_back(first.position);
+            }
+            else
+            {
+                ++failures_;
+                first.due = stats::now() + CONNECTOR_BACKOFF_MIN * 1000000ULL;
+                first.backoff = std::min(2 * CONNECTOR_BACKOFF_MIN, CONNECTOR_BACKOFF_MAX);
+                pending_.push_back(first);
+            }
+
+            std::size_t n = std::min<std::size_t>(size, CONNECTOR_THREADS);
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                threads_.push_back(boost::shared_ptr<boost::thread>(
+                                       new boost::thread(boost::bind(&connector::run, this,
+                                                                     static_cast<unsigned>(i + 1)))));
+            }
+        }
+
+        connector::~connector()
+        {
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                stopped_ = true;
+            }
+            changed_.notify_all();
+
+            for (std::size_t i = 0; i < threads_.size(); ++i)
+                threads_[i]->join();
+        }
+
+        bool connector::wait(std::size_t n, int seconds, std::string& error)
+        {
+            boost::system_time deadline = boost::get_system_time() + boost::posix_time::seconds(seconds);
+
+            boost::mutex::scoped_lock lock(mutex_);
+            while ((ready_ < n) && !stopped_)
+            {
+                if (!changed_.timed_wait(lock, deadline) && (ready_ < n))
+                {
+                    std::stringstream s;
+                    s << "database unreachable: " << ready_ << " of " << n
+                      << " sessions needed to start open after " << seconds << "s";
+                    if (!last_error_.empty())
+                        s << " (last error: " << last_error_ << ")";
+                    error = s.str();
+                    return false;
+                }
+            }
+
+            LINFO("sessions open: " + boost::lexical_cast<std::string>(ready_) +
+                  " of " + boost::lexical_cast<std::string>(ready_ + opening_ + pending_.size()));
+            return true;
+        }
+
+        void connector::reopen(std::size_t position)
+        {
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                slot s;
+                s.position = position;
+                s.due = 0;
+                s.backoff = CONNECTOR_BACKOFF_MIN;
+                pending_.push_back(s);
+                --ready_;
+                ++failures_;
+            }
+            changed_.notify_all();
+        }
+
+        bool connector::lost(const std::exception& e)
+        {
+            const soci::mysql_soci_error* error = dynamic_cast<const soci::mysql_soci_error*>(&e);
+            return error && ((error->err_num_ == CONNECTOR_GONE) || (error->err_num_ == CONNECTOR_LOST));
+        }
+
+        void connector::report(std::string& out, bool prometheus) const
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            std::stringstream s;
+
+            if (prometheus)
+            {
+                s << "# TYPE lisa_sessions gauge\n"
+                  << "lisa_sessions{state=\"open\"} " << ready_ << "\n"
+                  << "lisa_sessions{state=\"opening\"} " << opening_ << "\n"
+                  << "lisa_sessions{state=\"waiting\"} " << pending_.size() << "\n"
+                  << "# TYPE lisa_session_failures_total counter\n"
+                  << "lisa_session_failures_total " << failures_ << "\n";
+            }
+            else
+            {
+                s << "sessions open=" << ready_
+                  << " opening=" << opening_
+                  << " waiting=" << pending_.size()
+                  << " failures=" << failures_ << "\n";
+            }
+
+            out += s.str();
+        }
+
+        void connector::run(unsigned seed)
+        {
+            affinity::pin(cpus_);
+            if (seed == 1)
+                LINFO("placement: connector threads " + affinity::where());
+
+            boost::mutex::scoped_lock lock(mutex_);
+            while (!stopped_)
+            {
+                if (pending_.empty())
+                {
+                    changed_.wait(lock);
+                    continue;
+                }
+
+                std::size_t next = 0;
+                for (std::size_t i = 1; i < pending_.size(); ++i)
+                {
+                    if (pending_[i].due < pending_[next].due)
+                        next = i;
+                }
+
+                boost::uint64_t now = stats::now();
+                if (pending_[next].due > now)
+                {
+                    changed_.timed_wait(lock, boost::posix_time::microseconds((pending_[next].due - now) / 1000));
+                    continue;
+                }
+
+                slot s = pending_[next];
+                pending_[next] = pending_.back();
+                pending_.pop_back();
+                ++opening_;
+
+                std::string error;
+                lock.unlock();
+                bool opened = open(s.position, error);
+                lock.lock();
+
+                --opening_;
+                if (opened)
+                {
+                    ++ready_;
+                    pool_.give_back(s.position);
+                    changed_.notify_all();
+                    continue;
+                }
+
+                // Retry after somewhere between half the backoff and all of it,
+                // so that sessions lost together do not all come back at once.
+                ++failures_;
+                last_error_ = error;
+                int jitter = s.backoff / 2;
+                int delay = s.backoff - jitter + rand_r(&seed) % (jitter + 1);
+                s.due = stats::now() + static_cast<boost::uint64_t>(delay) * 1000000ULL;
+                s.backoff = std::min(2 * s.backoff, CONNECTOR_BACKOFF_MAX);
+                pending_.push_back(s);
+            }
+        }
+
+        bool connector::open(std::size_t position, std::string& error)
+        {
+            try
+            {
+                soci::session& sql = pool_.at(position);
+                sql.close();
+                sql.open(soci::mysql, database_);
+                return true;
+            }
+            catch (std::exception const &e)
+            {
+                error = e.what();
+                LIERR("session " + boost::lexical_cast<std::string>(position) + ": " + error);
+                return false;
+            }
+        }
+
+    } // namespace server3
+} // namespace http
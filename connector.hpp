@@ -0,0 +1,112 @@
+//
+// connector.hpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_CONNECTOR_HPP
+#define HTTP_SERVER3_CONNECTOR_HPP
+
+#include <cstddef>
+#include <exception>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include "soci.h"
+
+#define CONNECTOR_THREADS       16      // sessions opened at once
+#define CONNECTOR_BACKOFF_MIN   100     // ms before the first retry
+#define CONNECTOR_BACKOFF_MAX   30000   // ms between retries at most
+#define CONNECTOR_GONE          2006    // CR_SERVER_GONE_ERROR
+#define CONNECTOR_LOST          2013    // CR_SERVER_LOST
+#define CONNECTOR_STARTUP       60      // s to open the sessions needed to start
+
+namespace http {
+    namespace server3 {
+
+/// Opens the sessions of the pool in the background, a few at a time. A
+/// session is leased from the pool until it is open, so requests only ever
+/// get open sessions; one that fails to open, or is lost later, is retried
+/// with exponential backoff while the others serve.
+        class connector
+            : private boost::noncopyable
+        {
+        public:
+            /// Start opening every session of the pool with the given DSN, from
+            /// threads placed on the given CPU list.
+            connector(soci::connection_pool& pool, std::size_t size,
+                      const std::string& database, const std::string& cpus);
+
+            /// Stop retrying and wait for the opening threads.
+            ~connector();
+
+            /// Block until at least n sessions are open, or for seconds at most.
+            /// Returns false, with error set to why, if they could not be opened
+            /// in time.
+            bool wait(std::size_t n, int seconds, std::string& error);
+
+            /// Close and reopen the leased session at position, which the
+            /// connector now owns. Called instead of giving it back.
+            void reopen(std::size_t position);
+
+            /// Whether an error means the session is no longer usable.
+            static bool lost(const std::exception& e);
+
+            /// Append the current state to a /stats report.
+            void report(std::string& out, bool prometheus) const;
+
+        private:
+            /// A session waiting to be opened.
+            struct slot
+            {
+                std::size_t position;
+                boost::uint64_t due;
+                int backoff;
+            };
+
+            /// Body of the opening threads.
+            void run(unsigned seed);
+
+            /// Try to open a session, returning false, with error set, on failure.
+            bool open(std::size_t position, std::string& error);
+
+            soci::connection_pool& pool_;
+            std::string database_;
+
+            /// CPUs the opening threads run on.
+            std::vector<int> cpus_;
+
+            /// Protects everything below.
+            mutable boost::mutex mutex_;
+
+            /// Signalled when a slot is added, a session opened or on stop.
+            boost::condition_variable changed_;
+
+            /// Sessions waiting to be opened, in no particular order.
+            std::vector<slot> pending_;
+
+            /// Open sessions, sessions being opened and failures so far.
+            std::size_t ready_;
+            std::size_t opening_;
+            boost::uint64_t failures_;
+
+            /// Why the last session failed to open.
+            std::string last_error_;
+
+            bool stopped_;
+
+            std::vector<boost::shared_ptr<boost::thread> > threads_;
+        };
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_CONNECTOR_HPP
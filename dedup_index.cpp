@@ -0,0 +1,104 @@
+//
+// dedup_index.cpp
+// ~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "dedup_index.hpp"
+#include "stats.hpp"
+
+namespace http {
+    namespace server3 {
+
+        dedup_index::dedup_index(std::size_t capacity, std::size_t window)
+            : mask_(0), window_(static_cast<boost::uint64_t>(window) * 1000000000ULL)
+        {
+            if (window_ == 0)
+                return;
+
+            std::size_t slots = DEDUP_PROBES;
+            while (slots * DEDUP_SHARDS < capacity)
+                slots *= 2;
+            mask_ = slots - 1;
+
+            entry empty = { 0, 0 };
+            shards_.reset(new shard[DEDUP_SHARDS]);
+            for (std::size_t i = 0; i < DEDUP_SHARDS; ++i)
+                shards_[i].entries.assign(slots, empty);
+        }
+
+        boost::uint64_t dedup_index::hash(const std::string& key)
+        {
+            // FNV-1a, then a 64-bit finalizer so that both the shard (high bits)
+            // and the slot (low bits) are well mixed.
+            boost::uint64_t h = 14695981039346656037ULL;
+            for (std::size_t i = 0; i < key.size(); ++i)
+            {
+                h ^= static_cast<unsigned char>(key[i]);
+                h *= 1099511628211ULL;
+            }
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ULL;
+            h ^= h >> 33;
+            return h ? h : 1;
+        }
+
+        bool dedup_index::seen(const std::string& key)
+        {
+            if (window_ == 0)
+                return false;
+
+            boost::uint64_t h = hash(key);
+            boost::uint64_t now = stats::now();
+            shard& s = shards_[h >> 58];
+
+            boost::mutex::scoped_lock lock(s.mutex);
+            for (std::size_t i = 0; i < DEDUP_PROBES; ++i)
+            {
+                const entry& e = s.entries[(h + i) & mask_];
+                if (e.hash == 0)
+                    return false;
+                if ((e.hash == h) && (e.expires > now))
+                    return true;
+            }
+            return false;
+        }
+
+        void dedup_index::insert(const std::string& key)
+        {
+            if (window_ == 0)
+                return;
+
+            boost::uint64_t h = hash(key);
+            boost::uint64_t now = stats::now();
+            shard& s = shards_[h >> 58];
+
+            boost::mutex::scoped_lock lock(s.mutex);
+
+            // Reuse the key's own slot or a free one, else evict the entry that
+            // expires first, which is an expired one whenever there is any.
+            entry* victim = 0;
+            for (std::size_t i = 0; i < DEDUP_PROBES; ++i)
+            {
+                entry& e = s.entries[(h + i) & mask_];
+                if ((e.hash == h) || (e.hash == 0))
+                {
+                    victim = &e;
+                    break;
+                }
+                if (!victim || (e.expires < victim->expires))
+                    victim = &e;
+            }
+
+            victim->hash = h;
+            victim->expires = now + window_;
+        }
+
+    } // namespace server3
+} // namespace http
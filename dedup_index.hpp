@@ -0,0 +1,77 @@
+//
+// dedup_index.hpp
+// ~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_DEDUP_INDEX_HPP
+#define HTTP_SERVER3_DEDUP_INDEX_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/mutex.hpp>
+
+#define DEDUP_SHARDS        64
+#define DEDUP_PROBES        16
+#define DEDUP_MAX_KEY       255
+
+namespace http {
+    namespace server3 {
+
+/// Recently enqueued dedup keys, so that a retried enqueue can be answered
+/// without going to the database. Keys are kept as 64-bit hashes in fixed
+/// size open-addressing tables (16 bytes per entry) for a time window. When
+/// the probe window of a key is full, the entry closest to expiry is evicted,
+/// so memory never grows past the configured capacity.
+        class dedup_index
+            : private boost::noncopyable
+        {
+        public:
+            /// Remember keys for window seconds in about capacity entries. A
+            /// window of 0 disables the index.
+            dedup_index(std::size_t capacity, std::size_t window);
+
+            /// Whether the key was inserted less than window seconds ago.
+            bool seen(const std::string& key);
+
+            /// Record a key whose item has been stored.
+            void insert(const std::string& key);
+
+        private:
+            struct entry
+            {
+                /// Hash of the key, 0 for a slot never used.
+                boost::uint64_t hash;
+
+                /// Monotonic time (ns) after which the entry is void.
+                boost::uint64_t expires;
+            };
+
+            struct shard
+            {
+                boost::mutex mutex;
+                std::vector<entry> entries;
+            };
+
+            static boost::uint64_t hash(const std::string& key);
+
+            boost::scoped_array<shard> shards_;
+
+            /// Slots per shard minus one (a power of two minus one).
+            std::size_t mask_;
+
+            boost::uint64_t window_;
+        };
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_DEDUP_INDEX_HPP
@@ -0,0 +1,109 @@
+//
+// frame.hpp
+// ~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_FRAME_HPP
+#define HTTP_SERVER3_FRAME_HPP
+
+#include <string>
+#include <boost/cstdint.hpp>
+
+// Binary protocol layout (all integers in network byte order):
+//
+//   request:  u32 length | u8 opcode | u32 tag | body
+//   response: u32 length | u8 status | u32 tag | body
+//
+// length counts every byte after itself. The tag is echoed back untouched so
+// clients may pipeline requests; responses are always sent in request order.
+
+#define FRAME_LENGTH_SIZE   4
+#define FRAME_HEADER_SIZE   5
+#define FRAME_MAX_SIZE      (16 * 1024 * 1024)
+#define FRAME_MAX_BATCH     1000
+
+namespace http {
+    namespace server3 {
+
+        struct services;
+
+/// A binary protocol request or response.
+        struct frame
+        {
+            /// Request opcodes.
+            enum opcode_type
+            {
+                enqueue = 1,        // body: i32 priority | data
+                dequeue = 2,        // body: (empty)
+                peek = 3,           // body: (empty)
+                count = 4,          // body: (empty)
+                enqueue_batch = 5,  // body: u32 n | n * (i32 priority | u32 size | data)
+                dequeue_batch = 6,  // body: u32 max
+                peek_batch = 7,     // body: u32 max
+                enqueue_keyed = 8,  // body: i32 priority | u32 size | dedup key | data
+                dequeue_range = 9,  // body: i32 lo | i32 hi | u32 max
+                peek_range = 10,    // body: i32 lo | i32 hi | u32 max
+                count_range = 11    // body: i32 lo | i32 hi
+            };
+
+            /// Response status codes.
+            enum status_type
+            {
+                ok = 0,             // body: op dependent
+                empty = 1,          // body: (empty)
+                bad_request = 2,    // body: (empty)
+                error = 3,          // body: (empty)
+                busy = 4,           // body: (empty), retry later
+                read_only = 5       // body: (empty), write sent to a replica
+            };
+
+            /// The opcode of a request or the status of a response.
+            boost::uint8_t code;
+
+            /// Opaque client tag echoed back in the response.
+            boost::uint32_t tag;
+
+            /// The frame body.
+            std::string body;
+
+            /// What the request is served with, set by the request_handler.
+            services *svc;
+
+            /// Append a big-endian u32 to a buffer.
+            static void put_u32(std::string& out, boost::uint32_t v)
+            {
+                out.push_back(static_cast<char>((v >> 24) & 0xff));
+                out.push_back(static_cast<char>((v >> 16) & 0xff));
+                out.push_back(static_cast<char>((v >> 8) & 0xff));
+                out.push_back(static_cast<char>(v & 0xff));
+            }
+
+            /// Read a big-endian u32 from a buffer of at least four bytes.
+            static boost::uint32_t get_u32(const char* in)
+            {
+                const unsigned char* p = reinterpret_cast<const unsigned char*>(in);
+                return (static_cast<boost::uint32_t>(p[0]) << 24) |
+                    (static_cast<boost::uint32_t>(p[1]) << 16) |
+                    (static_cast<boost::uint32_t>(p[2]) << 8) |
+                    static_cast<boost::uint32_t>(p[3]);
+            }
+
+            /// Append the encoded frame (length, code, tag and body) to a buffer.
+            void encode(std::string& out) const
+            {
+                put_u32(out, static_cast<boost::uint32_t>(FRAME_HEADER_SIZE + body.size()));
+                out.push_back(static_cast<char>(code));
+                put_u32(out, tag);
+                out.append(body);
+            }
+        };
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_FRAME_HPP
@@ -0,0 +1,78 @@
+//
+// frame_parser.cpp
+// ~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <algorithm>
+#include "frame_parser.hpp"
+
+namespace http {
+    namespace server3 {
+
+        frame_parser::frame_parser()
+            : header_size_(0), remaining_(0), state_(frame_header)
+        {
+        }
+
+        void frame_parser::reset()
+        {
+            header_size_ = 0;
+            remaining_ = 0;
+            state_ = frame_header;
+        }
+
+        boost::tuple<boost::tribool, const char*> frame_parser::parse(frame& f,
+                                                                      const char* begin, const char* end)
+        {
+            if (state_ == frame_header)
+            {
+                std::size_t n = std::min<std::size_t>(header_.size() - header_size_, end - begin);
+                std::copy(begin, begin + n, header_.data() + header_size_);
+                header_size_ += n;
+                begin += n;
+
+                if (header_size_ < header_.size())
+                {
+                    boost::tribool result = boost::indeterminate;
+                    return boost::make_tuple(result, begin);
+                }
+
+                boost::uint32_t length = frame::get_u32(header_.data());
+                if ((length < FRAME_HEADER_SIZE) || (length > FRAME_MAX_SIZE))
+                {
+                    boost::tribool result = false;
+                    return boost::make_tuple(result, begin);
+                }
+
+                f.code = static_cast<boost::uint8_t>(header_[FRAME_LENGTH_SIZE]);
+                f.tag = frame::get_u32(header_.data() + FRAME_LENGTH_SIZE + 1);
+                f.body.clear();
+                f.body.reserve(length - FRAME_HEADER_SIZE);
+
+                remaining_ = length - FRAME_HEADER_SIZE;
+                state_ = frame_body;
+            }
+
+            std::size_t n = std::min<std::size_t>(remaining_, end - begin);
+            f.body.append(begin, n);
+            remaining_ -= n;
+            begin += n;
+
+            if (remaining_ == 0)
+            {
+                reset();
+                boost::tribool result = true;
+                return boost::make_tuple(result, begin);
+            }
+
+            boost::tribool result = boost::indeterminate;
+            return boost::make_tuple(result, begin);
+        }
+
+    } // namespace server3
+} // namespace http
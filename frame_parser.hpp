@@ -0,0 +1,72 @@
+//
+// frame_parser.hpp
+// ~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_FRAME_PARSER_HPP
+#define HTTP_SERVER3_FRAME_PARSER_HPP
+
+#include <boost/array.hpp>
+#include <boost/logic/tribool.hpp>
+#include <boost/tuple/tuple.hpp>
+#include "frame.hpp"
+
+namespace http {
+    namespace server3 {
+
+/// Parser for incoming binary protocol frames.
+        class frame_parser
+        {
+        public:
+            /// Construct ready to parse the frame header.
+            frame_parser();
+
+            /// Reset to initial parser state.
+            void reset();
+
+            /// Whether no byte of the next frame has been received.
+            bool idle() const
+            {
+                return (state_ == frame_header) && (header_size_ == 0);
+            }
+
+            /// Whether the fixed header is in and the body is being read.
+            bool in_body() const
+            {
+                return state_ == frame_body;
+            }
+
+            /// Parse some data. The tribool return value is true when a complete frame
+            /// has been parsed, false if the data is invalid, indeterminate when more
+            /// data is required. The returned pointer indicates how much of the input
+            /// has been consumed; bodies are copied in whole runs, not byte by byte.
+            boost::tuple<boost::tribool, const char*> parse(frame& f,
+                                                            const char* begin, const char* end);
+
+        private:
+            /// Bytes of the fixed header received so far.
+            boost::array<char, FRAME_LENGTH_SIZE + FRAME_HEADER_SIZE> header_;
+
+            /// Number of valid bytes in header_.
+            std::size_t header_size_;
+
+            /// Body bytes still expected.
+            std::size_t remaining_;
+
+            /// The current state of the parser.
+            enum state
+            {
+                frame_header,
+                frame_body
+            } state_;
+        };
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_FRAME_PARSER_HPP
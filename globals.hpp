@@ -12,7 +12,9 @@
 #define HTTP_SERVER3_GLOBALS_HPP
 
 #include "logger.hpp"
+#include "stats.hpp"
 
 extern http::server3::logger g_logger;
+extern http::server3::stats g_stats;
 
 #endif // HTTP_SERVER3_GLOBALS_HPP
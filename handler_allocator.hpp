@@ -0,0 +1,122 @@
+//
+// handler_allocator.hpp
+// ~~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//               2003-2008 Christopher M. Kohlhoff (chris at kohlhoff dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_HANDLER_ALLOCATOR_HPP
+#define HTTP_SERVER3_HANDLER_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <boost/aligned_storage.hpp>
+#include <boost/noncopyable.hpp>
+
+#define HANDLER_STORAGE_SIZE 1024
+
+namespace http {
+    namespace server3 {
+
+/// Class to manage the memory to be used for handler-based custom allocation.
+/// It contains a single block of memory which may be returned for allocation
+/// requests. If the memory is in use when an allocation request is made, the
+/// allocator delegates allocation to the global heap. It is not thread safe:
+/// it must serve a single chain of operations, each one started from the
+/// handler of the previous one (Asio frees an operation's memory before
+/// calling its handler). Operations in flight at the same time, which may
+/// complete on different threads, each need an allocator of their own.
+        class handler_allocator
+            : private boost::noncopyable
+        {
+        public:
+            handler_allocator()
+                : in_use_(false)
+            {
+            }
+
+            void* allocate(std::size_t size)
+            {
+                if (!in_use_ && size <= storage_.size)
+                {
+                    in_use_ = true;
+                    return storage_.address();
+                }
+                return ::operator new(size);
+            }
+
+            void deallocate(void* pointer)
+            {
+                if (pointer == storage_.address())
+                {
+                    in_use_ = false;
+                }
+                else
+                {
+                    ::operator delete(pointer);
+                }
+            }
+
+        private:
+            /// Storage space used for handler-based custom memory allocation.
+            boost::aligned_storage<HANDLER_STORAGE_SIZE> storage_;
+
+            /// Whether the handler-based custom allocation storage has been used.
+            bool in_use_;
+        };
+
+/// Wrapper class template for handler objects to allow handler memory
+/// allocation to be customised. Calls to operator() are forwarded to the
+/// encapsulated handler.
+        template <typename Handler>
+        class custom_alloc_handler
+        {
+        public:
+            custom_alloc_handler(handler_allocator& a, Handler h)
+                : allocator_(a), handler_(h)
+            {
+            }
+
+            template <typename Arg1>
+            void operator()(Arg1 arg1)
+            {
+                handler_(arg1);
+            }
+
+            template <typename Arg1, typename Arg2>
+            void operator()(Arg1 arg1, Arg2 arg2)
+            {
+                handler_(arg1, arg2);
+            }
+
+            friend void* asio_handler_allocate(std::size_t size,
+                                               custom_alloc_handler<Handler>* this_handler)
+            {
+                return this_handler->allocator_.allocate(size);
+            }
+
+            friend void asio_handler_deallocate(void* pointer, std::size_t /*size*/,
+                                                custom_alloc_handler<Handler>* this_handler)
+            {
+                this_handler->allocator_.deallocate(pointer);
+            }
+
+        private:
+            handler_allocator& allocator_;
+            Handler handler_;
+        };
+
+/// Helper function to wrap a handler object to add custom allocation.
+        template <typename Handler>
+        inline custom_alloc_handler<Handler> make_custom_alloc_handler(handler_allocator& a, Handler h)
+        {
+            return custom_alloc_handler<Handler>(a, h);
+        }
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_HANDLER_ALLOCATOR_HPP
@@ -0,0 +1,230 @@
+//
+// handoff.cpp
+// ~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/lexical_cast.hpp>
+#include "globals.hpp"
+#include "handoff.hpp"
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace http {
+    namespace server3 {
+
+        namespace {
+
+            /// Room for the sockets of one message, aligned for the cmsghdr that
+            /// heads it.
+            union control_buffer
+            {
+                cmsghdr header;
+                char data[CMSG_SPACE(HANDOFF_MAX_FDS * sizeof(int))];
+            };
+
+        } // namespace
+
+        handoff::handoff(boost::asio::io_service& io_service, const std::string& path)
+            : path_(path),
+              predecessor_(-1),
+              acceptor_(io_service),
+              successor_(io_service),
+              ready_(0)
+        {
+        }
+
+        handoff::~handoff()
+        {
+            if (predecessor_ >= 0)
+                ::close(predecessor_);
+        }
+
+        bool handoff::take(std::vector<int>& fds)
+        {
+            fds.clear();
+
+            sockaddr_un addr;
+            std::memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            if (path_.size() >= sizeof(addr.sun_path))
+                throw std::runtime_error("handoff: path too long: " + path_);
+            std::memcpy(addr.sun_path, path_.data(), path_.size());
+
+            int s = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (s < 0)
+                throw std::runtime_error(std::string("handoff: socket: ") + std::strerror(errno));
+
+            // No socket file, or a stale one: nobody to take over from.
+            if (::connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+            {
+                int error = errno;
+                ::close(s);
+                if ((error == ENOENT) || (error == ECONNREFUSED))
+                    return false;
+                throw std::runtime_error(std::string("handoff: connect: ") + std::strerror(error));
+            }
+
+            timeval timeout = { 10, 0 };
+            ::setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+            // One message: the number of sockets, with the sockets attached.
+            boost::uint32_t count = 0;
+            iovec iov = { &count, sizeof(count) };
+            control_buffer control;
+            msghdr msg;
+            std::memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control.data;
+            msg.msg_controllen = sizeof(control.data);
+
+            ssize_t n = ::recvmsg(s, &msg, 0);
+            for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c))
+            {
+                if ((c->cmsg_level != SOL_SOCKET) || (c->cmsg_type != SCM_RIGHTS))
+                    continue;
+                std::size_t received = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                const int* data = reinterpret_cast<const int*>(CMSG_DATA(c));
+                fds.insert(fds.end(), data, data + received);
+            }
+
+            if ((n != static_cast<ssize_t>(sizeof(count))) || (msg.msg_flags & MSG_CTRUNC) ||
+                (fds.size() != count))
+            {
+                for (std::size_t i = 0; i < fds.size(); ++i)
+                    ::close(fds[i]);
+                fds.clear();
+                ::close(s);
+                throw std::runtime_error("handoff: no listening sockets received from " + path_);
+            }
+
+            predecessor_ = s;
+            LINFO("handoff: took listening sockets from " + path_);
+            return true;
+        }
+
+        void handoff::listen(const std::vector<int>& fds, boost::function<void ()> done)
+        {
+            fds_ = fds;
+            done_ = done;
+
+            // Listen on a path of our own, and only move it over the
+            // predecessor's once the predecessor was told we serve: until then
+            // the path stays the predecessor's, so if this process dies first
+            // the next one still takes over from it.
+            std::string pending = path_ + "." + boost::lexical_cast<std::string>(::getpid());
+            ::unlink(pending.c_str());
+            boost::asio::local::stream_protocol::endpoint endpoint(pending);
+            acceptor_.open(endpoint.protocol());
+            acceptor_.bind(endpoint);
+            acceptor_.listen();
+
+            if (predecessor_ >= 0)
+            {
+                char ready = HANDOFF_READY;
+                if (::write(predecessor_, &ready, 1) != 1)
+                    LIERR(std::string("handoff: write: ") + std::strerror(errno));
+                ::close(predecessor_);
+                predecessor_ = -1;
+            }
+
+            // The predecessor may be draining already: serve on regardless,
+            // only without a successor.
+            if (::rename(pending.c_str(), path_.c_str()) < 0)
+            {
+                LIERR("handoff: rename to " + path_ + ": " + std::strerror(errno));
+                ::unlink(pending.c_str());
+                close();
+                return;
+            }
+
+            start_accept();
+        }
+
+        void handoff::close()
+        {
+            boost::system::error_code ignored_ec;
+            acceptor_.close(ignored_ec);
+            successor_.close(ignored_ec);
+        }
+
+        void handoff::start_accept()
+        {
+            acceptor_.async_accept(successor_,
+                                   boost::bind(&handoff::handle_accept, this,
+                                               boost::asio::placeholders::error));
+        }
+
+        void handoff::handle_accept(const boost::system::error_code& e)
+        {
+            if (e)
+                return;
+
+            boost::uint32_t count = static_cast<boost::uint32_t>(fds_.size());
+            iovec iov = { &count, sizeof(count) };
+            control_buffer control;
+            std::memset(control.data, 0, sizeof(control.data));
+            msghdr msg;
+            std::memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control.data;
+            msg.msg_controllen = CMSG_SPACE(fds_.size() * sizeof(int));
+
+            cmsghdr* c = CMSG_FIRSTHDR(&msg);
+            c->cmsg_level = SOL_SOCKET;
+            c->cmsg_type = SCM_RIGHTS;
+            c->cmsg_len = CMSG_LEN(fds_.size() * sizeof(int));
+            std::memcpy(CMSG_DATA(c), &fds_[0], fds_.size() * sizeof(int));
+
+            if (::sendmsg(successor_.native_handle(), &msg, MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(count)))
+            {
+                LIERR(std::string("handoff: sendmsg: ") + std::strerror(errno));
+                boost::system::error_code ignored_ec;
+                successor_.close(ignored_ec);
+                start_accept();
+                return;
+            }
+
+            // Keep serving until the successor does; it may still fail.
+            boost::asio::async_read(successor_, boost::asio::buffer(&ready_, 1),
+                                    boost::bind(&handoff::handle_ready, this,
+                                                boost::asio::placeholders::error,
+                                                boost::asio::placeholders::bytes_transferred));
+        }
+
+        void handoff::handle_ready(const boost::system::error_code& e, std::size_t bytes_transferred)
+        {
+            if (!e && (bytes_transferred == 1) && (ready_ == HANDOFF_READY))
+            {
+                LINFO("handoff: successor serving, draining");
+                close();
+                done_();
+                return;
+            }
+
+            if (e == boost::asio::error::operation_aborted)
+                return;
+
+            LIERR("handoff: successor gave up, still serving");
+            boost::system::error_code ignored_ec;
+            successor_.close(ignored_ec);
+            start_accept();
+        }
+
+    } // namespace server3
+} // namespace http
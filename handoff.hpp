@@ -0,0 +1,82 @@
+//
+// handoff.hpp
+// ~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_HANDOFF_HPP
+#define HTTP_SERVER3_HANDOFF_HPP
+
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+
+#define HANDOFF_MAX_FDS     250     // below SCM_MAX_FD
+#define HANDOFF_READY       'k'     // sent by the successor once it serves
+
+namespace http {
+    namespace server3 {
+
+/// Hot restart. A running lisa listens on a Unix socket; a new lisa started
+/// with the same path connects to it and receives the listening sockets
+/// (SCM_RIGHTS) instead of binding its own, so no connection is refused
+/// while the binary is replaced. Once the successor serves it says so, and
+/// the predecessor stops accepting and drains.
+        class handoff
+            : private boost::noncopyable
+        {
+        public:
+            /// Construct for the Unix socket at path.
+            handoff(boost::asio::io_service& io_service, const std::string& path);
+
+            /// Close the link to the predecessor, if still open.
+            ~handoff();
+
+            /// Take the listening sockets of a running predecessor. Returns
+            /// false, leaving fds empty, if none is running.
+            bool take(std::vector<int>& fds);
+
+            /// Tell the predecessor this process serves, then listen for a
+            /// successor; done is called once one took over fds.
+            void listen(const std::vector<int>& fds, boost::function<void ()> done);
+
+            /// Stop listening for a successor.
+            void close();
+
+        private:
+            /// Start an asynchronous accept of a successor.
+            void start_accept();
+
+            /// Pass the sockets to a successor that just connected.
+            void handle_accept(const boost::system::error_code& e);
+
+            /// A successor answered, or gave up.
+            void handle_ready(const boost::system::error_code& e, std::size_t bytes_transferred);
+
+            /// Path of the Unix socket.
+            std::string path_;
+
+            /// Connection to the predecessor, until it is told we serve.
+            int predecessor_;
+
+            /// Listening sockets passed on to a successor.
+            std::vector<int> fds_;
+
+            /// Called once a successor took over.
+            boost::function<void ()> done_;
+
+            boost::asio::local::stream_protocol::acceptor acceptor_;
+            boost::asio::local::stream_protocol::socket successor_;
+            char ready_;
+        };
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_HANDOFF_HPP
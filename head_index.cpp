@@ -0,0 +1,302 @@
+//
+// head_index.cpp
+// ~~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <exception>
+#include <sstream>
+#include "blob_store.hpp"
+#include "head_index.hpp"
+#include "stats.hpp"
+#include "soci-mysql.h"
+
+#define HEAD_INDEX_REFRESH_NS (HEAD_INDEX_REFRESH * 1000000000ULL)
+
+namespace http {
+    namespace server3 {
+
+        head_index::head_index(std::size_t capacity)
+            : capacity_(capacity),
+              bytes_(0),
+              complete_(false),
+              loaded_(false),
+              loaded_at_(0),
+              held_(0),
+              loading_(false),
+              hits_(0),
+              misses_(0),
+              loads_(0)
+        {
+        }
+
+        bool head_index::refresh(soci::session& sql)
+        {
+            if (!enabled())
+                return false;
+
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                if (usable())
+                    return false;
+            }
+            return load(sql);
+        }
+
+        bool head_index::usable() const
+        {
+            return loaded_ && (stats::now() - loaded_at_ < HEAD_INDEX_REFRESH_NS);
+        }
+
+        bool head_index::load(soci::session& sql)
+        {
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                if (loading_)
+                    return false;
+                loading_ = true;
+                replay_.clear();
+            }
+
+            // One more row than the capacity tells whether the queue fits.
+            // Within a transaction the blobs are read from the same snapshot
+            // as the rows; plain reads take no locks.
+            int limit = static_cast<int>(capacity_ + 1);
+            std::vector<long long> ks(capacity_ + 1);
+            std::vector<int> ps(capacity_ + 1);
+            std::vector<std::string> ds(capacity_ + 1);
+            try
+            {
+                sql.begin();
+                sql << "SELECT k, p, d FROM q ORDER BY p DESC, k LIMIT :n",
+                    soci::use(limit), soci::into(ks), soci::into(ps), soci::into(ds);
+                for (std::size_t i = 0; i < ds.size(); ++i)
+                    blob_store::fetch(sql, ds[i], false);
+                sql.commit();
+            }
+            catch (std::exception const &)
+            {
+                try
+                {
+                    sql.rollback();
+                }
+                catch (std::exception const &)
+                {
+                }
+
+                boost::mutex::scoped_lock lock(mutex_);
+                loading_ = false;
+                throw;
+            }
+
+            boost::mutex::scoped_lock lock(mutex_);
+
+            items_.clear();
+            priorities_.clear();
+            bytes_ = 0;
+
+            // Rows dequeued since the read are buried already.
+            complete_ = true;
+            for (std::size_t i = 0; i < ks.size(); ++i)
+                insert(static_cast<boost::uint64_t>(ks[i]), ps[i], ds[i]);
+            if (ks.size() > capacity_)
+                complete_ = false;
+
+            // Changes committed while reading may or may not be in the rows;
+            // applying them again changes nothing.
+            for (std::size_t i = 0; i < replay_.size(); ++i)
+            {
+                if (replay_[i].type == REPLICATION_ENQUEUE)
+                    insert(replay_[i].k, replay_[i].p, replay_[i].d);
+                else
+                    erase(replay_[i].k);
+            }
+            replay_.clear();
+
+            loading_ = false;
+            loaded_ = true;
+            loaded_at_ = stats::now();
+            held_ = items_.size();
+            ++loads_;
+            return true;
+        }
+
+        void head_index::apply(const std::vector<replicator::op>& ops)
+        {
+            if (ops.empty())
+                return;
+
+            boost::mutex::scoped_lock lock(mutex_);
+            for (std::size_t i = 0; i < ops.size(); ++i)
+            {
+                if (ops[i].type == REPLICATION_ENQUEUE)
+                    insert(ops[i].k, ops[i].p, ops[i].d);
+                else
+                    erase(ops[i].k);
+            }
+
+            if (loading_)
+                replay_.insert(replay_.end(), ops.begin(), ops.end());
+
+            // Too few items left to answer deep pages: load again.
+            if (!complete_ && (items_.empty() || (items_.size() < held_ / 2)))
+                loaded_ = false;
+        }
+
+        bool head_index::page(const position* after, int lo, int hi, std::size_t max,
+                              std::vector<replicator::op>& items)
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            if (!usable())
+            {
+                ++misses_;
+                return false;
+            }
+
+            // Start at the cursor or at the top of the range, whichever is
+            // further; keys start at 1, so (hi, 0) comes first in priority hi.
+            position top(hi, 0);
+            std::map<position, std::string, before>::const_iterator i =
+                (after && before()(top, *after)) ? items_.upper_bound(*after) : items_.lower_bound(top);
+            for (; (i != items_.end()) && (i->first.first >= lo) && (items.size() < max); ++i)
+            {
+                replicator::op o;
+                o.type = REPLICATION_ENQUEUE;
+                o.p = i->first.first;
+                o.k = i->first.second;
+                o.d = i->second;
+                items.push_back(o);
+            }
+
+            // Past the last item held, the queue may go on.
+            if ((items.size() < max) && (i == items_.end()) && !complete_)
+            {
+                items.clear();
+                ++misses_;
+                return false;
+            }
+
+            ++hits_;
+            return true;
+        }
+
+        bool head_index::head(int lo, int hi, std::string& d, bool& found)
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            if (!usable())
+            {
+                ++misses_;
+                return false;
+            }
+
+            // Keys start at 1: (hi, 0) comes before every item of priority hi.
+            std::map<position, std::string, before>::const_iterator i =
+                items_.lower_bound(position(hi, 0));
+            found = (i != items_.end()) && (i->first.first >= lo);
+            if (found)
+            {
+                d = i->second;
+            }
+            else if ((i == items_.end()) && !complete_)
+            {
+                // The band starts past the last item held.
+                ++misses_;
+                return false;
+            }
+
+            ++hits_;
+            return true;
+        }
+
+        void head_index::report(std::string& out, bool prometheus) const
+        {
+            if (!enabled())
+                return;
+
+            std::size_t items;
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                items = items_.size();
+            }
+
+            std::stringstream s;
+            if (prometheus)
+            {
+                s << "# TYPE lisa_head_index_items gauge\n"
+                  << "lisa_head_index_items " << items << "\n"
+                  << "# TYPE lisa_head_index_hits_total counter\n"
+                  << "lisa_head_index_hits_total " << hits_.load() << "\n"
+                  << "# TYPE lisa_head_index_misses_total counter\n"
+                  << "lisa_head_index_misses_total " << misses_.load() << "\n"
+                  << "# TYPE lisa_head_index_loads_total counter\n"
+                  << "lisa_head_index_loads_total " << loads_.load() << "\n";
+            }
+            else
+            {
+                s << "heads items=" << items
+                  << " hits=" << hits_.load()
+                  << " misses=" << misses_.load()
+                  << " loads=" << loads_.load() << "\n";
+            }
+            out += s.str();
+        }
+
+        void head_index::insert(boost::uint64_t k, int p, const std::string& d)
+        {
+            if (tombstones_.count(k) || priorities_.count(k))
+                return;
+
+            // Past the last item held, the index would have a hole.
+            position at(p, k);
+            if (!complete_ && (items_.empty() || before()(items_.rbegin()->first, at)))
+                return;
+
+            items_[at] = d;
+            priorities_[k] = p;
+            bytes_ += d.size();
+            trim();
+        }
+
+        void head_index::erase(boost::uint64_t k)
+        {
+            // Every dequeued key is remembered, so that an enqueue applied late
+            // (or again, after a load) does not bring it back.
+            if (tombstones_.insert(k).second)
+            {
+                buried_.push_back(k);
+                if (buried_.size() > HEAD_INDEX_TOMBSTONES)
+                {
+                    tombstones_.erase(buried_.front());
+                    buried_.pop_front();
+                }
+            }
+
+            std::map<boost::uint64_t, int>::iterator i = priorities_.find(k);
+            if (i == priorities_.end())
+                return;
+
+            std::map<position, std::string, before>::iterator j = items_.find(position(i->second, k));
+            bytes_ -= j->second.size();
+            items_.erase(j);
+            priorities_.erase(i);
+        }
+
+        void head_index::trim()
+        {
+            while (!items_.empty() && ((items_.size() > capacity_) || (bytes_ > HEAD_INDEX_BYTES)))
+            {
+                std::map<position, std::string, before>::iterator last = --items_.end();
+                bytes_ -= last->second.size();
+                priorities_.erase(last->first.second);
+                items_.erase(last);
+                complete_ = false;
+                held_ = items_.size();
+            }
+        }
+
+    } // namespace server3
+} // namespace http
@@ -0,0 +1,141 @@
+//
+// head_index.hpp
+// ~~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_HEAD_INDEX_HPP
+#define HTTP_SERVER3_HEAD_INDEX_HPP
+
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include "replicator.hpp"
+#include "soci.h"
+
+#define HEAD_INDEX_BYTES        (64 * 1024 * 1024)  // most bytes of items held
+#define HEAD_INDEX_REFRESH      10      // s before reloading, for writers it does not see
+#define HEAD_INDEX_TOMBSTONES   65536   // dequeues seen before their enqueue
+
+namespace http {
+    namespace server3 {
+
+/// The items at the head of the queue, in priority order, so that spy and
+/// peek are answered from memory instead of the database. The index is
+/// loaded with a plain (non-locking) read and then kept up to date with the
+/// changes every request commits, the same operations replication sends.
+/// It always holds every item ranked up to its last one: a new item ranked
+/// further is left out, and the last items are dropped past the capacity.
+/// Once dequeues leave it half empty it is loaded again, and so it is every
+/// few seconds, for the writers it does not see (another lisa handing over,
+/// statements run by hand).
+        class head_index
+            : private boost::noncopyable
+        {
+        public:
+            /// A position in priority order: priority and key.
+            typedef std::pair<int, boost::uint64_t> position;
+
+            /// Hold up to capacity items; 0 disables the index.
+            explicit head_index(std::size_t capacity);
+
+            /// Whether the index is used at all.
+            bool enabled() const
+            {
+                return capacity_ > 0;
+            }
+
+            /// Load the index again if it is enabled and stale, with plain reads,
+            /// outside any transaction. Returns false if it was not loaded (not
+            /// needed, or another thread is loading it).
+            bool refresh(soci::session& sql);
+
+            /// Apply changes committed to the queue.
+            void apply(const std::vector<replicator::op>& ops);
+
+            /// Up to max items with a priority in [lo, hi] ranked after the given
+            /// position (from the head if none), as enqueue operations. Returns
+            /// false if the index cannot tell: stale, or the page runs past its
+            /// last item.
+            bool page(const position* after, int lo, int hi, std::size_t max,
+                      std::vector<replicator::op>& items);
+
+            /// The head item with a priority in [lo, hi], if any. Returns false
+            /// if the index cannot tell.
+            bool head(int lo, int hi, std::string& d, bool& found);
+
+            /// Append the current state to a /stats report.
+            void report(std::string& out, bool prometheus) const;
+
+        private:
+            /// Dequeue order: highest priority, then oldest.
+            struct before
+            {
+                bool operator() (const position& a, const position& b) const
+                {
+                    return (a.first != b.first) ? (a.first > b.first) : (a.second < b.second);
+                }
+            };
+
+            /// Load the head items.
+            bool load(soci::session& sql);
+
+            void insert(boost::uint64_t k, int p, const std::string& d);
+            void erase(boost::uint64_t k);
+
+            /// Drop the last items while over capacity.
+            void trim();
+
+            /// Whether the index can answer; mutex_ held.
+            bool usable() const;
+
+            std::size_t capacity_;
+
+            /// Protects everything below.
+            mutable boost::mutex mutex_;
+
+            std::map<position, std::string, before> items_;
+            std::map<boost::uint64_t, int> priorities_;
+            std::size_t bytes_;
+
+            /// Keys dequeued before their enqueue was applied (two commits
+            /// applied in the other order), oldest first.
+            std::set<boost::uint64_t> tombstones_;
+            std::deque<boost::uint64_t> buried_;
+
+            /// Whether the index holds the whole queue.
+            bool complete_;
+
+            /// Whether it was loaded, and when.
+            bool loaded_;
+            boost::uint64_t loaded_at_;
+
+            /// Items held after the last load or trim; below half as many, an
+            /// incomplete index is loaded again.
+            std::size_t held_;
+
+            /// Changes applied while a load runs, applied again to its result.
+            bool loading_;
+            std::vector<replicator::op> replay_;
+
+            boost::atomic<boost::uint64_t> hits_;
+            boost::atomic<boost::uint64_t> misses_;
+            boost::atomic<boost::uint64_t> loads_;
+        };
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_HEAD_INDEX_HPP
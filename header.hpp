@@ -12,6 +12,9 @@
 #define HTTP_SERVER3_HEADER_HPP
 
 #include <string>
+#include <vector>
+#include <boost/utility/string_ref.hpp>
+#include "arena.hpp"
 
 namespace http {
     namespace server3 {
@@ -22,6 +25,18 @@ namespace http {
             std::string value;
         };
 
+        typedef std::vector<header, arena_allocator<header> > header_vector;
+
+        /// A decoded form or query string field, pointing into the buffer it
+        /// was decoded in.
+        struct field
+        {
+            boost::string_ref name;
+            boost::string_ref value;
+        };
+
+        typedef std::vector<field, arena_allocator<field> > field_vector;
+
     } // namespace server3
 } // namespace http
 
@@ -0,0 +1,183 @@
+//
+// item_codec.cpp
+// ~~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/trim.hpp>
+#include <zlib.h>
+#include "globals.hpp"
+#include "item_codec.hpp"
+
+namespace http {
+    namespace server3 {
+
+        item_codec::item_codec(std::size_t threshold)
+            : threshold_(threshold)
+        {
+        }
+
+        void item_codec::encode(boost::string_ref d, std::string& stored) const
+        {
+            if ((threshold_ > 0) && (d.size() >= threshold_))
+            {
+                uLongf size = compressBound(d.size());
+                stored.resize(CODEC_MAGIC_SIZE + size);
+                stored.replace(0, CODEC_MAGIC_SIZE, CODEC_MAGIC, CODEC_MAGIC_SIZE);
+
+                // Favour speed: the point is fewer bytes through InnoDB, not the
+                // best ratio.
+                int rc = compress2(reinterpret_cast<Bytef*>(&stored[CODEC_MAGIC_SIZE]), &size,
+                                   reinterpret_cast<const Bytef*>(d.data()), d.size(),
+                                   Z_BEST_SPEED);
+                if ((rc == Z_OK) && (CODEC_MAGIC_SIZE + size < d.size()))
+                {
+                    stored.resize(CODEC_MAGIC_SIZE + size);
+                    return;
+                }
+            }
+
+            if (marked(d, CODEC_MAGIC) || marked(d, CODEC_RAW))
+            {
+                stored.reserve(CODEC_MAGIC_SIZE + d.size());
+                stored.assign(CODEC_RAW, CODEC_MAGIC_SIZE);
+                stored.append(d.data(), d.size());
+                return;
+            }
+
+            stored.assign(d.data(), d.size());
+        }
+
+        bool item_codec::wrap(const std::string& z, std::string& stored)
+        {
+            // The stream is inflated once, through a scratch buffer, so that a
+            // truncated or oversized one is refused now instead of failing
+            // every dequeue later.
+            if ((z.size() < 2) || !expand(z.data(), z.size(), 0))
+                return false;
+
+            stored.reserve(CODEC_MAGIC_SIZE + z.size());
+            stored.assign(CODEC_MAGIC, CODEC_MAGIC_SIZE);
+            stored.append(z);
+            return true;
+        }
+
+        bool item_codec::compressed(const std::string& stored)
+        {
+            return (stored.size() > CODEC_MAGIC_SIZE) && marked(stored, CODEC_MAGIC);
+        }
+
+        void item_codec::unwrap(const std::string& stored, std::string& out)
+        {
+            out.append(stored, CODEC_MAGIC_SIZE, std::string::npos);
+        }
+
+        void item_codec::decode(const std::string& stored, std::string& d)
+        {
+            if (marked(stored, CODEC_RAW))
+            {
+                d.assign(stored, CODEC_MAGIC_SIZE, std::string::npos);
+                return;
+            }
+
+            if (!compressed(stored) ||
+                !expand(stored.data() + CODEC_MAGIC_SIZE, stored.size() - CODEC_MAGIC_SIZE, &d))
+            {
+                if (compressed(stored))
+                    LIERR("codec: corrupt stored item, returned as stored");
+                d = stored;
+            }
+        }
+
+        bool item_codec::accepts(const std::string& accept_encoding)
+        {
+            std::string::size_type begin = 0;
+            while (begin < accept_encoding.size())
+            {
+                std::string::size_type end = accept_encoding.find(',', begin);
+                if (end == std::string::npos)
+                    end = accept_encoding.size();
+
+                std::string coding(accept_encoding, begin, end - begin);
+                std::string::size_type semicolon = coding.find(';');
+                std::string q;
+                if (semicolon != std::string::npos)
+                {
+                    q = coding.substr(semicolon + 1);
+                    coding.erase(semicolon);
+                    boost::algorithm::trim(q);
+                }
+                boost::algorithm::trim(coding);
+
+                if (boost::algorithm::iequals(coding, CODEC_ENCODING) || (coding == "*"))
+                {
+                    // "deflate;q=0" explicitly refuses the coding.
+                    return !(boost::algorithm::istarts_with(q, "q=") &&
+                             (std::atof(q.c_str() + 2) <= 0));
+                }
+
+                begin = end + 1;
+            }
+            return false;
+        }
+
+        bool item_codec::marked(boost::string_ref data, const char* marker)
+        {
+            return (data.size() >= CODEC_MAGIC_SIZE) &&
+                (std::memcmp(data.data(), marker, CODEC_MAGIC_SIZE) == 0);
+        }
+
+        bool item_codec::expand(const char* z, std::size_t size, std::string* d)
+        {
+            z_stream zs = z_stream();
+            if (inflateInit(&zs) != Z_OK)
+                return false;
+
+            zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(z));
+            zs.avail_in = static_cast<uInt>(size);
+
+            // JSON payloads compress 5-10x; start there and grow as needed.
+            char scratch[CODEC_SCRATCH_SIZE];
+            if (d)
+                d->resize(std::min<std::size_t>(std::max<std::size_t>(size * 8, CODEC_SCRATCH_SIZE), CODEC_MAX_SIZE));
+
+            int rc = Z_OK;
+            while ((rc == Z_OK) && (zs.total_out <= CODEC_MAX_SIZE))
+            {
+                if (!d)
+                {
+                    zs.next_out = reinterpret_cast<Bytef*>(scratch);
+                    zs.avail_out = sizeof(scratch);
+                }
+                else
+                {
+                    if (zs.total_out == d->size())
+                    {
+                        if (d->size() >= CODEC_MAX_SIZE)
+                            break;
+                        d->resize(std::min<std::size_t>(d->size() * 2, CODEC_MAX_SIZE));
+                    }
+                    zs.next_out = reinterpret_cast<Bytef*>(&(*d)[zs.total_out]);
+                    zs.avail_out = static_cast<uInt>(d->size() - zs.total_out);
+                }
+                rc = inflate(&zs, Z_NO_FLUSH);
+            }
+
+            bool complete = (rc == Z_STREAM_END) && (zs.avail_in == 0) &&
+                (zs.total_out <= CODEC_MAX_SIZE);
+            if (d)
+                d->resize(zs.total_out);
+            inflateEnd(&zs);
+            return complete;
+        }
+
+    } // namespace server3
+} // namespace http
@@ -0,0 +1,79 @@
+//
+// item_codec.hpp
+// ~~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_ITEM_CODEC_HPP
+#define HTTP_SERVER3_ITEM_CODEC_HPP
+
+#include <cstddef>
+#include <string>
+#include <boost/noncopyable.hpp>
+#include <boost/utility/string_ref.hpp>
+
+// A compressed item is stored as CODEC_MAGIC followed by a zlib stream, i.e.
+// exactly what HTTP calls the "deflate" content coding. Other items are
+// stored as they were received, unless they start with one of the markers:
+// those are stored behind CODEC_RAW.
+#define CODEC_MAGIC         "\0Z"
+#define CODEC_RAW           "\0R"
+#define CODEC_MAGIC_SIZE    2
+#define CODEC_SCRATCH_SIZE  16384
+#define CODEC_MAX_SIZE      (16 * 1024 * 1024)
+#define CODEC_ENCODING      "deflate"
+
+namespace http {
+    namespace server3 {
+
+/// Transparent compression of stored items.
+        class item_codec
+            : private boost::noncopyable
+        {
+        public:
+            /// Compress items of at least threshold bytes; 0 disables compression.
+            explicit item_codec(std::size_t threshold);
+
+            /// Turn an item into its stored form, compressed when it is large enough
+            /// and compression actually saves space.
+            void encode(boost::string_ref d, std::string& stored) const;
+
+            /// Store a zlib stream received from a client as is. Returns false
+            /// unless it is one complete stream inflating to CODEC_MAX_SIZE bytes
+            /// at most.
+            static bool wrap(const std::string& z, std::string& stored);
+
+            /// Whether a stored item is compressed.
+            static bool compressed(const std::string& stored);
+
+            /// Append the zlib stream of a compressed stored item to out.
+            static void unwrap(const std::string& stored, std::string& out);
+
+            /// Turn a stored item back into the original data. A corrupt
+            /// compressed item is logged and handed back as stored, rather than
+            /// failing the dequeue that removed it.
+            static void decode(const std::string& stored, std::string& d);
+
+            /// Whether an Accept-Encoding header value allows the deflate coding.
+            static bool accepts(const std::string& accept_encoding);
+
+        private:
+            /// Whether data starts with a two byte marker.
+            static bool marked(boost::string_ref data, const char* marker);
+
+            /// Inflate a zlib stream into d, or only check it if d is 0. Returns
+            /// false unless the stream is complete, nothing follows it and it
+            /// inflates to CODEC_MAX_SIZE bytes at most.
+            static bool expand(const char* z, std::size_t size, std::string* d);
+
+            std::size_t threshold_;
+        };
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_ITEM_CODEC_HPP
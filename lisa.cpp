@@ -8,6 +8,7 @@
 // file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 //
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -17,7 +18,12 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/program_options.hpp>
 #include "server.hpp"
+#include "affinity.hpp"
+#include "cluster.hpp"
+#include "scheduler.hpp"
+#include "settings.hpp"
 #include "logger.hpp"
+#include "stats.hpp"
 
 #include <pthread.h>
 #include <signal.h>
@@ -26,6 +32,15 @@
 #define DEFAULT_ADDRESS  "0.0.0.0"
 #define DEFAULT_PORT      1972
 #define DEFAULT_THREADS    42
+#define DEFAULT_BINARY_PORT 0
+#define DEFAULT_COMPRESS    0
+#define DEFAULT_SPILL       0
+#define DEFAULT_HEAD_INDEX  0
+#define DEFAULT_DEDUP_WINDOW  0
+#define DEFAULT_DEDUP_ENTRIES 1048576
+#define DEFAULT_CONCURRENCY   0
+#define DEFAULT_LEASE_TIMEOUT 100
+#define DEFAULT_MIN_SESSIONS  1
 #define DEFAULT_SAMPLE1  "./lisa -d \"db=lisa user=root password=irr\""
 #define DEFAULT_SAMPLE2  "./lisa -d \"db=lisa user=root password=irr\" -a localhost"
 #define DEFAULT_SAMPLE3  "./lisa -d \"db=lisa user=root password=irr\" -a 127.0.0.1 -p 1972 -t 10"
@@ -39,6 +54,7 @@ it under the terms of the Boost Software License - Version 1.0.\n\
 LISA comes with ABSOLUTELY NO WARRANTY.\n\nAllowed Options"
 
 http::server3::logger g_logger;
+http::server3::stats g_stats;
 
 void help(boost::program_options::options_description& desc)
 {
@@ -49,6 +65,7 @@ void help(boost::program_options::options_description& desc)
 
 int main(int argc, char* argv[])
 {
+    int status = 0;
     try
     {
         // Parse command line arguments.
@@ -56,10 +73,18 @@ int main(int argc, char* argv[])
 
         std::string database;
         std::string address;
-        int port, threads;
-
-        std::stringstream smaxport, smaxthreads;
+        std::string bands;
+        std::string handoff;
+        std::string follow;
+        std::string cluster, self;
+        std::string cpus, background_cpus;
+        int port, threads, binary_port, compress, spill, head_index, dedup_window, dedup_entries;
+        int concurrency, lease_timeout, min_sessions, replication_port;
+
+        std::stringstream smaxport, smaxbinaryport, smaxreplicationport, smaxthreads;
         smaxport << "port [1," << MAX_PORT << "] (optional)";
+        smaxbinaryport << "binary protocol port [1," << MAX_PORT << "], 0 disables (optional)";
+        smaxreplicationport << "port replicas connect to [1," << MAX_PORT << "], 0 disables (optional)";
         smaxthreads << "threads [1," << MAX_THREADS << "] (optional)";
 
         po::options_description desc(HELP);
@@ -68,23 +93,82 @@ int main(int argc, char* argv[])
             ("database,d", po::value<std::string>(&database)->default_value(DEFAULT_DATABASE), "dsn (mandatory)")
             ("address,a", po::value<std::string>(&address)->default_value(DEFAULT_ADDRESS), "interface (optional)")
             ("port,p", po::value<int>(&port)->default_value(DEFAULT_PORT), smaxport.str().c_str())
-            ("threads,t", po::value<int>(&threads)->default_value(DEFAULT_THREADS), smaxthreads.str().c_str());
+            ("binary-port,b", po::value<int>(&binary_port)->default_value(DEFAULT_BINARY_PORT), smaxbinaryport.str().c_str())
+            ("threads,t", po::value<int>(&threads)->default_value(DEFAULT_THREADS), smaxthreads.str().c_str())
+            ("reuseport,r", "one io_service and SO_REUSEPORT acceptor per thread (optional)")
+            ("uring,U", "accept, read and write HTTP connections through io_uring instead of epoll; Linux 6.0 or later (optional)")
+            ("compress,z", po::value<int>(&compress)->default_value(DEFAULT_COMPRESS), "compress items of at least this many bytes, 0 disables (optional)")
+            ("spill,k", po::value<int>(&spill)->default_value(DEFAULT_SPILL), "store items of at least this many bytes (once compressed) in table b, their queue rows keeping a reference; 0 disables (optional)")
+            ("head-index,y", po::value<int>(&head_index)->default_value(DEFAULT_HEAD_INDEX), "head items kept in memory to answer spy and peek without the database, e.g. 4096; 0 disables (optional)")
+            ("dedup-window,w", po::value<int>(&dedup_window)->default_value(DEFAULT_DEDUP_WINDOW), "seconds enqueue keys are remembered in memory, 0 disables (optional)")
+            ("dedup-entries,e", po::value<int>(&dedup_entries)->default_value(DEFAULT_DEDUP_ENTRIES), "in-memory dedup index capacity (optional)")
+            ("bands,n", po::value<std::string>(&bands)->default_value(""), "priority bands dequeued round robin, floor:weight,... highest first; empty keeps strict priority order (optional)")
+            ("concurrency,c", po::value<int>(&concurrency)->default_value(DEFAULT_CONCURRENCY), "most requests using the database at once, adapted down under load; 0 for one per thread (optional)")
+            ("lease-timeout,l", po::value<int>(&lease_timeout)->default_value(DEFAULT_LEASE_TIMEOUT), "most milliseconds to wait for a database session before answering 503 (optional)")
+            ("min-sessions,m", po::value<int>(&min_sessions)->default_value(DEFAULT_MIN_SESSIONS), "database sessions open before accepting requests, at most one per thread; the others open in the background (optional)")
+            ("handoff,u", po::value<std::string>(&handoff)->default_value(""), "unix socket to take the listening sockets over from a running lisa, which then drains and exits, and to hand them to the next one (optional)")
+            ("replication-port,o", po::value<int>(&replication_port)->default_value(0), smaxreplicationport.str().c_str())
+            ("follow,f", po::value<std::string>(&follow)->default_value(""), "primary to replicate from, host:port; serves reads only until promoted (optional)")
+            ("cluster,s", po::value<std::string>(&cluster)->default_value(""), "cluster members, host:port,... (HTTP ports); topics are spread over them by consistent hashing (optional)")
+            ("self,i", po::value<std::string>(&self)->default_value(""), "this node in the cluster member list (mandatory with --cluster)")
+            ("proxy,x", "proxy requests for topics owned by other members instead of redirecting with 302 (optional)")
+            ("cpus,g", po::value<std::string>(&cpus)->default_value(""), "cpus the I/O threads (which also run the queries) are pinned to, one each in turn, e.g. 0-7,16-23 (optional)")
+            ("background-cpus,j", po::value<std::string>(&background_cpus)->default_value(""), "cpus the session opening and replication threads run on (optional)");
 
         po::variables_map vm;
         po::store(po::parse_command_line(argc, argv, desc), vm);
         po::notify(vm);
 
         // Check command line arguments.
+        std::vector<http::server3::scheduler::band> parsed;
+        std::vector<std::string> members;
+        std::vector<int> placement;
         if (((vm.count("help")) || (database == DEFAULT_DATABASE)) ||
             (((port <= 0) || (port > MAX_PORT)) ||
-             ((threads < 1) || (threads > MAX_THREADS))))
+             ((binary_port < 0) || (binary_port > MAX_PORT)) ||
+             ((threads < 1) || (threads > MAX_THREADS)) ||
+             (compress < 0) || (spill < 0) || (head_index < 0) || (dedup_window < 0) || (dedup_entries < 1) ||
+             (concurrency < 0) || (lease_timeout < 1) ||
+             (min_sessions < 1) || (min_sessions > threads) ||
+             ((replication_port < 0) || (replication_port > MAX_PORT)) ||
+             ((!follow.empty()) && (follow.find(':') == std::string::npos)) ||
+             (!http::server3::cluster::parse(cluster, members)) ||
+             (!http::server3::affinity::parse(cpus, placement)) ||
+             (!http::server3::affinity::parse(background_cpus, placement)) ||
+             ((!members.empty()) && (std::find(members.begin(), members.end(), self) == members.end())) ||
+             (!http::server3::scheduler::parse(bands, parsed))))
         {
             help(desc);
             return 1;
         }
 
-        std::stringstream sport;
-        sport << port;
+        http::server3::settings cfg;
+        cfg.database = database;
+        cfg.address = address;
+        cfg.port = boost::lexical_cast<std::string>(port);
+        if (binary_port > 0)
+            cfg.binary_port = boost::lexical_cast<std::string>(binary_port);
+        cfg.threads = boost::lexical_cast<std::size_t>(threads);
+        cfg.reuse_port = (vm.count("reuseport") > 0);
+        cfg.uring = (vm.count("uring") > 0);
+        cfg.compress_threshold = static_cast<std::size_t>(compress);
+        cfg.spill_threshold = static_cast<std::size_t>(spill);
+        cfg.head_index = static_cast<std::size_t>(head_index);
+        cfg.dedup_window = static_cast<std::size_t>(dedup_window);
+        cfg.dedup_entries = static_cast<std::size_t>(dedup_entries);
+        cfg.bands = bands;
+        cfg.concurrency = static_cast<std::size_t>(concurrency);
+        cfg.lease_timeout = lease_timeout;
+        cfg.min_sessions = static_cast<std::size_t>(min_sessions);
+        cfg.handoff = handoff;
+        if (replication_port > 0)
+            cfg.replication_port = boost::lexical_cast<std::string>(replication_port);
+        cfg.follow = follow;
+        cfg.cluster = cluster;
+        cfg.self = self;
+        cfg.proxy = (vm.count("proxy") > 0);
+        cfg.cpus = cpus;
+        cfg.background_cpus = background_cpus;
 
         // Block all signals for background thread.
         sigset_t new_mask;
@@ -93,8 +177,7 @@ int main(int argc, char* argv[])
         pthread_sigmask(SIG_BLOCK, &new_mask, &old_mask);
 
         // Run server in background thread.
-        std::size_t num_threads = boost::lexical_cast<std::size_t>(threads);
-        http::server3::server s(database, address, sport.str(), num_threads);
+        http::server3::server s(cfg);
         boost::thread t(boost::bind(&http::server3::server::run, &s));
 
         // Restore previous signals.
@@ -118,10 +201,12 @@ int main(int argc, char* argv[])
     {
         std::cerr << "exception: " << e.what() << std::endl;
         LIERR(e.what());
+        status = 1;
     }
 
+    g_logger.stop();
     log4cpp::Category::shutdown();
 
-    return 0;
+    return status;
 }
 
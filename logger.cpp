@@ -0,0 +1,193 @@
+//
+// logger.cpp
+// ~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <boost/bind.hpp>
+#include "logger.hpp"
+
+#include <pthread.h>
+#include <signal.h>
+
+namespace http {
+    namespace server3 {
+
+        logger::logger() : app_(new log4cpp::SyslogAppender("SyslogAppender", "lisa")),
+                           layout_(new log4cpp::BasicLayout()),
+                           cat_(log4cpp::Category::getInstance("lisa")),
+                           dropped_(0),
+                           running_(true),
+                           repeats_(0),
+                           second_(0),
+                           emitted_(0),
+                           suppressed_(0)
+        {
+            app_->setLayout(layout_);
+            cat_.setAdditivity(false);
+            cat_.setAppender(app_);
+            cat_.setPriority(log4cpp::Priority::ERROR);
+
+            last_.priority = 0;
+            last_.size = 0;
+
+            // The writer must not receive the signals main() waits for.
+            sigset_t new_mask;
+            sigfillset(&new_mask);
+            sigset_t old_mask;
+            pthread_sigmask(SIG_BLOCK, &new_mask, &old_mask);
+            thread_.reset(new boost::thread(boost::bind(&logger::run, this)));
+            pthread_sigmask(SIG_SETMASK, &old_mask, 0);
+        }
+
+        logger::~logger()
+        {
+            stop();
+        }
+
+        void logger::push(int priority, const char* message)
+        {
+            record r;
+            r.priority = priority;
+            r.size = std::strlen(message);
+            if (r.size >= LOG_RECORD_SIZE)
+                r.size = LOG_RECORD_SIZE - 1;
+            std::memcpy(r.text, message, r.size);
+            r.text[r.size] = '\0';
+
+            if (!queue_.bounded_push(r))
+                ++dropped_;
+        }
+
+        void logger::stop()
+        {
+            if (!thread_)
+                return;
+
+            running_ = false;
+            thread_->join();
+            thread_.reset();
+        }
+
+        void logger::run()
+        {
+            for (;;)
+            {
+                // Read the flag first so that nothing pushed before stop() is lost.
+                bool running = running_;
+
+                std::size_t n = 0;
+                record r;
+                while ((n < LOG_BATCH_SIZE) && queue_.pop(r))
+                {
+                    handle(r);
+                    ++n;
+                }
+
+                if (n == 0)
+                {
+                    summarize(!running);
+                    flush();
+
+                    if (!running)
+                        break;
+
+                    boost::this_thread::sleep(boost::posix_time::milliseconds(LOG_IDLE_MS));
+                }
+                else
+                {
+                    flush();
+                }
+            }
+        }
+
+        void logger::handle(const record& r)
+        {
+            if ((r.priority == last_.priority) && (r.size == last_.size) &&
+                (std::memcmp(r.text, last_.text, r.size) == 0))
+            {
+                ++repeats_;
+                return;
+            }
+
+            summarize();
+            last_ = r;
+
+            std::time_t now = std::time(0);
+            if (now != second_)
+            {
+                second_ = now;
+                emitted_ = 0;
+            }
+
+            if (emitted_ >= LOG_RATE_LIMIT)
+            {
+                ++suppressed_;
+                return;
+            }
+
+            emit(r.priority, std::string(r.text, r.size));
+        }
+
+        void logger::summarize(bool force)
+        {
+            if (repeats_)
+            {
+                std::stringstream s;
+                s << "last message repeated " << repeats_ << " times";
+                repeats_ = 0;
+                emit(last_.priority, s.str());
+            }
+
+            if (suppressed_ && (force || (std::time(0) != second_)))
+            {
+                std::stringstream s;
+                s << suppressed_ << " log messages suppressed by rate limit";
+                suppressed_ = 0;
+                emit(log4cpp::Priority::ERROR, s.str());
+            }
+
+            unsigned long dropped = dropped_.exchange(0);
+            if (dropped)
+            {
+                std::stringstream s;
+                s << dropped << " log messages dropped (queue full)";
+                emit(log4cpp::Priority::ERROR, s.str());
+            }
+        }
+
+        void logger::emit(int priority, const std::string& line)
+        {
+            ++emitted_;
+            cat_.log(priority, line);
+
+            std::string& out = (priority <= log4cpp::Priority::ERROR) ? err_ : out_;
+            out.append(line);
+            out.push_back('\n');
+        }
+
+        void logger::flush()
+        {
+            if (!out_.empty())
+            {
+                std::fwrite(out_.data(), 1, out_.size(), stdout);
+                std::fflush(stdout);
+                out_.clear();
+            }
+
+            if (!err_.empty())
+            {
+                std::fwrite(err_.data(), 1, err_.size(), stderr);
+                err_.clear();
+            }
+        }
+
+    } // namespace server3
+} // namespace http
@@ -11,42 +11,114 @@
 #ifndef HTTP_SERVER3_LOGGER_HPP
 #define HTTP_SERVER3_LOGGER_HPP
 
-#include <iostream>
+#include <ctime>
+#include <string>
 #include "SyslogAppender.hh"
 #include "Category.hh"
 #include "CategoryStream.hh"
 
+#include <boost/atomic.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/lockfree/queue.hpp>
 
-#define LINFO(MESSAGE) g_logger.get().log(log4cpp::Priority::INFO, MESSAGE); std::cout << MESSAGE << std::endl
-#define LIERR(MESSAGE) g_logger.get().log(log4cpp::Priority::ERROR, MESSAGE); std::cerr << MESSAGE << std::endl
+#define LINFO(MESSAGE) g_logger.push(log4cpp::Priority::INFO, MESSAGE)
+#define LIERR(MESSAGE) g_logger.push(log4cpp::Priority::ERROR, MESSAGE)
+
+#define LOG_RECORD_SIZE   256
+#define LOG_QUEUE_SIZE   4096
+#define LOG_BATCH_SIZE    256
+#define LOG_RATE_LIMIT    100
+#define LOG_IDLE_MS        10
 
 namespace http {
     namespace server3 {
 
-/// The logger service.
+/// The logger service. Producers only copy the message into a lock-free
+/// bounded queue; a background thread drains it, folds repeated messages,
+/// enforces a per-second line budget and writes whole batches to the console
+/// and to syslog. When the queue is full messages are dropped and counted,
+/// callers never block.
         class logger
             : private boost::noncopyable
         {
         public:
-            logger() : app_(new log4cpp::SyslogAppender("SyslogAppender", "lisa")),
-					   layout_(new log4cpp::BasicLayout()),					   
-					   cat_(log4cpp::Category::getInstance("lisa"))
+            logger();
+
+            ~logger();
+
+            /// Queue a message; never blocks. Messages are truncated to
+            /// LOG_RECORD_SIZE - 1 bytes.
+            void push(int priority, const char* message);
+
+            void push(int priority, const std::string& message)
             {
-                app_->setLayout(layout_);
-                cat_.setAdditivity(false);
-                cat_.setAppender(app_);
-                cat_.setPriority(log4cpp::Priority::ERROR);
+                push(priority, message.c_str());
             }
 
-			log4cpp::Category& get()
-			{
-				return cat_;
-			}
+            /// Write everything still queued and stop the background thread.
+            void stop();
+
         private:
+            /// A queued message.
+            struct record
+            {
+                int priority;
+                std::size_t size;
+                char text[LOG_RECORD_SIZE];
+            };
+
+            /// Background thread body.
+            void run();
+
+            /// Dedupe and rate-limit one record, appending it to the pending batch.
+            void handle(const record& r);
+
+            /// Emit the "repeated" and "dropped"/"suppressed" summaries, if any.
+            /// Suppressed lines are reported once their second is over, or now
+            /// when forced.
+            void summarize(bool force = false);
+
+            /// Append one line to the pending batch and send it to syslog.
+            void emit(int priority, const std::string& line);
+
+            /// Write the pending batch to the console.
+            void flush();
+
 			log4cpp::Appender* app_;
 			log4cpp::Layout* layout_;
 			log4cpp::Category& cat_;
+
+            /// Records waiting for the background thread.
+            boost::lockfree::queue<record, boost::lockfree::capacity<LOG_QUEUE_SIZE> > queue_;
+
+            /// Records lost because the queue was full.
+            boost::atomic<unsigned long> dropped_;
+
+            /// Cleared by stop().
+            boost::atomic<bool> running_;
+
+            /// Last record written, for de-duplication.
+            record last_;
+
+            /// Number of times last_ was seen again and not written.
+            unsigned long repeats_;
+
+            /// Second in which emitted_ lines were written.
+            std::time_t second_;
+
+            /// Lines written during second_.
+            unsigned long emitted_;
+
+            /// Lines suppressed by the rate limit during second_.
+            unsigned long suppressed_;
+
+            /// Pending console output, per stream.
+            std::string out_, err_;
+
+            /// The background thread.
+            boost::scoped_ptr<boost::thread> thread_;
         };
 
     } // namespace server3
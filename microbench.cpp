@@ -0,0 +1,499 @@
+//
+// microbench.cpp
+// ~~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <boost/asio.hpp>
+#include <boost/array.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "arena.hpp"
+#include "globals.hpp"
+#include "handler_allocator.hpp"
+#include "queue.hpp"
+#include "reply.hpp"
+#include "request.hpp"
+#include "request_parser.hpp"
+#include "url.hpp"
+
+// queue.cpp logs and records through these.
+http::server3::logger g_logger;
+http::server3::stats g_stats;
+
+// Every heap allocation made by the process goes through these, so each case
+// can report allocations and bytes per operation next to its timing.
+namespace {
+
+    boost::atomic<unsigned long> g_allocs(0);
+    boost::atomic<unsigned long> g_bytes(0);
+
+} // namespace
+
+namespace {
+
+    void* allocate(std::size_t size)
+    {
+        ++g_allocs;
+        g_bytes += size;
+        return std::malloc(size ? size : 1);
+    }
+
+    // Inlined into a caller, free() is seen releasing what operator new
+    // returned, which GCC 11 and later warn about although both go through
+    // malloc() and free() here.
+#if defined(__GNUC__) && !defined(__clang__) && (__GNUC__ >= 11)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+    void release(void* p)
+    {
+        std::free(p);
+    }
+#if defined(__GNUC__) && !defined(__clang__) && (__GNUC__ >= 11)
+#pragma GCC diagnostic pop
+#endif
+
+} // namespace
+
+// All the forms are replaced, so that every allocation and release pairs
+// malloc() with free().
+void* operator new(std::size_t size)
+{
+    void* p = allocate(size);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](std::size_t size)
+{
+    void* p = allocate(size);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) throw()
+{
+    return allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) throw()
+{
+    return allocate(size);
+}
+
+void operator delete(void* p) throw()
+{
+    release(p);
+}
+
+void operator delete[](void* p) throw()
+{
+    release(p);
+}
+
+void operator delete(void* p, std::size_t) throw()
+{
+    release(p);
+}
+
+void operator delete[](void* p, std::size_t) throw()
+{
+    release(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) throw()
+{
+    release(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) throw()
+{
+    release(p);
+}
+
+namespace {
+
+    /// Timing and allocation counters of one benchmark case.
+    class measure
+    {
+    public:
+        measure()
+            : start_(boost::posix_time::microsec_clock::universal_time()),
+              allocs_(g_allocs.load()), bytes_(g_bytes.load())
+        {
+        }
+
+        void report(const std::string& name, std::size_t ops) const
+        {
+            boost::posix_time::time_duration elapsed =
+                boost::posix_time::microsec_clock::universal_time() - start_;
+            double n = static_cast<double>(ops);
+            std::cout << std::left << std::setw(40) << name << std::right << std::fixed
+                      << std::setprecision(1)
+                      << std::setw(12) << (elapsed.total_nanoseconds() / n) << " ns/op"
+                      << std::setw(12) << ((g_bytes.load() - bytes_) / n) << " bytes/op"
+                      << std::setw(10) << std::setprecision(2)
+                      << ((g_allocs.load() - allocs_) / n) << " allocs/op" << std::endl;
+        }
+
+    private:
+        boost::posix_time::ptime start_;
+        unsigned long allocs_;
+        unsigned long bytes_;
+    };
+
+    /// Ping-pong over a socket pair with the same strand + bind + read/write
+    /// chain as connection, optionally through a handler_allocator.
+    template <bool Custom>
+    class echo_loop
+        : private boost::noncopyable
+    {
+    public:
+        explicit echo_loop(boost::asio::io_service& io_service)
+            : strand_(io_service), client_(io_service), server_(io_service), left_(0)
+        {
+            boost::asio::local::connect_pair(client_, server_);
+            message_.assign('x');
+        }
+
+        void run(std::size_t rounds)
+        {
+            left_ = rounds;
+            ping();
+        }
+
+    private:
+        template <typename Handler>
+        void read(boost::asio::local::stream_protocol::socket& s,
+                  http::server3::handler_allocator& a, Handler h)
+        {
+            if (Custom)
+                s.async_read_some(boost::asio::buffer(buffer_),
+                                  strand_.wrap(http::server3::make_custom_alloc_handler(a, h)));
+            else
+                s.async_read_some(boost::asio::buffer(buffer_), strand_.wrap(h));
+        }
+
+        template <typename Handler>
+        void write(boost::asio::local::stream_protocol::socket& s,
+                   http::server3::handler_allocator& a, Handler h)
+        {
+            if (Custom)
+                boost::asio::async_write(s, boost::asio::buffer(message_),
+                                         strand_.wrap(http::server3::make_custom_alloc_handler(a, h)));
+            else
+                boost::asio::async_write(s, boost::asio::buffer(message_), strand_.wrap(h));
+        }
+
+        void ping()
+        {
+            write(client_, client_allocator_,
+                  boost::bind(&echo_loop::handle_ping, this, boost::asio::placeholders::error));
+        }
+
+        void handle_ping(const boost::system::error_code& e)
+        {
+            if (!e)
+                read(server_, server_allocator_,
+                     boost::bind(&echo_loop::handle_request, this, boost::asio::placeholders::error));
+        }
+
+        void handle_request(const boost::system::error_code& e)
+        {
+            if (!e)
+                write(server_, server_allocator_,
+                      boost::bind(&echo_loop::handle_pong, this, boost::asio::placeholders::error));
+        }
+
+        void handle_pong(const boost::system::error_code& e)
+        {
+            if (!e)
+                read(client_, client_allocator_,
+                     boost::bind(&echo_loop::handle_reply, this, boost::asio::placeholders::error));
+        }
+
+        void handle_reply(const boost::system::error_code& e)
+        {
+            if (!e && --left_)
+                ping();
+        }
+
+        boost::asio::io_service::strand strand_;
+        boost::asio::local::stream_protocol::socket client_;
+        boost::asio::local::stream_protocol::socket server_;
+        http::server3::handler_allocator client_allocator_;
+        http::server3::handler_allocator server_allocator_;
+        boost::array<char, 64> buffer_;
+        boost::array<char, 64> message_;
+        std::size_t left_;
+    };
+
+    /// Run the io_service from several threads, as server::run does.
+    void run_pool(boost::asio::io_service& io_service, std::size_t threads)
+    {
+        boost::thread_group pool;
+        for (std::size_t i = 0; i < threads; ++i)
+            pool.create_thread(boost::bind(&boost::asio::io_service::run, &io_service));
+        pool.join_all();
+        io_service.reset();
+    }
+
+    template <bool Custom>
+    void bench_echo(const std::string& name, std::size_t rounds, std::size_t threads)
+    {
+        boost::asio::io_service io_service;
+        echo_loop<Custom> loop(io_service);
+
+        // Warm up so that one-off allocations (reactor registration, strand
+        // implementation, thread info) are not charged to the loop.
+        loop.run(100);
+        run_pool(io_service, threads);
+
+        measure m;
+        loop.run(rounds);
+        run_pool(io_service, threads);
+        m.report(name, rounds);
+    }
+
+    /// Requests as sent by curl, by JMeter's HTTP sampler and by a browser.
+    const char* corpus[][2] = {
+        { "curl enqueue",
+          "POST /10 HTTP/1.1\r\n"
+          "User-Agent: curl/7.19.7 (x86_64-pc-linux-gnu) libcurl/7.19.7 OpenSSL/0.9.8k zlib/1.2.3.3\r\n"
+          "Host: localhost:1972\r\n"
+          "Accept: */*\r\n"
+          "Content-Length: 6\r\n"
+          "Content-Type: application/x-www-form-urlencoded\r\n"
+          "\r\n"
+          "d=lara" },
+        { "curl dequeue",
+          "GET / HTTP/1.1\r\n"
+          "User-Agent: curl/7.19.7 (x86_64-pc-linux-gnu) libcurl/7.19.7 OpenSSL/0.9.8k zlib/1.2.3.3\r\n"
+          "Host: localhost:1972\r\n"
+          "Accept: */*\r\n"
+          "\r\n" },
+        { "jmeter enqueue 256B",
+          "POST /99 HTTP/1.1\r\n"
+          "Connection: keep-alive\r\n"
+          "Content-Length: 256\r\n"
+          "Content-Type: application/x-www-form-urlencoded\r\n"
+          "Host: localhost:1972\r\n"
+          "User-Agent: Apache-HttpClient/4.0.1 (java 1.5)\r\n"
+          "\r\n"
+          "d=%7B%22id%22%3A1264206913338%2C%22user%22%3A%22lara%22%2C%22action%22%3A%22"
+          "notify%22%2C%22payload%22%3A%22aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+          "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+          "aaaaaaaaaaaaaaaaaaaaaaaa%22%7D" },
+        { "browser spy",
+          "GET /spy HTTP/1.1\r\n"
+          "Host: localhost:1972\r\n"
+          "User-Agent: Mozilla/5.0 (X11; U; Linux x86_64; en-US; rv:1.9.1.7) Gecko/20100106 Firefox/3.5.7\r\n"
+          "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+          "Accept-Language: en-us,en;q=0.5\r\n"
+          "Accept-Encoding: gzip,deflate\r\n"
+          "Accept-Charset: ISO-8859-1,utf-8;q=0.7,*;q=0.7\r\n"
+          "Keep-Alive: 300\r\n"
+          "Connection: keep-alive\r\n"
+          "Cache-Control: max-age=0\r\n"
+          "\r\n" }
+    };
+
+    /// URIs and form bodies handed to url::decode.
+    const char* encoded[][2] = {
+        { "path", "/10" },
+        { "escaped path", "/my%20queue/spy%3Fx%3D1+y" },
+        { "form body 256B",
+          "d=%7B%22id%22%3A1264206913338%2C%22user%22%3A%22lara%22%2C%22action%22%3A%22"
+          "notify%22%2C%22payload%22%3A%22aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+          "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+          "aaaaaaaaaaaaaaaaaaaaaaaa%22%7D" }
+    };
+
+    /// Keeps results alive so the compiler cannot drop the work.
+    volatile std::size_t g_sink = 0;
+
+    /// Parse a request the way connection does: reusing the request, its
+    /// arena and the parser, fed in reads of at most chunk bytes.
+    void bench_parse(const std::string& name, const char* text, std::size_t chunk,
+                     std::size_t rounds)
+    {
+        http::server3::arena arena;
+        http::server3::request req(arena);
+        http::server3::request_parser parser;
+        std::size_t size = std::strlen(text);
+
+        measure m;
+        for (std::size_t i = 0; i < rounds; ++i)
+        {
+            parser.reset();
+            req.clear();
+            arena.reset();
+
+            boost::tribool result = boost::indeterminate;
+            for (std::size_t at = 0; boost::indeterminate(result) && (at < size); at += chunk)
+            {
+                boost::tie(result, boost::tuples::ignore) =
+                    parser.parse(req, text + at, text + std::min(at + chunk, size));
+            }
+            if (!result)
+            {
+                std::cerr << name << ": parse failed" << std::endl;
+                std::exit(1);
+            }
+            g_sink += req.headers.size();
+        }
+        m.report(name, rounds);
+    }
+
+    /// Build a dequeue reply and its buffers in a connection arena.
+    void bench_reply(std::size_t rounds)
+    {
+        http::server3::arena arena;
+        http::server3::reply rep(arena);
+
+        measure m;
+        for (std::size_t i = 0; i < rounds; ++i)
+        {
+            rep.clear();
+            arena.reset();
+
+            rep.content = "luma";
+            http::server3::queue::content(rep);
+            g_sink += rep.to_buffers().size();
+        }
+        m.report("queue::content + reply::to_buffers", rounds);
+    }
+
+    void bench_content(std::size_t rounds)
+    {
+        http::server3::reply rep;
+
+        measure m;
+        for (std::size_t i = 0; i < rounds; ++i)
+        {
+            rep.clear();
+            rep.content = "luma";
+            http::server3::queue::content(rep);
+            g_sink += rep.headers.size();
+        }
+        m.report("queue::content", rounds);
+    }
+
+    void bench_to_buffers(std::size_t rounds)
+    {
+        http::server3::reply rep;
+        rep.content = "luma";
+        http::server3::queue::content(rep);
+
+        measure m;
+        for (std::size_t i = 0; i < rounds; ++i)
+            g_sink += rep.to_buffers().size();
+        m.report("reply::to_buffers", rounds);
+    }
+
+    void bench_stock_reply(const std::string& name, http::server3::reply::status_type status,
+                           std::size_t rounds)
+    {
+        http::server3::arena arena;
+        http::server3::reply rep(arena);
+
+        measure m;
+        for (std::size_t i = 0; i < rounds; ++i)
+        {
+            rep.clear();
+            arena.reset();
+
+            rep = http::server3::reply::stock_reply(status);
+            g_sink += rep.headers.size();
+        }
+        m.report(name, rounds);
+    }
+
+    void bench_url_decode(const std::string& name, const std::string& in, std::size_t rounds)
+    {
+        std::string s;
+
+        measure m;
+        for (std::size_t i = 0; i < rounds; ++i)
+        {
+            s = in;
+            if (!http::server3::url::decode(s))
+            {
+                std::cerr << name << ": decode failed" << std::endl;
+                std::exit(1);
+            }
+            g_sink += s.size();
+        }
+        m.report(name, rounds);
+    }
+
+    /// Split and decode a form body into request fields, as request_handler does.
+    void bench_fields(const std::string& name, const std::string& in, std::size_t rounds)
+    {
+        http::server3::arena arena;
+        http::server3::request req(arena);
+
+        measure m;
+        for (std::size_t i = 0; i < rounds; ++i)
+        {
+            req.clear();
+            arena.reset();
+
+            req.field_data = in;
+            char* data = &req.field_data[0];
+            if (!http::server3::url::decode_fields(data, data + req.field_data.size(), req.fields))
+            {
+                std::cerr << name << ": decode failed" << std::endl;
+                std::exit(1);
+            }
+            g_sink += req.fields.size();
+        }
+        m.report(name, rounds);
+    }
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    std::size_t rounds = (argc > 1) ? std::strtoul(argv[1], 0, 10) : 100000;
+
+    bench_echo<false>("asio read/write, 1 thread", rounds, 1);
+    bench_echo<true>("asio read/write, 1 thread, custom", rounds, 1);
+    bench_echo<false>("asio read/write, 4 threads", rounds, 4);
+    bench_echo<true>("asio read/write, 4 threads, custom", rounds, 4);
+
+    for (std::size_t i = 0; i < sizeof(corpus) / sizeof(corpus[0]); ++i)
+    {
+        bench_parse(std::string("parse, ") + corpus[i][0], corpus[i][1], 8192, rounds);
+        bench_parse(std::string("parse 16B reads, ") + corpus[i][0], corpus[i][1], 16, rounds);
+    }
+
+    bench_content(rounds);
+    bench_to_buffers(rounds);
+    bench_reply(rounds);
+    bench_stock_reply("reply::stock_reply(not_found)", http::server3::reply::not_found, rounds);
+    bench_stock_reply("reply::stock_reply(bad_request)", http::server3::reply::bad_request, rounds);
+
+    for (std::size_t i = 0; i < sizeof(encoded) / sizeof(encoded[0]); ++i)
+        bench_url_decode(std::string("url::decode, ") + encoded[i][0], encoded[i][1], rounds);
+    bench_fields("url::decode_fields, enqueue form", "d=lara&k=order-1264206913338&ttl=60", rounds);
+    bench_fields("url::decode_fields, form body 256B", encoded[2][1], rounds);
+
+    return 0;
+}
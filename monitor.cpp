@@ -0,0 +1,95 @@
+//
+// monitor.cpp
+// ~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <string>
+#include <vector>
+#include <exception>
+#include <boost/lexical_cast.hpp>
+#include "monitor.hpp"
+#include "request_handler.hpp"
+#include "services.hpp"
+#include "soci.h"
+#include "soci-mysql.h"
+
+#define MAX_PRIORITIES 1000
+
+namespace http {
+    namespace server3 {
+
+        bool monitor::match(const std::string& path)
+        {
+            return path == STATS_URI;
+        }
+
+        int monitor::operator() (const request& req, reply& rep) const
+        {
+            if (req.method != "GET")
+            {
+                rep = reply::stock_reply(reply::method_not_allowed);
+                return request_handler::finished;
+            }
+
+            const boost::string_ref* format = req.field("format");
+            bool prometheus = format && (*format == PROMETHEUS_FORMAT);
+
+            // Queue depth per priority comes straight from the table; the rest
+            // of the report does not depend on the database being up, or
+            // admitting requests.
+            std::vector<int> priorities(MAX_PRIORITIES), depths(MAX_PRIORITIES);
+            try
+            {
+                lease db(req.svc->database_pool, &req.svc->admit, &req.svc->connect);
+                if (db.acquired())
+                {
+                    db.session() << "SELECT p, COUNT(*) FROM q GROUP BY p ORDER BY p DESC",
+                        soci::into(priorities), soci::into(depths);
+                }
+                else
+                {
+                    priorities.clear();
+                    depths.clear();
+                }
+            }
+            catch (std::exception const &e)
+            {
+                LIERR(e.what());
+                priorities.clear();
+                depths.clear();
+            }
+
+            std::vector<std::string> bands;
+            const std::vector<scheduler::band>& configured = req.svc->schedule.bands();
+            for (std::size_t i = 0; i < configured.size(); ++i)
+                bands.push_back(configured[i].label);
+
+            g_stats.report(rep.content, prometheus, priorities, depths, bands);
+            req.svc->admit.report(rep.content, prometheus);
+            req.svc->connect.report(rep.content, prometheus);
+            req.svc->replicate.report(rep.content, prometheus);
+            req.svc->heads.report(rep.content, prometheus);
+            req.svc->shard.report(rep.content, prometheus);
+
+            header hcl, hct;
+
+            hcl.name = CONTENT_LENGTH;
+            hcl.value = boost::lexical_cast<std::string>(rep.content.size());
+            rep.headers.push_back(hcl);
+
+            hct.name = CONTENT_TYPE;
+            hct.value = prometheus ? PROMETHEUS_TYPE : MIME_TYPE;
+            rep.headers.push_back(hct);
+
+            rep.status = reply::ok;
+
+            return request_handler::finished;
+        }
+
+    } // namespace server3
+} // namespace http
@@ -0,0 +1,42 @@
+//
+// monitor.hpp
+// ~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_MONITOR_HPP
+#define HTTP_SERVER3_MONITOR_HPP
+
+#include <string>
+#include <boost/noncopyable.hpp>
+#include "globals.hpp"
+#include "reply.hpp"
+#include "request.hpp"
+
+#define STATS_URI           "/stats"
+#define PROMETHEUS_FORMAT   "prometheus"
+#define PROMETHEUS_TYPE     "text/plain; version=0.0.4"
+
+namespace http {
+    namespace server3 {
+
+/// The instrumentation service: GET /stats in plain text, or
+/// GET /stats?format=prometheus in the Prometheus exposition format.
+        class monitor
+            : private boost::noncopyable
+        {
+        public:
+            /// Whether the decoded request path belongs to this service.
+            static bool match(const std::string& path);
+
+            int operator() (const request& req, reply& rep) const;
+        };
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_MONITOR_HPP
@@ -8,12 +8,19 @@
 // file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 //
 
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
 #include <sstream>
 #include <string>
+#include <vector>
 #include <exception>
+#include <stdexcept>
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/lexical_cast.hpp>
 #include "queue.hpp"
 #include "request_handler.hpp"
+#include "services.hpp"
 #include "soci.h"
 #include "soci-mysql.h"
 
@@ -28,13 +35,13 @@ namespace http {
                 return request_handler::finished;
             }
 
-            std::string action((req.uri.size() > 1) ? req.uri.substr(1) : "");
+            std::string action((req.path.size() > 1) ? req.path.substr(1) : "");
 
             try
             {
                 // Check for valid requests.
-                if ((!action.empty()) &&
-                    (action != "spy") && (action != "size") && (action != "count"))
+                if ((!action.empty()) && (action != "spy") && (action != "peek") &&
+                    (action != "stream") && (action != "size") && (action != "count"))
                 {
                     if (req.method == "GET")
                     {
@@ -48,9 +55,76 @@ namespace http {
                 LIERR(exc.what());
             }
 
-            soci::session sql(*req.database_pool);
+            // A replica serves reads from its copy of the primary's queue.
+            if (req.svc->replicate.read_only())
+                return replica(req, rep, action);
+
+            // Items of a stream are dequeued later, as the connection writes.
+            if ((req.method == "GET") && (action == "stream"))
+                return stream(req, rep);
+
+            if (req.method == "POST")
+                req.timing.op = stats::enqueue;
+            else if (action.empty())
+                req.timing.op = stats::dequeue;
+            else if ((action == "spy") || (action == "peek"))
+                req.timing.op = stats::spy;
+            else
+                req.timing.op = stats::count;
+
+            // Looking at the head takes no locks, and no session when the head
+            // index can answer.
+            if ((req.method == "GET") && ((action == "spy") || (action == "peek")))
+                return look(req, rep, action);
+
+            // Dequeues and counts may be restricted to a priority range.
+            int lo = std::numeric_limits<int>::min();
+            int hi = std::numeric_limits<int>::max();
+            if ((req.method == "GET") && !range(req, lo, hi))
+            {
+                rep = reply::stock_reply(reply::bad_request);
+                return request_handler::finished;
+            }
+
+            // A retried enqueue whose dedup key was stored recently succeeds
+            // again without touching the database.
+            const boost::string_ref* k = (req.method == "POST") ? req.field("k") : 0;
+            std::string key_data;
+            const std::string* key = 0;
+            if (k && !k->empty())
+            {
+                key_data.assign(k->data(), k->size());
+                key = &key_data;
+            }
+            if (key && (key->size() > DEDUP_MAX_KEY))
+            {
+                rep = reply::stock_reply(reply::bad_request);
+                return request_handler::finished;
+            }
+            if (key && req.svc->dedup.seen(*key))
+            {
+                content(rep);
+                return request_handler::finished;
+            }
+
+            boost::uint64_t waited = stats::now();
+            lease db(req.svc->database_pool, &req.svc->admit, &req.svc->connect);
+            req.timing.ns[stats::pool_wait] = stats::now() - waited;
+
+            if (!db.acquired())
+            {
+                busy(req, rep);
+                return request_handler::finished;
+            }
+
+            soci::session& sql = db.session();
+            stats::stopwatch database(req.timing, stats::database);
             bool rollback = false;
 
+            std::vector<replicator::op> ops;
+            std::vector<replicator::op>* log =
+                (req.svc->replicate.recording() || req.svc->heads.enabled()) ? &ops : 0;
+
             try
             {
                 // Check for queries size/count/spy or dequeue(default)
@@ -58,80 +132,60 @@ namespace http {
                 {
                     if (action == "size" || action == "count")
                     {
-                        int count;
-                        sql << "SELECT COUNT(*) FROM q", soci::into(count);
-
                         std::stringstream scount;
-                        scount << count;
+                        scount << size(sql, lo, hi);
 
                         rep.content = scount.str();
 
-                        content(req, rep);
+                        content(rep);
                         return request_handler::finished;
                     }
 
                     sql.begin();
                     rollback = true;
 
-                    // Retrieve data and k
+                    // Retrieve data
                     // URI must be: /spy or / (dequeue)
                     std::string d;
-                    soci::indicator ind;
-
-                    soci::statement st = (sql.prepare << "SELECT p(:r)",
-                                          soci::use((action.empty() ? 1 : 0)),
-                                          soci::into(d, ind));
-                    st.execute(true);
-
-                    if (sql.got_data())
+                    std::vector<scheduler::turn> turns;
+                    if (pop(sql, req.svc->schedule, action.empty() ? &turns : 0, d, log, lo, hi))
                     {
-                        switch (ind)
-                        {
-                            case soci::i_ok:
-                                rep.content = d;
-                                content(req, rep);
-                                break;
-                            case soci::i_null:
-                                rep = reply::stock_reply(reply::not_found);
-                                break;
-                            default:
-                                LIERR("soci: error retrieving data from SELECT p(:r)");
-                                rep = reply::stock_reply(reply::internal_server_error);
-                                return request_handler::finished;
-                        }
+                        item(req, d, rep);
                     }
                     else
                     {
-                        LIERR("soci: no data from SELECT p(:r)");
-                        rep = reply::stock_reply(reply::internal_server_error);
-                        sql.rollback();
-                        return request_handler::finished;
+                        rep = reply::stock_reply(reply::not_found);
                     }
 
                     sql.commit();
 
+                    served(req.svc->schedule, turns);
+                    req.svc->replicate.publish(ops);
+                    req.svc->heads.apply(ops);
+
                     return request_handler::finished;
                 }
                 else if (req.method == "POST")
                 {
-                    if (req.post_data.size() > 2)
+                    std::string stored;
+                    if (payload(req, stored))
                     {
-                        std::string uri((req.uri.size() > 1) ? req.uri.substr(1) : "0");
-
-                        std::string d = req.post_data.substr(2);
-
-                        int p(boost::lexical_cast<int>(uri));
+                        int p(action.empty() ? 0 : boost::lexical_cast<int>(action));
 
                         sql.begin();
                         rollback = true;
 
-                        soci::statement st = (sql.prepare << "INSERT INTO q(d, p) VALUES (:d, :p)",
-                                              soci::use(d), soci::use(p));
-                        st.execute(true);
+                        push(sql, req.svc->blobs, stored, p, key, log);
 
-                        content(req, rep);
+                        content(rep);
 
                         sql.commit();
+
+                        req.svc->replicate.publish(ops);
+                        req.svc->heads.apply(ops);
+
+                        if (key)
+                            req.svc->dedup.insert(*key);
                     }
                     else
                     {
@@ -155,6 +209,8 @@ namespace http {
                     }
                 }
 
+                db.failed(e);
+
                 rep = reply::stock_reply(reply::internal_server_error);
 
                 LIERR(e.what());
@@ -165,7 +221,1077 @@ namespace http {
             return request_handler::declined;
         }
 
-        void queue::content(const request& req, reply& rep) const
+        void queue::operator() (const frame& req, frame& rep) const
+        {
+            rep.code = frame::ok;
+            rep.tag = req.tag;
+            rep.body.clear();
+
+            stats::sample timing;
+            switch (req.code)
+            {
+                case frame::enqueue:
+                case frame::enqueue_batch:
+                case frame::enqueue_keyed:
+                    timing.op = stats::enqueue;
+                    break;
+                case frame::dequeue:
+                case frame::dequeue_batch:
+                case frame::dequeue_range:
+                    timing.op = stats::dequeue;
+                    break;
+                case frame::peek:
+                case frame::peek_batch:
+                case frame::peek_range:
+                    timing.op = stats::spy;
+                    break;
+                case frame::count:
+                case frame::count_range:
+                    timing.op = stats::count;
+                    break;
+            }
+
+            boost::uint64_t started = stats::now();
+
+            if (req.svc->replicate.read_only())
+            {
+                replica(req, rep);
+                timing.ns[stats::total] = stats::now() - started;
+                g_stats.record(timing);
+                return;
+            }
+
+            // Peeks take no session when the head index can answer.
+            if (indexed(req, rep))
+            {
+                timing.ns[stats::total] = stats::now() - started;
+                g_stats.record(timing);
+                return;
+            }
+
+            std::string key, d;
+            int p = 0;
+            if (req.code == frame::enqueue_keyed)
+            {
+                if (!keyed(req.body, p, key, d))
+                {
+                    rep.code = frame::bad_request;
+                    return;
+                }
+                if (req.svc->dedup.seen(key))
+                {
+                    timing.ns[stats::total] = stats::now() - started;
+                    g_stats.record(timing);
+                    return;
+                }
+            }
+
+            lease db(req.svc->database_pool, &req.svc->admit, &req.svc->connect);
+            if (!db.acquired())
+            {
+                rep.code = frame::busy;
+                return;
+            }
+
+            soci::session& sql = db.session();
+            boost::uint64_t leased = stats::now();
+            bool rollback = false;
+
+            std::vector<replicator::op> ops;
+            std::vector<replicator::op>* log =
+                (req.svc->replicate.recording() || req.svc->heads.enabled()) ? &ops : 0;
+
+            try
+            {
+                int lo, hi;
+                if (req.code == frame::count)
+                {
+                    frame::put_u32(rep.body, static_cast<boost::uint32_t>(size(sql)));
+                }
+                else if (req.code == frame::count_range)
+                {
+                    if ((req.body.size() == 8) && range(req.body, lo, hi))
+                        frame::put_u32(rep.body, static_cast<boost::uint32_t>(size(sql, lo, hi)));
+                    else
+                        rep.code = frame::bad_request;
+                }
+                else if (((req.code == frame::peek) || (req.code == frame::peek_batch) ||
+                          (req.code == frame::peek_range)) &&
+                         req.svc->heads.refresh(sql) && indexed(req, rep))
+                {
+                    // Answered by the head index, loaded again.
+                }
+                else
+                {
+                    std::vector<scheduler::turn> turns;
+
+                    sql.begin();
+                    rollback = true;
+
+                    if (req.code == frame::enqueue_keyed)
+                    {
+                        std::string stored;
+                        req.svc->codec.encode(d, stored);
+                        push(sql, req.svc->blobs, stored, p, &key, log);
+                    }
+                    else
+                    {
+                        execute(sql, req, rep, turns, log);
+                    }
+
+                    sql.commit();
+
+                    served(req.svc->schedule, turns);
+                    req.svc->replicate.publish(ops);
+                    req.svc->heads.apply(ops);
+
+                    if (!key.empty())
+                        req.svc->dedup.insert(key);
+                }
+            }
+            catch (std::exception const &e)
+            {
+                if (rollback)
+                {
+                    try
+                    {
+                        sql.rollback();
+                    }
+                    catch (std::exception const &ex)
+                    {
+                        LIERR(ex.what());
+                    }
+                }
+
+                db.failed(e);
+
+                rep.code = frame::error;
+                rep.body.clear();
+
+                LIERR(e.what());
+            }
+
+            boost::uint64_t finished = stats::now();
+            timing.ns[stats::pool_wait] = leased - started;
+            timing.ns[stats::database] = finished - leased;
+            timing.ns[stats::total] = finished - started;
+            g_stats.record(timing);
+        }
+
+        void queue::execute(soci::session& sql, const frame& req, frame& rep,
+                            std::vector<scheduler::turn>& turns,
+                            std::vector<replicator::op>* ops) const
+        {
+            const std::string& b = req.body;
+
+            switch (req.code)
+            {
+                case frame::enqueue:
+                {
+                    if (b.size() <= 4)
+                    {
+                        rep.code = frame::bad_request;
+                        return;
+                    }
+
+                    int p = static_cast<boost::int32_t>(frame::get_u32(b.data()));
+                    std::string stored;
+                    req.svc->codec.encode(b.substr(4), stored);
+                    push(sql, req.svc->blobs, stored, p, 0, ops);
+                    return;
+                }
+                case frame::dequeue:
+                case frame::peek:
+                {
+                    std::string stored;
+                    if (!pop(sql, req.svc->schedule, (req.code == frame::dequeue) ? &turns : 0, stored, ops))
+                    {
+                        rep.code = frame::empty;
+                        return;
+                    }
+                    item_codec::decode(stored, rep.body);
+                    return;
+                }
+                case frame::enqueue_batch:
+                {
+                    // Validate the whole batch before storing anything.
+                    if (b.size() < 4)
+                    {
+                        rep.code = frame::bad_request;
+                        return;
+                    }
+
+                    boost::uint32_t n = frame::get_u32(b.data());
+                    if ((n == 0) || (n > FRAME_MAX_BATCH))
+                    {
+                        rep.code = frame::bad_request;
+                        return;
+                    }
+
+                    std::vector<std::pair<std::size_t, std::size_t> > items;
+                    std::vector<int> priorities;
+                    std::size_t pos = 4;
+                    for (boost::uint32_t i = 0; i < n; ++i)
+                    {
+                        if (b.size() - pos < 8)
+                        {
+                            rep.code = frame::bad_request;
+                            return;
+                        }
+
+                        int p = static_cast<boost::int32_t>(frame::get_u32(b.data() + pos));
+                        std::size_t len = frame::get_u32(b.data() + pos + 4);
+                        pos += 8;
+
+                        if ((len == 0) || (b.size() - pos < len))
+                        {
+                            rep.code = frame::bad_request;
+                            return;
+                        }
+
+                        items.push_back(std::make_pair(pos, len));
+                        priorities.push_back(p);
+                        pos += len;
+                    }
+
+                    if (pos != b.size())
+                    {
+                        rep.code = frame::bad_request;
+                        return;
+                    }
+
+                    std::string stored;
+                    for (std::size_t i = 0; i < items.size(); ++i)
+                    {
+                        req.svc->codec.encode(b.substr(items[i].first, items[i].second), stored);
+                        push(sql, req.svc->blobs, stored, priorities[i], 0, ops);
+                    }
+
+                    frame::put_u32(rep.body, n);
+                    return;
+                }
+                case frame::dequeue_batch:
+                case frame::peek_batch:
+                case frame::dequeue_range:
+                case frame::peek_range:
+                {
+                    int lo, hi;
+                    boost::uint32_t max;
+                    if (!bounds(req, lo, hi, max))
+                    {
+                        rep.code = frame::bad_request;
+                        return;
+                    }
+
+                    std::vector<std::string> items;
+                    if ((req.code == frame::peek_batch) || (req.code == frame::peek_range))
+                    {
+                        std::vector<replicator::op> page;
+                        peek(sql, 0, lo, hi, max, page);
+                        for (std::size_t i = 0; i < page.size(); ++i)
+                        {
+                            items.push_back(std::string());
+                            items.back().swap(page[i].d);
+                        }
+                    }
+                    else
+                    {
+                        std::string d;
+                        while ((items.size() < max) && pop(sql, req.svc->schedule, &turns, d, ops, lo, hi))
+                        {
+                            items.push_back(d);
+                        }
+                    }
+
+                    batch(items, rep);
+                    return;
+                }
+                default:
+                    rep.code = frame::bad_request;
+                    return;
+            }
+        }
+
+        void queue::push(soci::session& sql, const blob_store& blobs, const std::string& d, int p,
+                         const std::string* key, std::vector<replicator::op>* ops) const
+        {
+            // A large item leaves only its reference in the row.
+            std::string ref;
+            bool spilled = blobs.spill(sql, d, ref);
+            const std::string& row = spilled ? ref : d;
+
+            if (!key)
+            {
+                soci::statement st = (sql.prepare << "INSERT INTO q(d, p) VALUES (:d, :p)",
+                                      soci::use(row), soci::use(p));
+                st.execute(true);
+            }
+            else
+            {
+                // The unique key column catches duplicates the in-memory index did
+                // not see (restarts, concurrent retries); they are dropped quietly.
+                // Only they are: any other error still fails the enqueue. The
+                // failed statement alone is undone, not the transaction.
+                try
+                {
+                    soci::statement st = (sql.prepare << "INSERT INTO q(d, p, u) VALUES (:d, :p, :u)",
+                                          soci::use(row), soci::use(p), soci::use(*key));
+                    st.execute(true);
+                }
+                catch (soci::mysql_soci_error const &e)
+                {
+                    if (e.err_num_ != QUEUE_DUPLICATE)
+                        throw;
+
+                    // A dropped duplicate holds no reference to its spilled item.
+                    if (spilled)
+                        blob_store::release(sql, ref);
+                    return;
+                }
+            }
+
+            if (!ops)
+                return;
+
+            // Replicas need the key the row got.
+            long long k = 0;
+            sql << "SELECT LAST_INSERT_ID()", soci::into(k);
+
+            replicator::op o;
+            o.type = REPLICATION_ENQUEUE;
+            o.k = static_cast<boost::uint64_t>(k);
+            o.p = p;
+            o.d = d;
+            ops->push_back(o);
+        }
+
+        bool queue::keyed(const std::string& b, int& p, std::string& key, std::string& d)
+        {
+            if (b.size() < 8)
+                return false;
+
+            std::size_t size = frame::get_u32(b.data() + 4);
+            if ((size == 0) || (size > DEDUP_MAX_KEY) || (b.size() - 8 <= size))
+                return false;
+
+            p = static_cast<boost::int32_t>(frame::get_u32(b.data()));
+            key.assign(b, 8, size);
+            d.assign(b, 8 + size, std::string::npos);
+            return true;
+        }
+
+        bool queue::pop(soci::session& sql, scheduler& schedule,
+                        std::vector<scheduler::turn>* turns, std::string& d,
+                        std::vector<replicator::op>* ops, int lo, int hi) const
+        {
+            // Start with the band whose turn it is, counting the items this
+            // transaction already took, and fall through to the others while
+            // they are empty.
+            const std::vector<scheduler::band>& bands = schedule.bands();
+            std::size_t first = turns ? schedule.next(*turns) : schedule.next();
+            bool passed = true;
+
+            for (std::size_t i = 0; i < bands.size(); ++i)
+            {
+                std::size_t b = (first + i) % bands.size();
+                soci::indicator ind;
+
+                // Only the part of the band within the range, a seek on ip.
+                int from = std::max(lo, bands[b].lo);
+                int to = std::min(hi, bands[b].hi);
+                if (from > to)
+                {
+                    passed = false;
+                    continue;
+                }
+
+                // p() locks the row it reads; a spy needs no lock.
+                if (!turns)
+                {
+                    soci::statement st = (sql.prepare << "SELECT d FROM q WHERE p BETWEEN :lo AND :hi ORDER BY p DESC, k LIMIT 1",
+                                          soci::use(from), soci::use(to),
+                                          soci::into(d, ind));
+                    st.execute(true);
+
+                    if (!sql.got_data() || (ind == soci::i_null))
+                        continue;
+
+                    if (ind != soci::i_ok)
+                    {
+                        throw std::runtime_error("soci: error retrieving data from SELECT d FROM q");
+                    }
+
+                    blob_store::fetch(sql, d, false);
+                    return true;
+                }
+
+                soci::statement st = (sql.prepare << "SELECT p(1, :lo, :hi)",
+                                      soci::use(from), soci::use(to),
+                                      soci::into(d, ind));
+                st.execute(true);
+
+                if (!sql.got_data())
+                {
+                    throw std::runtime_error("soci: no data from SELECT p(1, :lo, :hi)");
+                }
+
+                if (ind == soci::i_null)
+                    continue;
+
+                // The item comes after the time it waited, in microseconds, and
+                // its key.
+                if ((ind != soci::i_ok) || (d.size() < QUEUE_WAIT_DIGITS + QUEUE_KEY_DIGITS))
+                {
+                    throw std::runtime_error("soci: error retrieving data from SELECT p(1, :lo, :hi)");
+                }
+
+                scheduler::turn t;
+                t.b = b;
+                t.passed = passed;
+                t.wait = std::strtoull(d.substr(0, QUEUE_WAIT_DIGITS).c_str(), 0, 10);
+                turns->push_back(t);
+
+                if (ops)
+                {
+                    replicator::op o;
+                    o.type = REPLICATION_DEQUEUE;
+                    o.k = std::strtoull(d.substr(QUEUE_WAIT_DIGITS, QUEUE_KEY_DIGITS).c_str(), 0, 10);
+                    o.p = 0;
+                    ops->push_back(o);
+                }
+
+                d.erase(0, QUEUE_WAIT_DIGITS + QUEUE_KEY_DIGITS);
+                blob_store::fetch(sql, d, true);
+                return true;
+            }
+
+            return false;
+        }
+
+        void queue::peek(soci::session& sql, const head_index::position* after, int lo, int hi,
+                         std::size_t max, std::vector<replicator::op>& items) const
+        {
+            int limit = static_cast<int>(max);
+            std::vector<long long> ks(max);
+            std::vector<int> ps(max);
+            std::vector<std::string> ds(max);
+            if (after)
+            {
+                int p = after->first;
+                long long k = static_cast<long long>(after->second);
+                sql << "SELECT k, p, d FROM q WHERE p BETWEEN :lo AND :hi AND "
+                    "(p < :p OR (p = :same AND k > :k)) ORDER BY p DESC, k LIMIT :n",
+                    soci::use(lo), soci::use(hi), soci::use(p), soci::use(p), soci::use(k),
+                    soci::use(limit), soci::into(ks), soci::into(ps), soci::into(ds);
+            }
+            else
+            {
+                sql << "SELECT k, p, d FROM q WHERE p BETWEEN :lo AND :hi ORDER BY p DESC, k LIMIT :n",
+                    soci::use(lo), soci::use(hi), soci::use(limit),
+                    soci::into(ks), soci::into(ps), soci::into(ds);
+            }
+
+            for (std::size_t i = 0; i < ks.size(); ++i)
+            {
+                replicator::op o;
+                o.type = REPLICATION_ENQUEUE;
+                o.k = static_cast<boost::uint64_t>(ks[i]);
+                o.p = ps[i];
+                o.d.swap(ds[i]);
+                blob_store::fetch(sql, o.d, false);
+                items.push_back(o);
+            }
+        }
+
+        int queue::size(soci::session& sql, int lo, int hi) const
+        {
+            int count;
+            if ((lo == std::numeric_limits<int>::min()) && (hi == std::numeric_limits<int>::max()))
+            {
+                sql << "SELECT COUNT(*) FROM q", soci::into(count);
+            }
+            else
+            {
+                sql << "SELECT COUNT(*) FROM q WHERE p BETWEEN :lo AND :hi",
+                    soci::use(lo), soci::use(hi), soci::into(count);
+            }
+            return count;
+        }
+
+        int queue::stream(const request& req, reply& rep) const
+        {
+            const boost::string_ref* window = req.field("window");
+            const boost::string_ref* credit = req.field("credit");
+
+            rep.stream_window = QUEUE_STREAM_WINDOW;
+            rep.stream_credit = std::numeric_limits<std::size_t>::max();
+            try
+            {
+                if (window)
+                    rep.stream_window = boost::lexical_cast<std::size_t>(*window);
+                if (credit)
+                    rep.stream_credit = boost::lexical_cast<std::size_t>(*credit);
+            }
+            catch (boost::bad_lexical_cast&)
+            {
+                rep = reply::stock_reply(reply::bad_request);
+                return request_handler::finished;
+            }
+
+            int lo, hi;
+            if ((rep.stream_window == 0) || (rep.stream_window > FRAME_MAX_BATCH) ||
+                !range(req, lo, hi))
+            {
+                rep = reply::stock_reply(reply::bad_request);
+                return request_handler::finished;
+            }
+
+            header hte, hct;
+
+            hte.name = TRANSFER_ENCODING;
+            hte.value = CHUNKED;
+            rep.headers.push_back(hte);
+
+            hct.name = CONTENT_TYPE;
+            hct.value = QUEUE_STREAM_TYPE;
+            rep.headers.push_back(hct);
+
+            rep.status = reply::ok;
+
+            return request_handler::finished;
+        }
+
+        bool queue::drain(const request& req, std::size_t max, std::vector<std::string>& items) const
+        {
+            stats::sample timing;
+            timing.op = stats::dequeue;
+
+            // The range was checked when the stream opened.
+            int lo, hi;
+            range(req, lo, hi);
+
+            // A stream turned away just polls again later.
+            boost::uint64_t started = stats::now();
+            lease db(req.svc->database_pool, &req.svc->admit, &req.svc->connect);
+            if (!db.acquired())
+                return true;
+
+            soci::session& sql = db.session();
+            boost::uint64_t leased = stats::now();
+            bool rollback = false;
+            bool done = true;
+
+            std::vector<replicator::op> ops;
+            std::vector<replicator::op>* log =
+                (req.svc->replicate.recording() || req.svc->heads.enabled()) ? &ops : 0;
+
+            try
+            {
+                sql.begin();
+                rollback = true;
+
+                std::string d;
+                std::vector<scheduler::turn> turns;
+                while ((items.size() < max) && pop(sql, req.svc->schedule, &turns, d, log, lo, hi))
+                {
+                    items.push_back(std::string());
+                    item_codec::decode(d, items.back());
+                }
+
+                sql.commit();
+
+                served(req.svc->schedule, turns);
+                req.svc->replicate.publish(ops);
+                req.svc->heads.apply(ops);
+            }
+            catch (std::exception const &e)
+            {
+                if (rollback)
+                {
+                    try
+                    {
+                        sql.rollback();
+                    }
+                    catch (std::exception const &ex)
+                    {
+                        LIERR(ex.what());
+                    }
+                }
+
+                db.failed(e);
+
+                items.clear();
+                done = false;
+
+                LIERR(e.what());
+            }
+
+            // Empty polls say nothing about dequeue latency.
+            if (!items.empty())
+            {
+                boost::uint64_t finished = stats::now();
+                timing.ns[stats::pool_wait] = leased - started;
+                timing.ns[stats::database] = finished - leased;
+                timing.ns[stats::total] = finished - started;
+                g_stats.record(timing);
+            }
+            return done;
+        }
+
+        int queue::look(const request& req, reply& rep, const std::string& action) const
+        {
+            bool spy = (action == "spy");
+            std::size_t max = 1;
+            head_index::position at;
+            bool after = false;
+            int lo, hi;
+            if (!range(req, lo, hi) || (!spy && !cursor(req, max, at, after)))
+            {
+                rep = reply::stock_reply(reply::bad_request);
+                return request_handler::finished;
+            }
+
+            head_index& heads = req.svc->heads;
+            std::string d;
+            bool found = false;
+            std::vector<replicator::op> items;
+
+            bool indexed = heads.enabled() &&
+                (spy ? glance(heads, req.svc->schedule, lo, hi, d, found) :
+                 heads.page(after ? &at : 0, lo, hi, max, items));
+
+            if (!indexed)
+            {
+                boost::uint64_t waited = stats::now();
+                lease db(req.svc->database_pool, &req.svc->admit, &req.svc->connect);
+                req.timing.ns[stats::pool_wait] = stats::now() - waited;
+
+                if (!db.acquired())
+                {
+                    busy(req, rep);
+                    return request_handler::finished;
+                }
+
+                soci::session& sql = db.session();
+                stats::stopwatch database(req.timing, stats::database);
+                bool rollback = false;
+
+                try
+                {
+                    // A stale index is loaded and asked again; plain reads, in
+                    // one snapshot with the blobs, answer what it cannot tell.
+                    indexed = heads.refresh(sql) &&
+                        (spy ? glance(heads, req.svc->schedule, lo, hi, d, found) :
+                         heads.page(after ? &at : 0, lo, hi, max, items));
+
+                    if (!indexed)
+                    {
+                        sql.begin();
+                        rollback = true;
+
+                        if (spy)
+                            found = pop(sql, req.svc->schedule, 0, d, 0, lo, hi);
+                        else
+                            peek(sql, after ? &at : 0, lo, hi, max, items);
+
+                        sql.commit();
+                    }
+                }
+                catch (std::exception const &e)
+                {
+                    if (rollback)
+                    {
+                        try
+                        {
+                            sql.rollback();
+                        }
+                        catch (std::exception const &ex)
+                        {
+                            LIERR(ex.what());
+                        }
+                    }
+
+                    db.failed(e);
+
+                    rep = reply::stock_reply(reply::internal_server_error);
+
+                    LIERR(e.what());
+
+                    return request_handler::finished;
+                }
+            }
+
+            if (!spy)
+                page(items, max, rep);
+            else if (found)
+                item(req, d, rep);
+            else
+                rep = reply::stock_reply(reply::not_found);
+
+            return request_handler::finished;
+        }
+
+        bool queue::indexed(const frame& req, frame& rep) const
+        {
+            head_index& heads = req.svc->heads;
+            if (!heads.enabled())
+                return false;
+
+            if (req.code == frame::peek)
+            {
+                std::string d;
+                bool found = false;
+                if (!glance(heads, req.svc->schedule, std::numeric_limits<int>::min(),
+                            std::numeric_limits<int>::max(), d, found))
+                    return false;
+
+                if (found)
+                    item_codec::decode(d, rep.body);
+                else
+                    rep.code = frame::empty;
+                return true;
+            }
+
+            // Invalid batches are turned away by execute().
+            int lo, hi;
+            boost::uint32_t max;
+            if (((req.code != frame::peek_batch) && (req.code != frame::peek_range)) ||
+                !bounds(req, lo, hi, max))
+                return false;
+
+            std::vector<replicator::op> page;
+            if (!heads.page(0, lo, hi, max, page))
+                return false;
+
+            std::vector<std::string> items(page.size());
+            for (std::size_t i = 0; i < page.size(); ++i)
+                items[i].swap(page[i].d);
+            batch(items, rep);
+            return true;
+        }
+
+        bool queue::glance(head_index& heads, scheduler& schedule, int lo, int hi,
+                           std::string& d, bool& found)
+        {
+            // The bands in the order pop() looks at them.
+            const std::vector<scheduler::band>& bands = schedule.bands();
+            std::size_t first = schedule.next();
+
+            for (std::size_t i = 0; i < bands.size(); ++i)
+            {
+                std::size_t b = (first + i) % bands.size();
+                int from = std::max(lo, bands[b].lo);
+                int to = std::min(hi, bands[b].hi);
+                if (from > to)
+                    continue;
+                if (!heads.head(from, to, d, found))
+                    return false;
+                if (found)
+                    return true;
+            }
+
+            found = false;
+            return true;
+        }
+
+        bool queue::range(const request& req, int& lo, int& hi)
+        {
+            const boost::string_ref* from = req.field("lo");
+            const boost::string_ref* to = req.field("hi");
+
+            lo = std::numeric_limits<int>::min();
+            hi = std::numeric_limits<int>::max();
+            try
+            {
+                if (from)
+                    lo = boost::lexical_cast<int>(*from);
+                if (to)
+                    hi = boost::lexical_cast<int>(*to);
+            }
+            catch (boost::bad_lexical_cast&)
+            {
+                return false;
+            }
+            return lo <= hi;
+        }
+
+        bool queue::range(const std::string& b, int& lo, int& hi)
+        {
+            if (b.size() < 8)
+                return false;
+
+            lo = static_cast<boost::int32_t>(frame::get_u32(b.data()));
+            hi = static_cast<boost::int32_t>(frame::get_u32(b.data() + 4));
+            return lo <= hi;
+        }
+
+        bool queue::bounds(const frame& req, int& lo, int& hi, boost::uint32_t& max)
+        {
+            const std::string& b = req.body;
+            std::size_t at = 0;
+
+            lo = std::numeric_limits<int>::min();
+            hi = std::numeric_limits<int>::max();
+            if ((req.code == frame::dequeue_range) || (req.code == frame::peek_range))
+            {
+                if (!range(b, lo, hi))
+                    return false;
+                at = 8;
+            }
+
+            max = (b.size() == at + 4) ? frame::get_u32(b.data() + at) : 0;
+            return (max > 0) && (max <= FRAME_MAX_BATCH);
+        }
+
+        bool queue::cursor(const request& req, std::size_t& max, head_index::position& at,
+                           bool& after)
+        {
+            // The cursor is the X-Lisa-Next of the previous page: "p:k".
+            const boost::string_ref* n = req.field("n");
+            const boost::string_ref* from = req.field("after");
+
+            max = QUEUE_PEEK_ITEMS;
+            after = false;
+            try
+            {
+                if (n)
+                    max = boost::lexical_cast<std::size_t>(*n);
+                if (from)
+                {
+                    boost::string_ref::size_type colon = from->find(':');
+                    if (colon == boost::string_ref::npos)
+                        return false;
+                    at.first = boost::lexical_cast<int>(from->substr(0, colon));
+                    at.second = boost::lexical_cast<boost::uint64_t>(from->substr(colon + 1));
+                    after = true;
+                }
+            }
+            catch (boost::bad_lexical_cast&)
+            {
+                return false;
+            }
+
+            return (max > 0) && (max <= FRAME_MAX_BATCH);
+        }
+
+        void queue::page(const std::vector<replicator::op>& items, std::size_t max, reply& rep)
+        {
+            // Laid out as an enqueue batch: i32 priority | u32 size | data.
+            std::string d;
+            for (std::size_t i = 0; i < items.size(); ++i)
+            {
+                item_codec::decode(items[i].d, d);
+                frame::put_u32(rep.content, static_cast<boost::uint32_t>(items[i].p));
+                frame::put_u32(rep.content, static_cast<boost::uint32_t>(d.size()));
+                rep.content.append(d);
+            }
+
+            header hcl, hct;
+
+            hcl.name = CONTENT_LENGTH;
+            hcl.value = boost::lexical_cast<std::string>(rep.content.size());
+            rep.headers.push_back(hcl);
+
+            hct.name = CONTENT_TYPE;
+            hct.value = QUEUE_STREAM_TYPE;
+            rep.headers.push_back(hct);
+
+            // A full page may not be the last one.
+            if (!items.empty() && (items.size() == max))
+            {
+                header hn;
+                hn.name = QUEUE_PEEK_NEXT;
+                hn.value = boost::lexical_cast<std::string>(items.back().p) + ":" +
+                    boost::lexical_cast<std::string>(items.back().k);
+                rep.headers.push_back(hn);
+            }
+
+            rep.status = reply::ok;
+        }
+
+        int queue::replica(const request& req, reply& rep, const std::string& action) const
+        {
+            if ((req.method != "GET") || action.empty() || (action == "stream"))
+            {
+                req.timing.op = -1;
+                rep = reply::stock_reply(reply::forbidden);
+                return request_handler::finished;
+            }
+
+            req.timing.op = ((action == "spy") || (action == "peek")) ? stats::spy : stats::count;
+
+            std::size_t max = 1;
+            head_index::position at;
+            bool after = false;
+            int lo, hi;
+            if (!range(req, lo, hi) || ((action == "peek") && !cursor(req, max, at, after)))
+            {
+                rep = reply::stock_reply(reply::bad_request);
+                return request_handler::finished;
+            }
+
+            if (!req.svc->replicate.synced())
+            {
+                busy(req, rep);
+                return request_handler::finished;
+            }
+
+            if ((action == "spy") || (action == "peek"))
+            {
+                std::vector<replicator::op> items;
+                req.svc->replicate.page(after ? &at : 0, lo, hi, max, items);
+                if (action == "peek")
+                    page(items, max, rep);
+                else if (items.empty())
+                    rep = reply::stock_reply(reply::not_found);
+                else
+                    item(req, items[0].d, rep);
+                return request_handler::finished;
+            }
+
+            rep.content = boost::lexical_cast<std::string>(req.svc->replicate.count(lo, hi));
+            content(rep);
+            return request_handler::finished;
+        }
+
+        void queue::replica(const frame& req, frame& rep) const
+        {
+            if ((req.code != frame::peek) && (req.code != frame::peek_batch) &&
+                (req.code != frame::peek_range) && (req.code != frame::count) &&
+                (req.code != frame::count_range))
+            {
+                rep.code = frame::read_only;
+                return;
+            }
+
+            int lo = std::numeric_limits<int>::min();
+            int hi = std::numeric_limits<int>::max();
+            boost::uint32_t max = 1;
+            bool valid = true;
+            if (req.code == frame::count_range)
+                valid = (req.body.size() == 8) && range(req.body, lo, hi);
+            else if ((req.code == frame::peek_batch) || (req.code == frame::peek_range))
+                valid = bounds(req, lo, hi, max);
+
+            if (!valid)
+            {
+                rep.code = frame::bad_request;
+                return;
+            }
+
+            if (!req.svc->replicate.synced())
+            {
+                rep.code = frame::busy;
+                return;
+            }
+
+            if ((req.code == frame::count) || (req.code == frame::count_range))
+            {
+                frame::put_u32(rep.body, static_cast<boost::uint32_t>(req.svc->replicate.count(lo, hi)));
+                return;
+            }
+
+            std::vector<replicator::op> page;
+            req.svc->replicate.page(0, lo, hi, max, page);
+
+            std::vector<std::string> items(page.size());
+            for (std::size_t i = 0; i < page.size(); ++i)
+                items[i].swap(page[i].d);
+
+            if (req.code != frame::peek)
+            {
+                batch(items, rep);
+            }
+            else if (items.empty())
+            {
+                rep.code = frame::empty;
+            }
+            else
+            {
+                item_codec::decode(items[0], rep.body);
+            }
+        }
+
+        void queue::served(scheduler& schedule, const std::vector<scheduler::turn>& turns)
+        {
+            schedule.served(turns);
+            for (std::size_t i = 0; i < turns.size(); ++i)
+                g_stats.wait(turns[i].b, turns[i].wait);
+        }
+
+        void queue::batch(const std::vector<std::string>& items, frame& rep)
+        {
+            if (items.empty())
+            {
+                rep.code = frame::empty;
+                return;
+            }
+
+            frame::put_u32(rep.body, static_cast<boost::uint32_t>(items.size()));
+            std::string d;
+            for (std::size_t i = 0; i < items.size(); ++i)
+            {
+                item_codec::decode(items[i], d);
+                frame::put_u32(rep.body, static_cast<boost::uint32_t>(d.size()));
+                rep.body.append(d);
+            }
+        }
+
+        void queue::busy(const request& req, reply& rep) const
+        {
+            // Rejections would only blur the latency of the requests served.
+            req.timing.op = -1;
+
+            rep = reply::stock_reply(reply::service_unavailable);
+
+            header hra;
+            hra.name = RETRY_AFTER;
+            hra.value = boost::lexical_cast<std::string>(req.svc->admit.retry_after());
+            rep.headers.push_back(hra);
+        }
+
+        bool queue::payload(const request& req, std::string& stored) const
+        {
+            // Either a form with the item in "d", or a body already compressed
+            // by the client, stored without recompressing.
+            const std::string* encoding = req.find_header(CONTENT_ENCODING);
+            if (encoding)
+            {
+                return boost::algorithm::iequals(*encoding, CODEC_ENCODING) &&
+                    item_codec::wrap(req.post_data, stored);
+            }
+
+            const boost::string_ref* d = req.field("d");
+            if (!d || d->empty())
+                return false;
+
+            req.svc->codec.encode(*d, stored);
+            return true;
+        }
+
+        void queue::item(const request& req, const std::string& stored, reply& rep) const
+        {
+            // Compressed items go out as they are to clients that accept the
+            // deflate coding.
+            const std::string* accept = req.find_header(ACCEPT_ENCODING);
+            if (item_codec::compressed(stored) && accept && item_codec::accepts(*accept))
+            {
+                item_codec::unwrap(stored, rep.content);
+                content(rep);
+
+                header hce;
+                hce.name = CONTENT_ENCODING;
+                hce.value = CODEC_ENCODING;
+                rep.headers.push_back(hce);
+            }
+            else
+            {
+                item_codec::decode(stored, rep.content);
+                content(rep);
+            }
+        }
+
+        void queue::content(reply& rep)
         {
             header hcl, hct;
 
@@ -11,10 +11,30 @@
 #ifndef HTTP_SERVER3_QUEUE_HPP
 #define HTTP_SERVER3_QUEUE_HPP
 
+#include <limits>
+#include <string>
+#include <vector>
 #include <boost/noncopyable.hpp>
+#include "blob_store.hpp"
 #include "globals.hpp"
+#include "head_index.hpp"
+#include "frame.hpp"
 #include "reply.hpp"
+#include "replicator.hpp"
 #include "request.hpp"
+#include "scheduler.hpp"
+
+// Width of the zero padded wait time and key p() puts in front of every item.
+#define QUEUE_WAIT_DIGITS   20
+#define QUEUE_KEY_DIGITS    20
+
+#define QUEUE_STREAM_WINDOW 64
+#define QUEUE_STREAM_TYPE   "application/octet-stream"
+
+#define QUEUE_PEEK_ITEMS    10      // items per peek page unless n= says otherwise
+#define QUEUE_PEEK_NEXT     "X-Lisa-Next"
+
+#define QUEUE_DUPLICATE     1062    // ER_DUP_ENTRY, a dedup key already stored
 
 namespace http {
     namespace server3 {
@@ -24,9 +44,117 @@ namespace http {
             : private boost::noncopyable
         {
         public:
+            /// Serve an HTTP request.
             int operator() (const request& req, reply& rep) const;
+
+            /// Serve a binary protocol request.
+            void operator() (const frame& req, frame& rep) const;
+
+            /// Store an item, unless its dedup key (if any) is already stored,
+            /// spilling it to blobs if it is large and adding the change to ops
+            /// if given. The caller owns the transaction.
+            void push(soci::session& sql, const blob_store& blobs, const std::string& d, int p,
+                      const std::string* key = 0, std::vector<replicator::op>* ops = 0) const;
+
+            /// Fetch the head item of the band whose turn it is (or of the next
+            /// non-empty one) among the priorities in [lo, hi]. With turns, it is
+            /// removed, the band it came from added to turns (for the caller to
+            /// pass to served() once committed) and the removal to ops
+            /// if given; without, it is a plain read taking no locks. Returns
+            /// false when there is none. The caller owns the transaction.
+            bool pop(soci::session& sql, scheduler& schedule,
+                     std::vector<scheduler::turn>* turns, std::string& d,
+                     std::vector<replicator::op>* ops = 0,
+                     int lo = std::numeric_limits<int>::min(),
+                     int hi = std::numeric_limits<int>::max()) const;
+
+            /// Fetch up to max items with a priority in [lo, hi] ranked after the
+            /// given position (from the head if none) with plain reads, as enqueue
+            /// operations.
+            void peek(soci::session& sql, const head_index::position* after, int lo, int hi,
+                      std::size_t max, std::vector<replicator::op>& items) const;
+
+            /// Number of stored items with a priority in [lo, hi].
+            int size(soci::session& sql,
+                     int lo = std::numeric_limits<int>::min(),
+                     int hi = std::numeric_limits<int>::max()) const;
+
+            /// Dequeue up to max items for a stream, decoded, in one transaction.
+            /// Returns false on a database error.
+            bool drain(const request& req, std::size_t max, std::vector<std::string>& items) const;
+
+            /// Turn a request away for now: 503 with Retry-After.
+            void busy(const request& req, reply& rep) const;
+
+            /// The item an HTTP enqueue carries, in its stored form. Returns false
+            /// if there is none.
+            bool payload(const request& req, std::string& stored) const;
+
+            /// Turn a stored item into a complete reply.
+            void item(const request& req, const std::string& stored, reply& rep) const;
+
+            /// Turn rep.content into a complete plain text reply.
+            static void content(reply& rep);
+
         private:
-            void content(const request& req, reply& rep) const;
+            /// Answer GET /stream with the headers of a chunked reply; the
+            /// connection then sends the items.
+            int stream(const request& req, reply& rep) const;
+
+            /// Answer GET /spy and GET /peek, from the head index when it can tell
+            /// and with plain reads otherwise.
+            int look(const request& req, reply& rep, const std::string& action) const;
+
+            /// The item spy shows among the priorities in [lo, hi], from the head
+            /// index. Returns false if the index cannot tell.
+            static bool glance(head_index& heads, scheduler& schedule, int lo, int hi,
+                               std::string& d, bool& found);
+
+            /// The priority range of an HTTP request, from its lo and hi fields
+            /// (every priority by default). Returns false if invalid.
+            static bool range(const request& req, int& lo, int& hi);
+
+            /// The priority range at the start of a binary request body. Returns
+            /// false if invalid.
+            static bool range(const std::string& b, int& lo, int& hi);
+
+            /// The priority range (every priority but for the range opcodes) and
+            /// the item count of a binary batch request. Returns false if invalid.
+            static bool bounds(const frame& req, int& lo, int& hi, boost::uint32_t& max);
+
+            /// Answer a binary peek from the head index. Returns false if it is
+            /// not a peek, or if the index cannot tell.
+            bool indexed(const frame& req, frame& rep) const;
+
+            /// The page size and cursor of a peek. Returns false if invalid.
+            static bool cursor(const request& req, std::size_t& max, head_index::position& at,
+                               bool& after);
+
+            /// Turn a page of items into a complete reply, with the cursor of
+            /// the next page if it is full.
+            static void page(const std::vector<replicator::op>& items, std::size_t max, reply& rep);
+
+            /// Serve an HTTP request on a replica, from its in-memory copy.
+            int replica(const request& req, reply& rep, const std::string& action) const;
+
+            /// Serve a binary request on a replica, from its in-memory copy.
+            void replica(const frame& req, frame& rep) const;
+
+            /// Split an enqueue_keyed body into priority, dedup key and data.
+            static bool keyed(const std::string& b, int& p, std::string& key, std::string& d);
+
+            /// Account for the dequeues of a committed transaction: the band
+            /// turns they took and the time their items waited.
+            static void served(scheduler& schedule, const std::vector<scheduler::turn>& turns);
+
+            /// Put stored items, decoded, in a batch response body.
+            static void batch(const std::vector<std::string>& items, frame& rep);
+
+            /// Execute a binary request inside an open transaction, adding the
+            /// dequeues to turns and the changes to ops if given.
+            void execute(soci::session& sql, const frame& req, frame& rep,
+                         std::vector<scheduler::turn>& turns,
+                         std::vector<replicator::op>* ops) const;
         };
 
     } // namespace server3
@@ -0,0 +1,70 @@
+//
+// replication.cpp
+// ~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <string>
+#include <boost/lexical_cast.hpp>
+#include "replication.hpp"
+#include "request_handler.hpp"
+#include "services.hpp"
+
+namespace http {
+    namespace server3 {
+
+        bool replication::match(const std::string& path)
+        {
+            return (path == REPLICATION_URI) || (path == PROMOTE_URI);
+        }
+
+        int replication::operator() (const request& req, reply& rep) const
+        {
+            req.timing.op = -1;
+
+            if (req.path == PROMOTE_URI)
+            {
+                if (req.method != "POST")
+                {
+                    rep = reply::stock_reply(reply::method_not_allowed);
+                    return request_handler::finished;
+                }
+
+                // Only a replica can be promoted.
+                if (!req.svc->replicate.promote())
+                {
+                    rep = reply::stock_reply(reply::bad_request);
+                    return request_handler::finished;
+                }
+            }
+            else if (req.method != "GET")
+            {
+                rep = reply::stock_reply(reply::method_not_allowed);
+                return request_handler::finished;
+            }
+
+            req.svc->replicate.report(rep.content, false);
+            if (rep.content.empty())
+                rep.content = "replication role=none\n";
+
+            header hcl, hct;
+
+            hcl.name = CONTENT_LENGTH;
+            hcl.value = boost::lexical_cast<std::string>(rep.content.size());
+            rep.headers.push_back(hcl);
+
+            hct.name = CONTENT_TYPE;
+            hct.value = MIME_TYPE;
+            rep.headers.push_back(hct);
+
+            rep.status = reply::ok;
+
+            return request_handler::finished;
+        }
+
+    } // namespace server3
+} // namespace http
@@ -0,0 +1,41 @@
+//
+// replication.hpp
+// ~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_REPLICATION_HPP
+#define HTTP_SERVER3_REPLICATION_HPP
+
+#include <string>
+#include <boost/noncopyable.hpp>
+#include "globals.hpp"
+#include "reply.hpp"
+#include "request.hpp"
+
+#define REPLICATION_URI     "/replication"
+#define PROMOTE_URI         "/replication/promote"
+
+namespace http {
+    namespace server3 {
+
+/// The replication service: GET /replication reports the role of this node,
+/// POST /replication/promote turns a replica into a primary.
+        class replication
+            : private boost::noncopyable
+        {
+        public:
+            /// Whether the decoded request path belongs to this service.
+            static bool match(const std::string& path);
+
+            int operator() (const request& req, reply& rep) const;
+        };
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_REPLICATION_HPP
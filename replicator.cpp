@@ -0,0 +1,637 @@
+//
+// replicator.cpp
+// ~~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <exception>
+#include <limits>
+#include <sstream>
+#include <boost/bind.hpp>
+#include "admission.hpp"
+#include "affinity.hpp"
+#include "blob_store.hpp"
+#include "connector.hpp"
+#include "frame.hpp"
+#include "globals.hpp"
+#include "replicator.hpp"
+
+namespace http {
+    namespace server3 {
+
+        void replicator::mirror::insert(boost::uint64_t k, int p, const std::string& d)
+        {
+            if (tombstones.erase(k))
+                return;
+
+            std::map<boost::uint64_t, std::pair<int, std::string> >::iterator i = items.find(k);
+            if (i != items.end())
+                order.erase(std::make_pair(-i->second.first, k));
+
+            items[k] = std::make_pair(p, d);
+            order.insert(std::make_pair(-p, k));
+        }
+
+        void replicator::mirror::erase(boost::uint64_t k)
+        {
+            std::map<boost::uint64_t, std::pair<int, std::string> >::iterator i = items.find(k);
+            if (i != items.end())
+            {
+                order.erase(std::make_pair(-i->second.first, k));
+                items.erase(i);
+                return;
+            }
+
+            tombstones.insert(k);
+            buried.push_back(k);
+            if (buried.size() > REPLICATION_TOMBSTONES)
+            {
+                tombstones.erase(buried.front());
+                buried.pop_front();
+            }
+        }
+
+        void replicator::mirror::clear()
+        {
+            items.clear();
+            order.clear();
+            tombstones.clear();
+            buried.clear();
+        }
+
+        void replicator::mirror::swap(mirror& other)
+        {
+            items.swap(other.items);
+            order.swap(other.order);
+            tombstones.swap(other.tombstones);
+            buried.swap(other.buried);
+        }
+
+        replicator::replicator(const settings& cfg, soci::connection_pool& pool, connector& connect)
+            : pool_(pool),
+              connect_(connect),
+              address_(cfg.address),
+              port_(cfg.replication_port),
+              follow_(cfg.follow),
+              primary_(!cfg.replication_port.empty() && cfg.follow.empty()),
+              work_(new boost::asio::io_service::work(io_service_)),
+              acceptor_(io_service_),
+              replicas_(0),
+              upstream_(io_service_),
+              timer_(io_service_),
+              following_(false),
+              synced_(false),
+              loading_(false),
+              ops_(0)
+        {
+            if (primary_)
+                listen();
+            else if (!follow_.empty())
+                io_service_.post(boost::bind(&replicator::connect, this));
+
+            affinity::parse(cfg.background_cpus, cpus_);
+            thread_.reset(new boost::thread(boost::bind(&replicator::run, this)));
+        }
+
+        replicator::~replicator()
+        {
+            work_.reset();
+            io_service_.stop();
+            thread_->join();
+        }
+
+        void replicator::publish(const std::vector<op>& ops)
+        {
+            ops_ += ops.size();
+
+            // A replica connecting later gets these in its snapshot.
+            if (ops.empty() || (replicas_ == 0))
+                return;
+
+            boost::shared_ptr<std::string> message(new std::string);
+            for (std::size_t i = 0; i < ops.size(); ++i)
+                encode(*message, ops[i].type, ops[i].k, ops[i].p, ops[i].d);
+
+            io_service_.post(boost::bind(&replicator::broadcast, this, message));
+        }
+
+        bool replicator::synced() const
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            return synced_;
+        }
+
+        void replicator::page(const std::pair<int, boost::uint64_t>* after, int lo, int hi,
+                              std::size_t max, std::vector<op>& items) const
+        {
+            // Start at the cursor or at the top of the range, whichever is
+            // further.
+            boost::mutex::scoped_lock lock(mutex_);
+            std::set<std::pair<int, boost::uint64_t> >::const_iterator i = (after && (after->first <= hi)) ?
+                live_.order.upper_bound(std::make_pair(-after->first, after->second)) :
+                live_.order.lower_bound(std::make_pair(-hi, boost::uint64_t(0)));
+            for (; (i != live_.order.end()) && (-i->first >= lo) && (items.size() < max); ++i)
+            {
+                op o;
+                o.type = REPLICATION_ENQUEUE;
+                o.k = i->second;
+                o.p = -i->first;
+                o.d = live_.items.find(i->second)->second.second;
+                items.push_back(o);
+            }
+        }
+
+        std::size_t replicator::size() const
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            return live_.items.size();
+        }
+
+        std::size_t replicator::count(int lo, int hi) const
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            if ((lo == std::numeric_limits<int>::min()) && (hi == std::numeric_limits<int>::max()))
+                return live_.items.size();
+
+            std::size_t n = 0;
+            std::set<std::pair<int, boost::uint64_t> >::const_iterator i =
+                live_.order.lower_bound(std::make_pair(-hi, boost::uint64_t(0)));
+            for (; (i != live_.order.end()) && (-i->first >= lo); ++i)
+                ++n;
+            return n;
+        }
+
+        bool replicator::promote()
+        {
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                if (follow_.empty() || primary_)
+                    return false;
+
+                // From now on writes go to the database and are published.
+                primary_ = true;
+                synced_ = false;
+                loading_ = false;
+                live_.clear();
+                staging_.clear();
+            }
+
+            io_service_.post(boost::bind(&replicator::stop_following, this));
+            return true;
+        }
+
+        void replicator::report(std::string& out, bool prometheus) const
+        {
+            if (port_.empty() && follow_.empty())
+                return;
+
+            bool primary = primary_;
+            std::size_t items = size();
+            std::stringstream s;
+
+            if (prometheus)
+            {
+                s << "# TYPE lisa_replication_primary gauge\n"
+                  << "lisa_replication_primary " << (primary ? 1 : 0) << "\n"
+                  << "# TYPE lisa_replication_replicas gauge\n"
+                  << "lisa_replication_replicas " << replicas_.load() << "\n"
+                  << "# TYPE lisa_replication_synced gauge\n"
+                  << "lisa_replication_synced " << (synced() ? 1 : 0) << "\n"
+                  << "# TYPE lisa_replication_items gauge\n"
+                  << "lisa_replication_items " << items << "\n"
+                  << "# TYPE lisa_replication_ops_total counter\n"
+                  << "lisa_replication_ops_total " << ops_.load() << "\n";
+            }
+            else if (primary)
+            {
+                s << "replication role=primary replicas=" << replicas_.load()
+                  << " ops=" << ops_.load() << "\n";
+            }
+            else
+            {
+                s << "replication role=replica primary=" << follow_
+                  << " synced=" << (synced() ? 1 : 0)
+                  << " items=" << items
+                  << " ops=" << ops_.load() << "\n";
+            }
+
+            out += s.str();
+        }
+
+        void replicator::listen()
+        {
+            try
+            {
+                boost::asio::ip::tcp::resolver resolver(io_service_);
+                boost::asio::ip::tcp::resolver::query query(address_, port_);
+                boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(query);
+                acceptor_.open(endpoint.protocol());
+                acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+                acceptor_.bind(endpoint);
+                acceptor_.listen();
+            }
+            catch (std::exception const &e)
+            {
+                boost::system::error_code ignored_ec;
+                acceptor_.close(ignored_ec);
+                LIERR(std::string("replication: cannot listen, retrying: ") + e.what());
+
+                timer_.expires_from_now(boost::posix_time::milliseconds(REPLICATION_RETRY));
+                timer_.async_wait(boost::bind(&replicator::handle_listen, this,
+                                              boost::asio::placeholders::error));
+                return;
+            }
+
+            start_accept();
+        }
+
+        void replicator::handle_listen(const boost::system::error_code& e)
+        {
+            if (!e)
+                listen();
+        }
+
+        void replicator::start_accept()
+        {
+            peer_ptr p(new peer(io_service_));
+            acceptor_.async_accept(p->socket_,
+                                   boost::bind(&replicator::handle_accept, this, p,
+                                               boost::asio::placeholders::error));
+        }
+
+        void replicator::handle_accept(peer_ptr p, const boost::system::error_code& e)
+        {
+            if (e == boost::asio::error::operation_aborted)
+                return;
+
+            if (!e)
+            {
+                // Registered before the snapshot is read: whatever commits after
+                // a batch is read is broadcast, and queued behind that batch
+                // since broadcasts run in this thread too. Applying a change, or
+                // a row, twice changes nothing.
+                peers_.push_back(p);
+                ++replicas_;
+
+                boost::asio::async_read(p->socket_, boost::asio::buffer(&p->discard_, 1),
+                                        boost::bind(&replicator::handle_gone, this, p,
+                                                    boost::asio::placeholders::error));
+
+                if (snapshot(p))
+                    LINFO("replication: replica connected");
+                else
+                    drop(p);
+            }
+
+            start_accept();
+        }
+
+        void replicator::handle_gone(peer_ptr p, const boost::system::error_code& e)
+        {
+            if (e != boost::asio::error::operation_aborted)
+                drop(p);
+        }
+
+        bool replicator::snapshot(peer_ptr p)
+        {
+            lease db(pool_, 0, &connect_);
+            try
+            {
+                soci::session& sql = db.session();
+
+                // The rows after the last one sent, in key order; within a
+                // transaction the blobs are read from the same snapshot as the
+                // rows.
+                int limit = REPLICATION_SNAPSHOT_ROWS;
+                std::vector<long long> ks(REPLICATION_SNAPSHOT_ROWS);
+                std::vector<int> ps(REPLICATION_SNAPSHOT_ROWS);
+                std::vector<std::string> ds(REPLICATION_SNAPSHOT_ROWS);
+                sql.begin();
+                sql << "SELECT k, p, d FROM q WHERE k > :k ORDER BY k LIMIT :n",
+                    soci::use(p->cursor_), soci::use(limit),
+                    soci::into(ks), soci::into(ps), soci::into(ds);
+
+                boost::shared_ptr<std::string> message(new std::string);
+                for (std::size_t i = 0; i < ks.size(); ++i)
+                {
+                    // Replicas keep whole items, never references.
+                    blob_store::fetch(sql, ds[i], false);
+                    encode(*message, REPLICATION_ENQUEUE, ks[i], ps[i], ds[i]);
+                }
+                sql.commit();
+
+                if (!ks.empty())
+                    p->cursor_ = ks.back();
+                if (ks.size() < REPLICATION_SNAPSHOT_ROWS)
+                {
+                    encode(*message, REPLICATION_READY, 0, 0, std::string());
+                    p->loading_ = false;
+                }
+                send(p, message, true);
+                return true;
+            }
+            catch (std::exception const &e)
+            {
+                try
+                {
+                    db.session().rollback();
+                }
+                catch (std::exception const &)
+                {
+                }
+
+                db.failed(e);
+                LIERR(std::string("replication: snapshot failed: ") + e.what());
+                return false;
+            }
+        }
+
+        void replicator::send(peer_ptr p, boost::shared_ptr<std::string> message, bool batch)
+        {
+            if (p->closed_)
+                return;
+
+            p->out_.push_back(message);
+            if (batch)
+                p->batch_ = message.get();
+            else
+                p->queued_ += message->size();
+            if (p->writing_)
+                return;
+
+            p->writing_ = true;
+            boost::asio::async_write(p->socket_, boost::asio::buffer(*p->out_.front()),
+                                     boost::bind(&replicator::handle_write, this, p,
+                                                 boost::asio::placeholders::error));
+        }
+
+        void replicator::handle_write(peer_ptr p, const boost::system::error_code& e)
+        {
+            if (e)
+            {
+                drop(p);
+                return;
+            }
+
+            // The next batch of a snapshot is read once the last one is out, so
+            // a snapshot holds one batch in memory whatever the size of q.
+            bool batch = (p->out_.front().get() == p->batch_);
+            if (batch)
+                p->batch_ = 0;
+            else
+                p->queued_ -= p->out_.front()->size();
+            p->out_.pop_front();
+
+            if (batch && p->loading_ && !p->closed_ && !snapshot(p))
+            {
+                drop(p);
+                return;
+            }
+
+            if (p->out_.empty() || p->closed_)
+            {
+                p->writing_ = false;
+                return;
+            }
+
+            boost::asio::async_write(p->socket_, boost::asio::buffer(*p->out_.front()),
+                                     boost::bind(&replicator::handle_write, this, p,
+                                                 boost::asio::placeholders::error));
+        }
+
+        void replicator::broadcast(boost::shared_ptr<std::string> message)
+        {
+            std::vector<peer_ptr> peers(peers_);
+            for (std::size_t i = 0; i < peers.size(); ++i)
+            {
+                // A replica that cannot keep up starts over with a new snapshot
+                // when it reconnects. The snapshot itself is not counted: it is
+                // sent as fast as the replica takes it.
+                if (peers[i]->queued_ + message->size() > REPLICATION_MAX_BACKLOG)
+                {
+                    LIERR("replication: replica too far behind, dropped");
+                    drop(peers[i]);
+                    continue;
+                }
+                send(peers[i], message);
+            }
+        }
+
+        void replicator::drop(peer_ptr p)
+        {
+            if (p->closed_)
+                return;
+            p->closed_ = true;
+
+            boost::system::error_code ignored_ec;
+            p->socket_.close(ignored_ec);
+
+            for (std::size_t i = 0; i < peers_.size(); ++i)
+            {
+                if (peers_[i] == p)
+                {
+                    peers_.erase(peers_.begin() + i);
+                    --replicas_;
+                    break;
+                }
+            }
+        }
+
+        void replicator::connect()
+        {
+            following_ = true;
+
+            std::string::size_type colon = follow_.rfind(':');
+            boost::asio::ip::tcp::resolver resolver(io_service_);
+            boost::asio::ip::tcp::resolver::query query(follow_.substr(0, colon), follow_.substr(colon + 1));
+            boost::system::error_code ec;
+            boost::asio::ip::tcp::resolver::iterator endpoint = resolver.resolve(query, ec);
+            if (ec)
+            {
+                LIERR("replication: cannot resolve " + follow_ + ": " + ec.message());
+                retry();
+                return;
+            }
+
+            upstream_.async_connect(*endpoint, boost::bind(&replicator::handle_connect, this,
+                                                           boost::asio::placeholders::error));
+        }
+
+        void replicator::retry()
+        {
+            boost::system::error_code ignored_ec;
+            upstream_.close(ignored_ec);
+
+            timer_.expires_from_now(boost::posix_time::milliseconds(REPLICATION_RETRY));
+            timer_.async_wait(boost::bind(&replicator::handle_retry, this,
+                                          boost::asio::placeholders::error));
+        }
+
+        void replicator::handle_retry(const boost::system::error_code& e)
+        {
+            if (!e && following_)
+                connect();
+        }
+
+        void replicator::handle_connect(const boost::system::error_code& e)
+        {
+            if (!following_)
+                return;
+
+            if (e)
+            {
+                LIERR("replication: cannot reach " + follow_ + ": " + e.message());
+                retry();
+                return;
+            }
+
+            // Keep serving the old copy while the new snapshot loads.
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                staging_.clear();
+                loading_ = true;
+            }
+            in_.clear();
+
+            LINFO("replication: following " + follow_);
+            upstream_.async_read_some(boost::asio::buffer(buffer_),
+                                      boost::bind(&replicator::handle_read, this,
+                                                  boost::asio::placeholders::error,
+                                                  boost::asio::placeholders::bytes_transferred));
+        }
+
+        void replicator::handle_read(const boost::system::error_code& e, std::size_t bytes_transferred)
+        {
+            if (!following_ || primary_)
+                return;
+
+            if (e)
+            {
+                LIERR("replication: lost " + follow_ + ": " + e.message());
+                retry();
+                return;
+            }
+
+            in_.append(buffer_.data(), bytes_transferred);
+
+            std::size_t pos = 0;
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                while (in_.size() - pos >= REPLICATION_HEADER_SIZE)
+                {
+                    std::size_t size = frame::get_u32(in_.data() + pos + 1);
+                    bool valid = (size <= REPLICATION_MAX_BODY);
+                    if (valid && (in_.size() - pos - REPLICATION_HEADER_SIZE < size))
+                        break;
+
+                    if (!valid || !apply(in_[pos], in_.data() + pos + REPLICATION_HEADER_SIZE, size))
+                    {
+                        lock.unlock();
+                        LIERR("replication: bad message from " + follow_);
+                        retry();
+                        return;
+                    }
+                    pos += REPLICATION_HEADER_SIZE + size;
+                }
+            }
+            in_.erase(0, pos);
+
+            upstream_.async_read_some(boost::asio::buffer(buffer_),
+                                      boost::bind(&replicator::handle_read, this,
+                                                  boost::asio::placeholders::error,
+                                                  boost::asio::placeholders::bytes_transferred));
+        }
+
+        bool replicator::apply(char type, const char* body, std::size_t size)
+        {
+            mirror& m = loading_ ? staging_ : live_;
+
+            switch (type)
+            {
+                case REPLICATION_ENQUEUE:
+                {
+                    if (size < 12)
+                        return false;
+                    boost::uint64_t k = (static_cast<boost::uint64_t>(frame::get_u32(body)) << 32) |
+                        frame::get_u32(body + 4);
+                    int p = static_cast<boost::int32_t>(frame::get_u32(body + 8));
+                    m.insert(k, p, std::string(body + 12, size - 12));
+                    ++ops_;
+                    return true;
+                }
+                case REPLICATION_DEQUEUE:
+                {
+                    if (size != 8)
+                        return false;
+                    boost::uint64_t k = (static_cast<boost::uint64_t>(frame::get_u32(body)) << 32) |
+                        frame::get_u32(body + 4);
+                    m.erase(k);
+                    ++ops_;
+                    return true;
+                }
+                case REPLICATION_READY:
+                {
+                    if (!loading_ || (size != 0))
+                        return false;
+                    live_.swap(staging_);
+                    staging_.clear();
+                    loading_ = false;
+                    synced_ = true;
+                    return true;
+                }
+                default:
+                    return false;
+            }
+        }
+
+        void replicator::run()
+        {
+            affinity::pin(cpus_);
+            if (!port_.empty() || !follow_.empty())
+                LINFO("placement: replication thread " + affinity::where());
+
+            io_service_.run();
+        }
+
+        void replicator::stop_following()
+        {
+            following_ = false;
+
+            boost::system::error_code ignored_ec;
+            timer_.cancel(ignored_ec);
+            upstream_.close(ignored_ec);
+
+            LINFO("replication: promoted to primary");
+            if (!port_.empty())
+                listen();
+        }
+
+        void replicator::encode(std::string& out, char type, boost::uint64_t k, int p,
+                                const std::string& d)
+        {
+            std::size_t size = 0;
+            if (type == REPLICATION_ENQUEUE)
+                size = 12 + d.size();
+            else if (type == REPLICATION_DEQUEUE)
+                size = 8;
+
+            out.push_back(type);
+            frame::put_u32(out, static_cast<boost::uint32_t>(size));
+            if (size == 0)
+                return;
+
+            frame::put_u32(out, static_cast<boost::uint32_t>(k >> 32));
+            frame::put_u32(out, static_cast<boost::uint32_t>(k & 0xffffffff));
+            if (type == REPLICATION_ENQUEUE)
+            {
+                frame::put_u32(out, static_cast<boost::uint32_t>(p));
+                out.append(d);
+            }
+        }
+
+    } // namespace server3
+} // namespace http
@@ -0,0 +1,259 @@
+//
+// replicator.hpp
+// ~~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_REPLICATOR_HPP
+#define HTTP_SERVER3_REPLICATOR_HPP
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/array.hpp>
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include "settings.hpp"
+
+#include "soci.h"
+
+#define REPLICATION_ENQUEUE     'E'     // body: u64 k | i32 p | stored item
+#define REPLICATION_DEQUEUE     'D'     // body: u64 k
+#define REPLICATION_READY       'R'     // body: (empty), end of the snapshot
+#define REPLICATION_HEADER_SIZE 5       // u8 type | u32 body size
+#define REPLICATION_MAX_BODY    (64 * 1024 * 1024)
+#define REPLICATION_MAX_BACKLOG (64 * 1024 * 1024)  // bytes of changes queued per replica
+#define REPLICATION_SNAPSHOT_ROWS 1024  // rows of a snapshot fetched and sent at once
+#define REPLICATION_TOMBSTONES  65536   // dequeues seen before their enqueue
+#define REPLICATION_RETRY       1000    // ms between attempts to reach the primary
+
+namespace http {
+    namespace server3 {
+
+        class connector;
+
+/// Node to node replication of the queue. A primary sends every replica a
+/// snapshot of the queue table followed by the ordered log of the enqueues
+/// and dequeues it commits; a replica keeps an in-memory copy, serves the
+/// read-only operations (spy, size, count) from it, and turns writes away
+/// until it is promoted. Items are identified by their key k, so applying
+/// an operation twice, or a snapshot row again, changes nothing. Topics are
+/// not replicated.
+        class replicator
+            : private boost::noncopyable
+        {
+        public:
+            /// A committed change of the queue table.
+            struct op
+            {
+                char type;
+                boost::uint64_t k;
+                int p;
+                std::string d;
+            };
+
+            /// Start as a primary listening on cfg.replication_port, as a replica
+            /// of cfg.follow, or neither.
+            replicator(const settings& cfg, soci::connection_pool& pool, connector& connect);
+
+            /// Stop the replication thread.
+            ~replicator();
+
+            /// Whether committed changes must be collected and published.
+            bool recording() const
+            {
+                return primary_;
+            }
+
+            /// Whether writes must be turned away.
+            bool read_only() const
+            {
+                return !primary_ && !follow_.empty();
+            }
+
+            /// Send committed changes to the replicas, in order.
+            void publish(const std::vector<op>& ops);
+
+            /// Replica: whether the in-memory copy is complete.
+            bool synced() const;
+
+            /// Replica: up to max items with a priority in [lo, hi] ranked after
+            /// priority after->first and key after->second (from the head if
+            /// none), as enqueue operations.
+            void page(const std::pair<int, boost::uint64_t>* after, int lo, int hi,
+                      std::size_t max, std::vector<op>& items) const;
+
+            /// Replica: number of items.
+            std::size_t size() const;
+
+            /// Replica: number of items with a priority in [lo, hi].
+            std::size_t count(int lo, int hi) const;
+
+            /// Turn a replica into a primary serving writes from its database.
+            /// Returns false if this node is not a replica.
+            bool promote();
+
+            /// Append the current state to a /stats report.
+            void report(std::string& out, bool prometheus) const;
+
+        private:
+            /// The in-memory copy of the queue table.
+            struct mirror
+            {
+                /// Item priority and stored data by key.
+                std::map<boost::uint64_t, std::pair<int, std::string> > items;
+
+                /// Keys in priority order: highest priority, then oldest.
+                std::set<std::pair<int, boost::uint64_t> > order;
+
+                /// Keys dequeued before their enqueue arrived (two commits
+                /// published in the other order), oldest first.
+                std::set<boost::uint64_t> tombstones;
+                std::deque<boost::uint64_t> buried;
+
+                void insert(boost::uint64_t k, int p, const std::string& d);
+                void erase(boost::uint64_t k);
+                void clear();
+                void swap(mirror& other);
+            };
+
+            /// A replica connected to this primary.
+            class peer
+                : public boost::enable_shared_from_this<peer>,
+                  private boost::noncopyable
+            {
+            public:
+                explicit peer(boost::asio::io_service& io_service)
+                    : socket_(io_service), queued_(0), writing_(false), closed_(false),
+                      loading_(true), cursor_(0), batch_(0)
+                {
+                }
+
+                boost::asio::ip::tcp::socket socket_;
+                std::deque<boost::shared_ptr<std::string> > out_;
+
+                /// Bytes of published changes in out_; snapshot batches are not
+                /// counted, there is at most one of them.
+                std::size_t queued_;
+                bool writing_;
+                bool closed_;
+
+                /// Whether the snapshot is still being sent, the last key sent
+                /// in it, and its batch in out_ (0 if none).
+                bool loading_;
+                long long cursor_;
+                const std::string* batch_;
+
+                char discard_;
+            };
+
+            typedef boost::shared_ptr<peer> peer_ptr;
+
+            /// Primary: accept replicas on the replication port, retrying while
+            /// it is taken (by a predecessor still draining, say).
+            void listen();
+            void handle_listen(const boost::system::error_code& e);
+            void start_accept();
+            void handle_accept(peer_ptr p, const boost::system::error_code& e);
+
+            /// Primary: a replica never sends anything, so a read completing
+            /// means it went away.
+            void handle_gone(peer_ptr p, const boost::system::error_code& e);
+
+            /// Primary: queue the next batch of rows of the table for a new
+            /// replica, with the end of the snapshot after the last one. The
+            /// next batch is only read once this one is written.
+            bool snapshot(peer_ptr p);
+
+            /// Primary: queue a message for a replica, and write if idle.
+            void send(peer_ptr p, boost::shared_ptr<std::string> message, bool batch = false);
+            void handle_write(peer_ptr p, const boost::system::error_code& e);
+
+            /// Primary: queue published changes for every replica.
+            void broadcast(boost::shared_ptr<std::string> message);
+
+            /// Primary: forget a replica.
+            void drop(peer_ptr p);
+
+            /// Replica: connect to the primary, now or after a pause.
+            void connect();
+            void retry();
+            void handle_retry(const boost::system::error_code& e);
+            void handle_connect(const boost::system::error_code& e);
+            void handle_read(const boost::system::error_code& e, std::size_t bytes_transferred);
+
+            /// Replica: apply a message received from the primary.
+            bool apply(char type, const char* body, std::size_t size);
+
+            /// Replica: stop following after a promotion.
+            void stop_following();
+
+            /// Body of the replication thread.
+            void run();
+
+            /// Append an encoded message.
+            static void encode(std::string& out, char type, boost::uint64_t k, int p,
+                               const std::string& d);
+
+            soci::connection_pool& pool_;
+            connector& connect_;
+
+            /// Interface and port replicas connect to, and primary to follow as
+            /// "host:port".
+            std::string address_;
+            std::string port_;
+            std::string follow_;
+
+            /// Whether this node takes writes and publishes them.
+            boost::atomic<bool> primary_;
+
+            /// Everything below runs in the replication thread.
+            boost::asio::io_service io_service_;
+            boost::scoped_ptr<boost::asio::io_service::work> work_;
+            boost::asio::ip::tcp::acceptor acceptor_;
+            std::vector<peer_ptr> peers_;
+            boost::atomic<std::size_t> replicas_;
+
+            boost::asio::ip::tcp::socket upstream_;
+            boost::asio::deadline_timer timer_;
+            boost::array<char, 8192> buffer_;
+            std::string in_;
+            bool following_;
+
+            /// Protects the copies below.
+            mutable boost::mutex mutex_;
+
+            /// The copy served, and the one a snapshot is loaded into.
+            mirror live_;
+            mirror staging_;
+            bool synced_;
+
+            /// Whether a snapshot is being received.
+            bool loading_;
+
+            /// Operations published or applied so far.
+            boost::atomic<boost::uint64_t> ops_;
+
+            /// CPUs the replication thread runs on.
+            std::vector<int> cpus_;
+
+            boost::scoped_ptr<boost::thread> thread_;
+        };
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_REPLICATOR_HPP
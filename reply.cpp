@@ -54,6 +54,10 @@ namespace http {
             const std::string service_unavailable =
                 "HTTP/1.0 503 Service Unavailable\r\n";
 
+            // Chunked transfer coding needs HTTP/1.1.
+            const std::string stream_ok =
+                "HTTP/1.1 200 OK\r\n";
+
             boost::asio::const_buffer to_buffer(reply::status_type status)
             {
                 switch (status)
@@ -106,13 +110,16 @@ namespace http {
 
         } // namespace misc_strings
 
-        std::vector<boost::asio::const_buffer> reply::to_buffers()
+        reply::buffer_vector reply::to_buffers()
         {
-            std::vector<boost::asio::const_buffer> buffers;
-            buffers.push_back(status_strings::to_buffer(status));
-            buffers.push_back(boost::asio::buffer(SERVER));
+            buffer_vector buffers(headers.get_allocator());
+            buffers.reserve(6 + headers.size() * 4);
+            buffers.push_back(stream_window ?
+                              boost::asio::buffer(status_strings::stream_ok) :
+                              status_strings::to_buffer(status));
+            buffers.push_back(boost::asio::buffer(SERVER, sizeof(SERVER) - 1));
             buffers.push_back(boost::asio::buffer(misc_strings::name_value_separator));
-            buffers.push_back(boost::asio::buffer(SERVER_NAME));
+            buffers.push_back(boost::asio::buffer(SERVER_NAME, sizeof(SERVER_NAME) - 1));
             buffers.push_back(boost::asio::buffer(misc_strings::crlf));
             for (std::size_t i = 0; i < headers.size(); ++i)
             {
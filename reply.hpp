@@ -21,6 +21,11 @@
 #define SERVER_NAME         "Lisa 1.0"
 #define CONTENT_LENGTH      "Content-Length"
 #define CONTENT_TYPE        "Content-Type"
+#define CONTENT_ENCODING    "Content-Encoding"
+#define ACCEPT_ENCODING     "Accept-Encoding"
+#define TRANSFER_ENCODING   "Transfer-Encoding"
+#define CHUNKED             "chunked"
+#define RETRY_AFTER         "Retry-After"
 #define MIME_TYPE           "text/plain"
 
 namespace http {
@@ -29,6 +34,33 @@ namespace http {
 /// A reply to be sent to a client.
         struct reply
         {
+            typedef std::vector<boost::asio::const_buffer,
+                                arena_allocator<boost::asio::const_buffer> > buffer_vector;
+
+            reply()
+                : status(ok), stream_window(0), stream_credit(0)
+            {
+            }
+
+            /// Construct with headers and buffers allocated from an arena.
+            explicit reply(arena& a)
+                : status(ok), headers(header_vector::allocator_type(&a)),
+                  stream_window(0), stream_credit(0)
+            {
+            }
+
+            /// Forget the current reply, keeping string capacity for the next one.
+            void clear()
+            {
+                status = ok;
+                // Drop the storage too: it may live in an arena about to be reset.
+                header_vector(headers.get_allocator()).swap(headers);
+                content.clear();
+                stream_window = 0;
+                stream_credit = 0;
+                proxy_to.clear();
+            }
+
             /// The status of the reply.
             enum status_type
             {
@@ -52,15 +84,28 @@ namespace http {
             } status;
 
             /// The headers to be included in the reply.
-            std::vector<header> headers;
+            header_vector headers;
 
             /// The content to be sent in the reply.
             std::string content;
 
+            /// For a streamed reply (HTTP/1.1, chunked), the most items sent per
+            /// write; 0 for a plain reply.
+            std::size_t stream_window;
+
+            /// For a streamed reply, the items the client accepts before it
+            /// grants more credit.
+            std::size_t stream_credit;
+
+            /// The cluster member to pass the request on to, which answers in
+            /// place of this reply; empty to send this reply.
+            std::string proxy_to;
+
             /// Convert the reply into a vector of buffers. The buffers do not own the
             /// underlying memory blocks, therefore the reply object must remain valid and
-            /// not be changed until the write operation has completed.
-            std::vector<boost::asio::const_buffer> to_buffers();
+            /// not be changed until the write operation has completed. The vector
+            /// shares the allocator of the headers.
+            buffer_vector to_buffers();
 
             /// Get a stock reply.
             static reply stock_reply(status_type status);
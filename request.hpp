@@ -14,22 +14,94 @@
 
 #include <string>
 #include <vector>
+#include <boost/algorithm/string/predicate.hpp>
 #include "header.hpp"
-#include "soci.h"
+#include "stats.hpp"
 
 namespace http {
     namespace server3 {
 
+        struct services;
+
 /// A request received from a client.
         struct request
         {
+            request()
+                : http_version_major(0), http_version_minor(0), svc(0)
+            {
+            }
+
+            /// Construct with the header list allocated from an arena.
+            explicit request(arena& a)
+                : http_version_major(0), http_version_minor(0),
+                  headers(header_vector::allocator_type(&a)),
+                  fields(field_vector::allocator_type(&a)), svc(0)
+            {
+            }
+
+            /// Forget the current request, keeping string capacity for the next one.
+            void clear()
+            {
+                method.clear();
+                uri.clear();
+                http_version_major = 0;
+                http_version_minor = 0;
+                // Drop the storage too: it may live in an arena about to be reset.
+                header_vector(headers.get_allocator()).swap(headers);
+                post_data.clear();
+                path.clear();
+                field_data.clear();
+                field_vector(fields.get_allocator()).swap(fields);
+                svc = 0;
+                timing.clear();
+            }
+
             std::string method;
             std::string uri;
             int http_version_major;
             int http_version_minor;
-            std::vector<header> headers;
+            header_vector headers;
             std::string post_data;
-            soci::connection_pool *database_pool;
+
+            /// The decoded URI path, without the query string.
+            std::string path;
+
+            /// The form body and the query string, copied once and decoded in
+            /// place; unlike post_data and uri, which may still be passed on as
+            /// they came.
+            std::string field_data;
+
+            /// Form body fields followed by the query string fields, pointing
+            /// into field_data; the first field of a name wins.
+            field_vector fields;
+
+            /// What the request is served with, set by the request_handler.
+            services *svc;
+
+            /// Value of the first header with the given name (case insensitive), or 0.
+            const std::string* find_header(const char* name) const
+            {
+                for (header_vector::const_iterator i = headers.begin(); i != headers.end(); ++i)
+                {
+                    if (boost::algorithm::iequals(i->name, name))
+                        return &i->value;
+                }
+                return 0;
+            }
+
+            /// Value of the first field with the given name, or 0 if there is none.
+            const boost::string_ref* field(const char* name) const
+            {
+                for (field_vector::const_iterator i = fields.begin(); i != fields.end(); ++i)
+                {
+                    if (i->name == name)
+                        return &i->value;
+                }
+                return 0;
+            }
+
+            /// Phase timings, filled in by the connection and the service.
+            mutable stats::sample timing;
         };
 
     } // namespace server3
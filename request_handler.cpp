@@ -10,49 +10,53 @@
 //
 
 #include <fstream>
-#include <sstream>
 #include <iostream>
+#include <stdexcept>
 #include <string>
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/lexical_cast.hpp>
 #include "request_handler.hpp"
 #include "reply.hpp"
 #include "request.hpp"
 #include "router.hpp"
+#include "frame.hpp"
+#include "queue.hpp"
+#include "url.hpp"
 
 namespace http {
     namespace server3 {
 
-        request_handler::request_handler(std::size_t thread_pool_size, const std::string& database)
-            : database_pool_(new soci::connection_pool(thread_pool_size))
+        request_handler::request_handler(const settings& cfg)
+            : services_(cfg),
+              streams_stopped_(false)
         {
-            // Create database connection pool.
-            for (std::size_t i = 0; i < thread_pool_size; ++i)
-            {
-                soci::session& sql = (*database_pool_).at(i);
-                sql.open(soci::mysql, database);
-            }
+            // Serve as soon as enough sessions are open; the others keep
+            // opening in the background. A database that cannot be reached
+            // fails the startup instead of hanging it.
+            std::string error;
+            if (!services_.connect.wait(cfg.min_sessions, CONNECTOR_STARTUP, error))
+                throw std::runtime_error(error);
         }
 
         void request_handler::handle_request(request& req, reply& rep)
         {
-            // Decode url to path.
-            std::string request_path;
-            if (!url_decode(req.uri, request_path))
+            // Decode url to path and fields.
+            if (!decode(req))
             {
                 rep = reply::stock_reply(reply::bad_request);
                 return;
             }
 
             // Request path must be absolute and not contain "..".
-            if (request_path.empty() || request_path[0] != '/'
-                || request_path.find("..") != std::string::npos)
+            if (req.path.empty() || req.path[0] != '/'
+                || req.path.find("..") != std::string::npos)
             {
                 rep = reply::stock_reply(reply::bad_request);
                 return;
             }
 
             // Router request based upon a REST API
-            req.database_pool = &(*database_pool_);
+            req.svc = &services_;
 
             router r(req, rep);
 
@@ -62,43 +66,79 @@ namespace http {
             }
         }
 
-        bool request_handler::url_decode(const std::string& in, std::string& out)
+        void request_handler::handle_frame(frame& req, frame& rep)
+        {
+            req.svc = &services_;
+
+            queue()(req, rep);
+        }
+
+        bool request_handler::handle_stream(request& req, std::size_t max,
+                                            std::vector<std::string>& items)
+        {
+            if (streams_stopped_)
+                return false;
+
+            req.svc = &services_;
+
+            return queue().drain(req, max, items);
+        }
+
+        void request_handler::stop_streams()
+        {
+            streams_stopped_ = true;
+        }
+
+        void request_handler::handle_proxy(boost::asio::io_service& io_service, const request& req,
+                                           const reply& rep, cluster::proxy_handler handler)
+        {
+            services_.shard.proxy(io_service, req, rep.proxy_to, handler);
+        }
+
+        bool request_handler::decode(request& req)
         {
-            out.clear();
-            out.reserve(in.size());
-            for (std::size_t i = 0; i < in.size(); ++i)
+            std::string::size_type q = req.uri.find('?');
+            req.path.assign(req.uri, 0, q);
+            if (!url::decode(req.path))
+                return false;
+
+            // Form body fields go first, so that the item and key posted win
+            // over fields of the same name in the URL. Bodies are only split
+            // when they are application/x-www-form-urlencoded, as sent by
+            // curl -d, and do not carry an already encoded item.
+            //
+            // Both go into one buffer, kept by the request from one request to
+            // the next, and the fields point into it as decoded in place: the
+            // body and the URI themselves stay as they came, for a request
+            // proxied to another cluster member.
+            if (!req.find_header(CONTENT_ENCODING) && form(req))
+                req.field_data = req.post_data;
+
+            if (q != std::string::npos)
             {
-                if (in[i] == '%')
-                {
-                    if (i + 3 <= in.size())
-                    {
-                        int value = 0;
-                        std::istringstream is(in.substr(i + 1, 2));
-                        if (is >> std::hex >> value)
-                        {
-                            out += static_cast<char>(value);
-                            i += 2;
-                        }
-                        else
-                        {
-                            return false;
-                        }
-                    }
-                    else
-                    {
-                        return false;
-                    }
-                }
-                else if (in[i] == '+')
-                {
-                    out += ' ';
-                }
-                else
-                {
-                    out += in[i];
-                }
+                req.field_data += '&';
+                req.field_data.append(req.uri, q + 1, std::string::npos);
             }
-            return true;
+
+            if (req.field_data.empty())
+                return true;
+            char* data = &req.field_data[0];
+            return url::decode_fields(data, data + req.field_data.size(), req.fields);
+        }
+
+        bool request_handler::form(const request& req)
+        {
+            const std::string* type = req.find_header(CONTENT_TYPE);
+            if (!type)
+                return false;
+
+            // Media type, up to any parameters: "...; charset=UTF-8".
+            std::string::size_type end = type->find(';');
+            if (end == std::string::npos)
+                end = type->size();
+            while ((end > 0) && ((*type)[end - 1] == ' '))
+                --end;
+            return boost::algorithm::iequals(type->substr(0, end), FORM_URLENCODED);
         }
 
     } // namespace server3
@@ -13,17 +13,20 @@
 #define HTTP_SERVER3_REQUEST_HANDLER_HPP
 
 #include <string>
-#include <memory>
+#include <vector>
+#include <boost/atomic.hpp>
 #include <boost/noncopyable.hpp>
+#include "services.hpp"
+#include "settings.hpp"
 
-#include "soci.h"
-#include "soci-mysql.h"
+#define FORM_URLENCODED     "application/x-www-form-urlencoded"
 
 namespace http {
     namespace server3 {
 
         struct reply;
         struct request;
+        struct frame;
 
 /// The common handler for all incoming requests.
         class request_handler
@@ -32,19 +35,42 @@ namespace http {
         public:
             enum { finished, declined };
 
-            /// Construct with a directory containing files to be served.
-            explicit request_handler(std::size_t thread_pool_size, const std::string& database);
+            /// Construct with a database session per thread, returning once
+            /// cfg.min_sessions of them are open.
+            explicit request_handler(const settings& cfg);
 
             /// Handle a request and produce a reply.
             void handle_request(request& req, reply& rep);
 
+            /// Handle a binary protocol request and produce a response.
+            void handle_frame(frame& req, frame& rep);
+
+            /// Dequeue the next items of a stream opened by req. Returns false if
+            /// the stream must end.
+            bool handle_stream(request& req, std::size_t max, std::vector<std::string>& items);
+
+            /// End every stream at its next batch, for a server handing over to
+            /// its successor.
+            void stop_streams();
+
+            /// Pass a request on to the member named by rep.proxy_to, on
+            /// io_service, and call handler with its answer.
+            void handle_proxy(boost::asio::io_service& io_service, const request& req,
+                              const reply& rep, cluster::proxy_handler handler);
+
         private:
-            /// SQLite3 connection pool.
-            const std::auto_ptr<soci::connection_pool> database_pool_;
+            /// Fill in the decoded path and fields of a request. Returns false if
+            /// the encoding was invalid.
+            static bool decode(request& req);
+
+            /// Whether the body of a request is application/x-www-form-urlencoded.
+            static bool form(const request& req);
+
+            /// Everything requests are served with.
+            services services_;
 
-            /// Perform URL-decoding on a string. Returns false if the encoding was
-            /// invalid.
-            static bool url_decode(const std::string& in, std::string& out);
+            /// Whether streams must end.
+            boost::atomic<bool> streams_stopped_;
         };
 
     } // namespace server3
@@ -290,7 +290,7 @@ namespace http {
                     if (input == '\n')
                     {
                         state_ = header_line_start;
-                        std::vector<header>::const_iterator cit = req.headers.begin();
+                        header_vector::const_iterator cit = req.headers.begin();
                         for (; cit != req.headers.end(); ++cit)
                         {
                             std::string n = (*cit).name;
@@ -309,7 +309,9 @@ namespace http {
                             }
                             else if (n == UPPER_CONTENT_TYPE)
                             {
-                                std::string m = (*cit).value;
+                                // Media type, without parameters such as a charset.
+                                std::string m((*cit).value, 0, (*cit).value.find(';'));
+                                m.erase(m.find_last_not_of(' ') + 1);
                                 std::transform(m.begin(), m.end(), m.begin(), ::toupper);
 
                                 if (m != UPPER_MIME_TYPE)
@@ -342,7 +344,7 @@ namespace http {
                     if (0 == --cl_)
                         return true;
                     else
-                        return ((cl_ < 0) ? false : boost::indeterminate);
+                        return ((cl_ < 0) ? boost::tribool(false) : boost::tribool(boost::indeterminate));
                 }
                 default:
                     return false;
@@ -31,6 +31,12 @@ namespace http {
             /// Reset to initial parser state.
             void reset();
 
+            /// Whether the headers are in and the body is being read.
+            bool in_body() const
+            {
+                return state_ == post_data;
+            }
+
             /// Parse some data. The tribool return value is true when a complete request
             /// has been parsed, false if the data is invalid, indeterminate when more
             /// data is required. The InputIterator return value indicates how much of the
@@ -15,7 +15,10 @@
 #include "reply.hpp"
 #include "request.hpp"
 #include "router.hpp"
+#include "monitor.hpp"
 #include "queue.hpp"
+#include "replication.hpp"
+#include "topic.hpp"
 
 namespace http {
     namespace server3 {
@@ -32,6 +35,15 @@ namespace http {
 
             int exec() const
             {
+                if (monitor::match(req_.path))
+                    return monitor()(req_, rep_);
+
+                if (replication::match(req_.path))
+                    return replication()(req_, rep_);
+
+                if (topic::match(req_.path))
+                    return topic()(req_, rep_);
+
                 return queue()(req_, rep_);
             }
 
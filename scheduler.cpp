@@ -0,0 +1,130 @@
+//
+// scheduler.cpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <limits>
+#include <stdexcept>
+#include <boost/lexical_cast.hpp>
+#include "scheduler.hpp"
+
+namespace http {
+    namespace server3 {
+
+        bool scheduler::parse(const std::string& spec, std::vector<band>& bands)
+        {
+            bands.clear();
+
+            if (spec.empty())
+            {
+                band all;
+                all.lo = std::numeric_limits<int>::min();
+                all.hi = std::numeric_limits<int>::max();
+                all.weight = 1;
+                all.label = "all";
+                bands.push_back(all);
+                return true;
+            }
+
+            std::string::size_type begin = 0;
+            while (begin <= spec.size())
+            {
+                std::string::size_type end = spec.find(',', begin);
+                if (end == std::string::npos)
+                    end = spec.size();
+
+                std::string item(spec, begin, end - begin);
+                std::string::size_type colon = item.find(':');
+                if (colon == std::string::npos)
+                    return false;
+
+                band b;
+                try
+                {
+                    b.lo = boost::lexical_cast<int>(item.substr(0, colon));
+                    long weight = boost::lexical_cast<long>(item.substr(colon + 1));
+                    if ((weight < 1) || (weight > SCHEDULER_MAX_WEIGHT))
+                        return false;
+                    b.weight = static_cast<std::size_t>(weight);
+                }
+                catch (boost::bad_lexical_cast&)
+                {
+                    return false;
+                }
+
+                // Floors must go down strictly.
+                if (!bands.empty() && (b.lo >= bands.back().lo))
+                    return false;
+
+                b.hi = bands.empty() ? std::numeric_limits<int>::max() : bands.back().lo - 1;
+                b.label = item.substr(0, colon);
+                bands.push_back(b);
+
+                begin = end + 1;
+            }
+
+            if (bands.size() > SCHEDULER_MAX_BANDS)
+                return false;
+
+            bands.back().lo = std::numeric_limits<int>::min();
+            return true;
+        }
+
+        scheduler::scheduler(const std::string& spec)
+            : current_(0), credit_(0)
+        {
+            if (!parse(spec, bands_))
+                throw std::invalid_argument("invalid priority bands: " + spec);
+            credit_ = bands_[0].weight;
+        }
+
+        std::size_t scheduler::next()
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            return current_;
+        }
+
+        std::size_t scheduler::next(const std::vector<turn>& pending)
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            std::size_t current = current_;
+            std::size_t credit = credit_;
+            for (std::size_t i = 0; i < pending.size(); ++i)
+                advance(pending[i], current, credit);
+            return current;
+        }
+
+        void scheduler::served(const std::vector<turn>& turns)
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            for (std::size_t i = 0; i < turns.size(); ++i)
+                advance(turns[i], current_, credit_);
+        }
+
+        void scheduler::advance(const turn& t, std::size_t& current, std::size_t& credit) const
+        {
+            if (t.b != current)
+            {
+                // An item from another band says nothing of the bands before it
+                // unless they were all found empty: then their turn is over,
+                // and unused credit is not carried over.
+                if (!t.passed)
+                    return;
+                current = t.b;
+                credit = bands_[t.b].weight;
+            }
+
+            if (--credit == 0)
+            {
+                current = (current + 1) % bands_.size();
+                credit = bands_[current].weight;
+            }
+        }
+
+    } // namespace server3
+} // namespace http
@@ -0,0 +1,109 @@
+//
+// scheduler.hpp
+// ~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_SCHEDULER_HPP
+#define HTTP_SERVER3_SCHEDULER_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#define SCHEDULER_MAX_BANDS     16
+#define SCHEDULER_MAX_WEIGHT    1000000
+
+namespace http {
+    namespace server3 {
+
+/// Splits priorities into bands and picks the band each dequeue is served
+/// from, deficit round robin style: a band serves up to its weight in items,
+/// then the next band gets its turn, and an empty band passes. Within a band
+/// items keep strict priority order. Low priority items therefore get a fixed
+/// share of dequeues under any high priority load, and the state is a couple
+/// of counters updated per dequeue, never a rescoring of the queue.
+        class scheduler
+            : private boost::noncopyable
+        {
+        public:
+            struct band
+            {
+                /// Priorities served by the band, inclusive.
+                int lo, hi;
+
+                /// Items served per round.
+                std::size_t weight;
+
+                /// Name used in statistics.
+                std::string label;
+            };
+
+            /// An item dequeued from band b, accounted for once its transaction
+            /// commits.
+            struct turn
+            {
+                std::size_t b;
+
+                /// Whether every band tried before b was asked and found empty,
+                /// which ends their turn. Bands outside the priorities requested
+                /// are skipped unasked and keep it.
+                bool passed;
+
+                /// How long the item waited in the queue, in microseconds.
+                boost::uint64_t wait;
+            };
+
+            /// Parse a band spec "floor:weight,floor:weight,...", bands listed
+            /// from the highest floor down. The first band takes every priority
+            /// above its floor, the last every priority below. An empty spec is a
+            /// single band, i.e. strict priority order. Returns false if invalid.
+            static bool parse(const std::string& spec, std::vector<band>& bands);
+
+            /// Construct from a spec already checked with parse.
+            explicit scheduler(const std::string& spec);
+
+            /// The configured bands, highest first.
+            const std::vector<band>& bands() const
+            {
+                return bands_;
+            }
+
+            /// The band to try first for the next dequeue; when it is empty the
+            /// following ones are tried in turn.
+            std::size_t next();
+
+            /// The band to try first after the dequeues of pending, not yet
+            /// committed.
+            std::size_t next(const std::vector<turn>& pending);
+
+            /// Account for the dequeues of a committed transaction.
+            void served(const std::vector<turn>& turns);
+
+        private:
+            /// Move current past an item dequeued in t.
+            void advance(const turn& t, std::size_t& current, std::size_t& credit) const;
+
+            std::vector<band> bands_;
+
+            /// Protects current_ and credit_.
+            boost::mutex mutex_;
+
+            /// The band whose turn it is.
+            std::size_t current_;
+
+            /// Items the current band may still serve in this round.
+            std::size_t credit_;
+        };
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_SCHEDULER_HPP
@@ -9,33 +9,123 @@
 // file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 //
 
+#include <stdexcept>
 #include <vector>
 #include <boost/thread.hpp>
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+#include "affinity.hpp"
+#include "globals.hpp"
 #include "server.hpp"
 
+#include <signal.h>
+#include <unistd.h>
+
 namespace http {
     namespace server3 {
 
-        server::server(const std::string& database, const std::string& address,
-                       const std::string& port, std::size_t thread_pool_size)
-            : thread_pool_size_(thread_pool_size),
-              acceptor_(io_service_),
-              new_connection_(new connection(io_service_, request_handler_)),
-              request_handler_(thread_pool_size, database)
+        typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+
+        server::server(const settings& cfg)
+            : thread_pool_size_(cfg.threads),
+              reuse_port_(cfg.reuse_port),
+              request_handler_(cfg),
+              draining_(false),
+              drain_deadline_(0)
+        {
+            // In reuse_port mode every thread runs its own io_service with its own
+            // listening sockets; the kernel spreads new connections between them and
+            // a connection never leaves the thread that accepted it.
+            std::size_t n = reuse_port_ ? thread_pool_size_ : 1;
+            affinity::parse(cfg.cpus, cpus_);
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                io_services_.push_back(io_service_ptr(reuse_port_ ?
+                                                      new boost::asio::io_service(1) :
+                                                      new boost::asio::io_service()));
+            }
+
+            // Sockets taken over come as every HTTP acceptor, then every binary
+            // one; a predecessor laid out otherwise keeps serving.
+            std::size_t listeners = cfg.binary_port.empty() ? n : 2 * n;
+            std::vector<int> fds;
+            if (!cfg.handoff.empty())
+            {
+                handoff_.reset(new handoff(*io_services_[0], cfg.handoff));
+                if (handoff_->take(fds) && (fds.size() != listeners))
+                {
+                    for (std::size_t i = 0; i < fds.size(); ++i)
+                        ::close(fds[i]);
+                    throw std::runtime_error("handoff: predecessor listens with another number of "
+                                             "threads, binary port or --reuseport");
+                }
+            }
+
+            if (cfg.uring && !uring::available())
+                throw std::runtime_error("io_uring: not built in (no linux/io_uring.h)");
+            LINFO(cfg.uring ? "transport: io_uring" : "transport: epoll");
+
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                boost::asio::io_service& io_service = *io_services_[i];
+                if (cfg.uring)
+                    rings_.push_back(uring_ptr(new uring(io_service)));
+                timer_wheels_.push_back(timer_wheel_ptr(new timer_wheel(io_service)));
+                connection_caches_.push_back(connection_cache_ptr(
+                                                 new connection_cache(io_service, request_handler_,
+                                                                      *timer_wheels_[i], !reuse_port_,
+                                                                      rings_.empty() ? 0 : rings_[i].get())));
+
+                acceptors_.push_back(listen(io_service, cfg.address, cfg.port,
+                                            fds.empty() ? -1 : fds[i]));
+                new_connections_.push_back(connection_ptr());
+
+                // The first connection is allocated by a thread of the
+                // io_service too, on its NUMA node.
+                io_service.post(boost::bind(&server::start_accept, this, i));
+
+                if (!cfg.binary_port.empty())
+                {
+                    binary_acceptors_.push_back(listen(io_service, cfg.address, cfg.binary_port,
+                                                       fds.empty() ? -1 : fds[n + i]));
+                    new_binary_connections_.push_back(binary_connection_ptr());
+                    io_service.post(boost::bind(&server::start_binary_accept, this, i));
+                }
+            }
+
+            if (handoff_)
+            {
+                fds.clear();
+                for (std::size_t i = 0; i < acceptors_.size(); ++i)
+                    fds.push_back(acceptors_[i]->native_handle());
+                for (std::size_t i = 0; i < binary_acceptors_.size(); ++i)
+                    fds.push_back(binary_acceptors_[i]->native_handle());
+                handoff_->listen(fds, boost::bind(&server::drain, this));
+            }
+        }
+
+        server::acceptor_ptr server::listen(boost::asio::io_service& io_service,
+                                            const std::string& address, const std::string& port,
+                                            int fd)
         {
             // Open the acceptor with the option to reuse the address (i.e. SO_REUSEADDR).
-            boost::asio::ip::tcp::resolver resolver(io_service_);
+            boost::asio::ip::tcp::resolver resolver(io_service);
             boost::asio::ip::tcp::resolver::query query(address, port);
             boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(query);
-            acceptor_.open(endpoint.protocol());
-            acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
-            acceptor_.bind(endpoint);
-            acceptor_.listen();
-            acceptor_.async_accept(new_connection_->socket(),
-                                   boost::bind(&server::handle_accept, this,
-                                               boost::asio::placeholders::error));
+            acceptor_ptr acceptor(new boost::asio::ip::tcp::acceptor(io_service));
+            if (fd >= 0)
+            {
+                acceptor->assign(endpoint.protocol(), fd);
+                return acceptor;
+            }
+            acceptor->open(endpoint.protocol());
+            acceptor->set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+            if (reuse_port_)
+                acceptor->set_option(reuse_port(true));
+            acceptor->bind(endpoint);
+            acceptor->listen();
+            return acceptor;
         }
 
         void server::run()
@@ -45,7 +135,7 @@ namespace http {
             for (std::size_t i = 0; i < thread_pool_size_; ++i)
             {
                 boost::shared_ptr<boost::thread> thread(new boost::thread(
-                                                            boost::bind(&boost::asio::io_service::run, &io_service_)));
+                                                            boost::bind(&server::run_thread, this, i)));
                 threads.push_back(thread);
             }
 
@@ -54,20 +144,132 @@ namespace http {
                 threads[i]->join();
         }
 
+        void server::run_thread(std::size_t i)
+        {
+            // Pinned before it runs a handler, the thread allocates its
+            // connections, buffers and statistics on its own node.
+            if (!cpus_.empty())
+                affinity::pin(std::vector<int>(1, cpus_[i % cpus_.size()]));
+            LINFO("placement: io thread " + boost::lexical_cast<std::string>(i) + " " + affinity::where());
+
+            io_services_[i % io_services_.size()]->run();
+        }
+
         void server::stop()
         {
-            io_service_.stop();
+            for (std::size_t i = 0; i < io_services_.size(); ++i)
+                io_services_[i]->stop();
+        }
+
+        void server::drain()
+        {
+            // Connections still waiting in the listen queues belong to the
+            // successor, which holds the same sockets.
+            {
+                boost::mutex::scoped_lock lock(accept_mutex_);
+                draining_ = true;
+            }
+
+            // Each acceptor is closed by its own io_service, which its pending
+            // accept belongs to, rather than from this thread.
+            for (std::size_t i = 0; i < io_services_.size(); ++i)
+                io_services_[i]->post(boost::bind(&server::close_acceptors, this, i));
+
+            // Streams end with their last chunk, so that their clients see a
+            // clean end and move to the successor: at their next batch, or
+            // right away for those waiting for credit.
+            request_handler_.stop_streams();
+            for (std::size_t i = 0; i < timer_wheels_.size(); ++i)
+                timer_wheels_[i]->drain();
+
+            drain_deadline_ = stats::now() + SERVER_DRAIN_TIMEOUT * 1000000ULL;
+            drain_timer_.reset(new boost::asio::deadline_timer(*io_services_[0]));
+            handle_drain(boost::system::error_code());
+        }
+
+        void server::close_acceptors(std::size_t i)
+        {
+            boost::mutex::scoped_lock lock(accept_mutex_);
+            boost::system::error_code ignored_ec;
+            if (!rings_.empty())
+                rings_[i]->cancel_accept(acceptors_[i]->native_handle());
+            acceptors_[i]->close(ignored_ec);
+            if (i < binary_acceptors_.size())
+                binary_acceptors_[i]->close(ignored_ec);
+        }
+
+        void server::handle_drain(const boost::system::error_code& e)
+        {
+            if (e)
+                return;
+
+            // Persistent binary connections and streams are cut at the deadline;
+            // their clients reconnect to the successor.
+            if ((g_stats.connections() == 0) || (stats::now() >= drain_deadline_))
+            {
+                LINFO("handoff: drained, exiting");
+                ::kill(::getpid(), SIGTERM);
+                return;
+            }
+
+            drain_timer_->expires_from_now(boost::posix_time::milliseconds(SERVER_DRAIN_POLL));
+            drain_timer_->async_wait(boost::bind(&server::handle_drain, this,
+                                                 boost::asio::placeholders::error));
+        }
+
+        void server::start_accept(std::size_t i)
+        {
+            boost::mutex::scoped_lock lock(accept_mutex_);
+            if (draining_)
+                return;
+
+            // The ring keeps accepting until the acceptor closes.
+            if (!rings_.empty())
+            {
+                rings_[i]->accept(acceptors_[i]->native_handle(),
+                                  boost::bind(&server::handle_uring_accept, this, i, _1));
+                return;
+            }
+
+            new_connections_[i] = connection_caches_[i]->acquire();
+            acceptors_[i]->async_accept(new_connections_[i]->socket(),
+                                        boost::bind(&server::handle_accept, this, i,
+                                                    boost::asio::placeholders::error));
+        }
+
+        void server::handle_accept(std::size_t i, const boost::system::error_code& e)
+        {
+            if (!e)
+            {
+                new_connections_[i]->start();
+                start_accept(i);
+            }
+        }
+
+        void server::handle_uring_accept(std::size_t i, int fd)
+        {
+            connection_caches_[i]->acquire()->start(fd);
+        }
+
+        void server::start_binary_accept(std::size_t i)
+        {
+            boost::mutex::scoped_lock lock(accept_mutex_);
+            if (draining_)
+                return;
+
+            new_binary_connections_[i].reset(new binary_connection(*io_services_[i], request_handler_,
+                                                                      *timer_wheels_[i], !reuse_port_));
+            binary_acceptors_[i]->async_accept(new_binary_connections_[i]->socket(),
+                                               boost::bind(&server::handle_binary_accept, this, i,
+                                                           boost::asio::placeholders::error));
         }
 
-        void server::handle_accept(const boost::system::error_code& e)
+        void server::handle_binary_accept(std::size_t i, const boost::system::error_code& e)
         {
             if (!e)
             {
-                new_connection_->start();
-                new_connection_.reset(new connection(io_service_, request_handler_));
-                acceptor_.async_accept(new_connection_->socket(),
-                                       boost::bind(&server::handle_accept, this,
-                                                   boost::asio::placeholders::error));
+                new_binary_connections_[i]->start();
+                start_binary_accept(i);
             }
         }
 
@@ -16,9 +16,21 @@
 #include <vector>
 #include <boost/asio.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+#include "binary_connection.hpp"
 #include "connection.hpp"
+#include "connection_cache.hpp"
+#include "handoff.hpp"
 #include "request_handler.hpp"
+#include "settings.hpp"
+#include "timer_wheel.hpp"
+#include "uring.hpp"
+
+#define SERVER_DRAIN_TIMEOUT    10000   // ms open connections get after a handoff
+#define SERVER_DRAIN_POLL       50      // ms
 
 namespace http {
     namespace server3 {
@@ -28,10 +40,9 @@ namespace http {
             : private boost::noncopyable
         {
         public:
-            /// Construct the server to listen on the specified TCP address and port, and
-            /// serve up files from the given directory.
-            explicit server(const std::string& database, const std::string& address,
-                            const std::string& port, std::size_t thread_pool_size);
+            /// Construct the server to listen on the configured TCP address and
+            /// ports, or on those of the running lisa it takes over from.
+            explicit server(const settings& cfg);
 
             /// Run the server's io_service loop.
             void run();
@@ -40,23 +51,98 @@ namespace http {
             void stop();
 
         private:
+            typedef boost::shared_ptr<boost::asio::io_service> io_service_ptr;
+            typedef boost::shared_ptr<boost::asio::ip::tcp::acceptor> acceptor_ptr;
+
+            /// Open, bind and listen on an acceptor for the given address and port,
+            /// or adopt the already listening socket fd if it is not negative.
+            acceptor_ptr listen(boost::asio::io_service& io_service,
+                                const std::string& address, const std::string& port,
+                                int fd);
+
+            /// Body of the i-th I/O thread: take its place, then run its io_service.
+            void run_thread(std::size_t i);
+
+            /// Stop accepting after a successor took over the listening sockets,
+            /// and end the process once the open connections are done.
+            void drain();
+
+            /// Close the acceptors of the i-th io_service, from one of its threads.
+            void close_acceptors(std::size_t i);
+
+            /// Check whether draining is over.
+            void handle_drain(const boost::system::error_code& e);
+
+            /// Start an asynchronous accept on the i-th HTTP acceptor.
+            void start_accept(std::size_t i);
+
             /// Handle completion of an asynchronous accept operation.
-            void handle_accept(const boost::system::error_code& e);
+            void handle_accept(std::size_t i, const boost::system::error_code& e);
+
+            /// Handle a connection accepted through the i-th ring.
+            void handle_uring_accept(std::size_t i, int fd);
+
+            /// Start an asynchronous accept on the i-th binary protocol acceptor.
+            void start_binary_accept(std::size_t i);
+
+            /// Handle completion of an asynchronous binary protocol accept operation.
+            void handle_binary_accept(std::size_t i, const boost::system::error_code& e);
 
             /// The number of threads that will call io_service::run().
             std::size_t thread_pool_size_;
 
-            /// The io_service used to perform asynchronous operations.
-            boost::asio::io_service io_service_;
+            /// Whether each thread owns its io_service and acceptors.
+            bool reuse_port_;
 
-            /// Acceptor used to listen for incoming connections.
-            boost::asio::ip::tcp::acceptor acceptor_;
+            /// CPUs the I/O threads are pinned to, one each in turn.
+            std::vector<int> cpus_;
 
-            /// The next connection to be accepted.
-            connection_ptr new_connection_;
+            /// The io_services used to perform asynchronous operations: a single one
+            /// shared by every thread, or one per thread in reuse_port mode.
+            std::vector<io_service_ptr> io_services_;
+
+            /// Acceptors used to listen for incoming connections, one per io_service.
+            std::vector<acceptor_ptr> acceptors_;
+
+            /// Acceptors used to listen for incoming binary protocol connections.
+            std::vector<acceptor_ptr> binary_acceptors_;
+
+            /// The io_uring transport of the HTTP connections, one ring per
+            /// io_service (none on epoll). Declared after io_services_ so that
+            /// they are destroyed before them, and before connection_caches_ so
+            /// that connections are given back to them while they exist.
+            std::vector<uring_ptr> rings_;
+
+            /// Connection deadlines, one wheel per io_service. Declared after
+            /// io_services_ so that they are destroyed before them.
+            std::vector<timer_wheel_ptr> timer_wheels_;
+
+            /// Recycled HTTP connections, one cache per io_service. Declared after
+            /// io_services_ so that they are destroyed before them.
+            std::vector<connection_cache_ptr> connection_caches_;
+
+            /// The next connection to be accepted on each acceptor.
+            std::vector<connection_ptr> new_connections_;
+
+            /// The next binary protocol connection to be accepted on each acceptor.
+            std::vector<binary_connection_ptr> new_binary_connections_;
 
             /// The handler for all incoming requests.
             request_handler request_handler_;
+
+            /// Hot restart through a Unix socket, if configured.
+            boost::scoped_ptr<handoff> handoff_;
+
+            /// Keeps an accept from starting while its acceptor closes, in the
+            /// io_service shared by every thread.
+            boost::mutex accept_mutex_;
+
+            /// Whether the listening sockets belong to a successor now.
+            bool draining_;
+
+            /// Polls the open connections while draining, until drain_deadline_.
+            boost::scoped_ptr<boost::asio::deadline_timer> drain_timer_;
+            boost::uint64_t drain_deadline_;
         };
 
     } // namespace server3
@@ -0,0 +1,31 @@
+//
+// services.cpp
+// ~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "services.hpp"
+
+namespace http {
+    namespace server3 {
+
+        services::services(const settings& cfg)
+            : database_pool(cfg.threads),
+              codec(cfg.compress_threshold),
+              blobs(cfg.spill_threshold),
+              dedup(cfg.dedup_entries, cfg.dedup_window),
+              schedule(cfg.bands),
+              admit(cfg.concurrency ? cfg.concurrency : cfg.threads, cfg.lease_timeout),
+              connect(database_pool, cfg.threads, cfg.database, cfg.background_cpus),
+              replicate(cfg, database_pool, connect),
+              heads(cfg.head_index),
+              shard(cfg)
+        {
+        }
+
+    } // namespace server3
+} // namespace http
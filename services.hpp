@@ -0,0 +1,75 @@
+//
+// services.hpp
+// ~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_SERVICES_HPP
+#define HTTP_SERVER3_SERVICES_HPP
+
+#include <boost/noncopyable.hpp>
+#include "admission.hpp"
+#include "blob_store.hpp"
+#include "cluster.hpp"
+#include "connector.hpp"
+#include "dedup_index.hpp"
+#include "head_index.hpp"
+#include "item_codec.hpp"
+#include "replicator.hpp"
+#include "scheduler.hpp"
+#include "settings.hpp"
+
+#include "soci.h"
+#include "soci-mysql.h"
+
+namespace http {
+    namespace server3 {
+
+/// What requests are served with: the database sessions and the state shared
+/// by every connection. The request_handler owns the only instance and hands
+/// it to each request it serves.
+        struct services
+            : private boost::noncopyable
+        {
+            /// Build every service and start opening the database sessions.
+            explicit services(const settings& cfg);
+
+            /// The database sessions, one per thread.
+            soci::connection_pool database_pool;
+
+            /// Compression of stored items.
+            const item_codec codec;
+
+            /// Large items kept out of the rows.
+            const blob_store blobs;
+
+            /// Recently enqueued dedup keys.
+            dedup_index dedup;
+
+            /// Priority band scheduling of dequeues.
+            scheduler schedule;
+
+            /// Admission control in front of the database.
+            admission admit;
+
+            /// Opens the sessions of the pool; destroyed before the pool.
+            connector connect;
+
+            /// Replication of the queue; stopped before the sessions close.
+            replicator replicate;
+
+            /// The head items, in memory.
+            head_index heads;
+
+            /// Placement of topics on cluster members.
+            cluster shard;
+        };
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_SERVICES_HPP
@@ -0,0 +1,115 @@
+//
+// settings.hpp
+// ~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_SETTINGS_HPP
+#define HTTP_SERVER3_SETTINGS_HPP
+
+#include <string>
+
+namespace http {
+    namespace server3 {
+
+/// Runtime options collected from the command line.
+        struct settings
+        {
+            settings()
+                : threads(0), reuse_port(false), uring(false), compress_threshold(0), spill_threshold(0),
+                  head_index(0), dedup_window(0), dedup_entries(0), concurrency(0), lease_timeout(0),
+                  min_sessions(0), proxy(false)
+            {
+            }
+
+            /// Database DSN used by every session of the pool.
+            std::string database;
+
+            /// Interface to listen on.
+            std::string address;
+
+            /// HTTP port.
+            std::string port;
+
+            /// Binary protocol port (empty disables the binary listener).
+            std::string binary_port;
+
+            /// Number of I/O threads (and database sessions).
+            std::size_t threads;
+
+            /// Give every thread its own io_service and SO_REUSEPORT acceptors,
+            /// instead of sharing a single io_service between all of them.
+            bool reuse_port;
+
+            /// Accept, read and write HTTP connections through io_uring instead
+            /// of Asio's epoll reactor.
+            bool uring;
+
+            /// Compress stored items of at least this many bytes (0 disables).
+            std::size_t compress_threshold;
+
+            /// Keep stored items of at least this many bytes out of the rows of
+            /// the queue (0 disables).
+            std::size_t spill_threshold;
+
+            /// Head items kept in memory for spy and peek (0 disables).
+            std::size_t head_index;
+
+            /// Seconds a dedup key is remembered in memory (0 disables the index).
+            std::size_t dedup_window;
+
+            /// Capacity of the in-memory dedup index.
+            std::size_t dedup_entries;
+
+            /// Priority bands served round robin, "floor:weight,..." (empty keeps
+            /// strict priority order).
+            std::string bands;
+
+            /// Most requests using the database at once (0 for one per thread);
+            /// the actual limit adapts below it.
+            std::size_t concurrency;
+
+            /// Most milliseconds to wait for a database session.
+            int lease_timeout;
+
+            /// Database sessions open before accepting requests; the others
+            /// are opened in the background.
+            std::size_t min_sessions;
+
+            /// Unix socket to take the listening sockets over from a running
+            /// lisa, and to hand them to the next one (empty disables).
+            std::string handoff;
+
+            /// Port replicas connect to (empty: not a primary).
+            std::string replication_port;
+
+            /// Primary to replicate from, "host:port" (empty: not a replica).
+            std::string follow;
+
+            /// Cluster members, "host:port,..." (empty: no cluster mode).
+            std::string cluster;
+
+            /// This node in the member list.
+            std::string self;
+
+            /// Proxy requests for topics owned by other members, instead of
+            /// redirecting the client.
+            bool proxy;
+
+            /// CPUs the I/O threads are pinned to, one each in turn, "0-3,8,..."
+            /// (empty: no placement).
+            std::string cpus;
+
+            /// CPUs the background threads (opening sessions, replication) may
+            /// run on (empty: no placement).
+            std::string background_cpus;
+        };
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_SETTINGS_HPP
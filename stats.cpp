@@ -0,0 +1,346 @@
+//
+// stats.cpp
+// ~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <time.h>
+#include "stats.hpp"
+
+namespace http {
+    namespace server3 {
+
+        namespace {
+
+            const char* operation_names[] = { "enqueue", "dequeue", "spy", "count" };
+            const char* phase_names[] = { "parse", "pool_wait", "database", "write", "total" };
+            const char* deadline_names[] = { "idle", "header", "body", "write" };
+            const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+            const char* quantile_names[] = { "p50", "p90", "p99", "p999" };
+            const std::size_t quantile_count = sizeof(quantiles) / sizeof(quantiles[0]);
+
+        } // namespace
+
+        histogram::histogram()
+            : sum_(0)
+        {
+            for (std::size_t i = 0; i < STATS_BUCKETS; ++i)
+                counts_[i].store(0, boost::memory_order_relaxed);
+        }
+
+        void histogram::record(boost::uint64_t us)
+        {
+            boost::atomic<boost::uint64_t>& c = counts_[index(us)];
+            c.store(c.load(boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+            sum_.store(sum_.load(boost::memory_order_relaxed) + us, boost::memory_order_relaxed);
+        }
+
+        void histogram::merge(std::vector<boost::uint64_t>& counts, boost::uint64_t& sum) const
+        {
+            counts.resize(STATS_BUCKETS, 0);
+            for (std::size_t i = 0; i < STATS_BUCKETS; ++i)
+                counts[i] += counts_[i].load(boost::memory_order_relaxed);
+            sum += sum_.load(boost::memory_order_relaxed);
+        }
+
+        std::size_t histogram::index(boost::uint64_t us)
+        {
+            const boost::uint64_t sub = 1 << STATS_SUB_BUCKET_BITS;
+            if (us < sub)
+                return static_cast<std::size_t>(us);
+
+            int msb = 63 - __builtin_clzll(us);
+            int e = msb - (STATS_SUB_BUCKET_BITS - 1);
+            std::size_t i = e * (sub / 2) + static_cast<std::size_t>(us >> e);
+            return (i < STATS_BUCKETS) ? i : STATS_BUCKETS - 1;
+        }
+
+        boost::uint64_t histogram::upper_bound(std::size_t index)
+        {
+            const std::size_t sub = 1 << STATS_SUB_BUCKET_BITS;
+            if (index < sub)
+                return index;
+
+            int e = static_cast<int>(index / (sub / 2)) - 1;
+            boost::uint64_t m = index - e * (sub / 2);
+            return ((m + 1) << e) - 1;
+        }
+
+        boost::uint64_t histogram::quantile(const std::vector<boost::uint64_t>& counts,
+                                            boost::uint64_t total, double q)
+        {
+            if (total == 0)
+                return 0;
+
+            boost::uint64_t rank = static_cast<boost::uint64_t>(std::ceil(q * total));
+            if (rank == 0)
+                rank = 1;
+
+            boost::uint64_t seen = 0;
+            for (std::size_t i = 0; i < counts.size(); ++i)
+            {
+                seen += counts[i];
+                if (seen >= rank)
+                    return upper_bound(i);
+            }
+            return upper_bound(counts.size() - 1);
+        }
+
+        stats::block::block()
+            : bytes_in(0), bytes_out(0)
+        {
+            for (std::size_t i = 0; i < STATS_MAX_STATUS; ++i)
+                statuses[i].store(0, boost::memory_order_relaxed);
+            for (int i = 0; i < deadlines; ++i)
+                timeouts[i].store(0, boost::memory_order_relaxed);
+        }
+
+        stats::stats()
+            : local_(keep), connections_(0), started_(now())
+        {
+        }
+
+        void stats::keep(block*)
+        {
+            // Blocks are owned by stats and outlive their threads.
+        }
+
+        stats::~stats()
+        {
+            for (std::size_t i = 0; i < blocks_.size(); ++i)
+                delete blocks_[i];
+        }
+
+        boost::uint64_t stats::now()
+        {
+            timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return static_cast<boost::uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+        }
+
+        stats::block& stats::local()
+        {
+            block* b = local_.get();
+            if (!b)
+            {
+                b = new block();
+                {
+                    boost::mutex::scoped_lock lock(mutex_);
+                    blocks_.push_back(b);
+                }
+                local_.reset(b);
+            }
+            return *b;
+        }
+
+        void stats::record(const sample& s)
+        {
+            if ((s.op < 0) || (s.op >= operations))
+                return;
+
+            block& b = local();
+            for (int i = 0; i < phases; ++i)
+                b.latency[s.op][i].record(s.ns[i] / 1000);
+        }
+
+        void stats::wait(std::size_t band, boost::uint64_t us)
+        {
+            if (band < STATS_MAX_BANDS)
+                local().waits[band].record(us);
+        }
+
+        void stats::status(int code)
+        {
+            if ((code >= 0) && (code < STATS_MAX_STATUS))
+                add(local().statuses[code], 1);
+        }
+
+        void stats::bytes_in(std::size_t n)
+        {
+            add(local().bytes_in, n);
+        }
+
+        void stats::bytes_out(std::size_t n)
+        {
+            add(local().bytes_out, n);
+        }
+
+        void stats::connection_opened()
+        {
+            ++connections_;
+        }
+
+        void stats::connection_closed()
+        {
+            --connections_;
+        }
+
+        long stats::connections() const
+        {
+            return connections_.load();
+        }
+
+        void stats::timed_out(deadline d)
+        {
+            add(local().timeouts[d], 1);
+        }
+
+        void stats::report(std::string& out, bool prometheus,
+                           const std::vector<int>& priorities, const std::vector<int>& depths,
+                           const std::vector<std::string>& bands) const
+        {
+            // Take a snapshot of every block.
+            std::vector<boost::uint64_t> statuses(STATS_MAX_STATUS, 0);
+            std::vector<boost::uint64_t> counts[operations][phases];
+            boost::uint64_t sums[operations][phases] = {};
+            std::vector<boost::uint64_t> waits[STATS_MAX_BANDS];
+            boost::uint64_t wait_sums[STATS_MAX_BANDS] = {};
+            boost::uint64_t in = 0, sent = 0;
+            boost::uint64_t timeouts[deadlines] = {};
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                for (std::size_t b = 0; b < blocks_.size(); ++b)
+                {
+                    const block& blk = *blocks_[b];
+                    for (int o = 0; o < operations; ++o)
+                        for (int p = 0; p < phases; ++p)
+                            blk.latency[o][p].merge(counts[o][p], sums[o][p]);
+                    for (std::size_t w = 0; w < STATS_MAX_BANDS; ++w)
+                        blk.waits[w].merge(waits[w], wait_sums[w]);
+                    for (std::size_t i = 0; i < STATS_MAX_STATUS; ++i)
+                        statuses[i] += blk.statuses[i].load(boost::memory_order_relaxed);
+                    in += blk.bytes_in.load(boost::memory_order_relaxed);
+                    sent += blk.bytes_out.load(boost::memory_order_relaxed);
+                    for (int d = 0; d < deadlines; ++d)
+                        timeouts[d] += blk.timeouts[d].load(boost::memory_order_relaxed);
+                }
+            }
+
+            std::stringstream s;
+            double uptime = (now() - started_) / 1e9;
+
+            if (prometheus)
+            {
+                s << "# TYPE lisa_uptime_seconds gauge\n"
+                  << "lisa_uptime_seconds " << uptime << "\n"
+                  << "# TYPE lisa_connections_active gauge\n"
+                  << "lisa_connections_active " << connections_.load() << "\n"
+                  << "# TYPE lisa_bytes_received_total counter\n"
+                  << "lisa_bytes_received_total " << in << "\n"
+                  << "# TYPE lisa_bytes_sent_total counter\n"
+                  << "lisa_bytes_sent_total " << sent << "\n"
+                  << "# TYPE lisa_connection_timeouts_total counter\n";
+                for (int d = 0; d < deadlines; ++d)
+                    s << "lisa_connection_timeouts_total{deadline=\"" << deadline_names[d] << "\"} "
+                      << timeouts[d] << "\n";
+
+                s << "# TYPE lisa_responses_total counter\n";
+                for (std::size_t i = 0; i < STATS_MAX_STATUS; ++i)
+                    if (statuses[i])
+                        s << "lisa_responses_total{code=\"" << i << "\"} " << statuses[i] << "\n";
+
+                s << "# TYPE lisa_queue_depth gauge\n";
+                for (std::size_t i = 0; i < priorities.size(); ++i)
+                    s << "lisa_queue_depth{priority=\"" << priorities[i] << "\"} " << depths[i] << "\n";
+
+                s << "# TYPE lisa_latency_seconds summary\n";
+                for (int o = 0; o < operations; ++o)
+                {
+                    for (int p = 0; p < phases; ++p)
+                    {
+                        boost::uint64_t total = 0;
+                        for (std::size_t i = 0; i < counts[o][p].size(); ++i)
+                            total += counts[o][p][i];
+
+                        std::stringstream labels;
+                        labels << "op=\"" << operation_names[o] << "\",phase=\"" << phase_names[p] << "\"";
+
+                        for (std::size_t q = 0; q < quantile_count; ++q)
+                            s << "lisa_latency_seconds{" << labels.str() << ",quantile=\"" << quantiles[q] << "\"} "
+                              << histogram::quantile(counts[o][p], total, quantiles[q]) / 1e6 << "\n";
+                        s << "lisa_latency_seconds_sum{" << labels.str() << "} " << sums[o][p] / 1e6 << "\n"
+                          << "lisa_latency_seconds_count{" << labels.str() << "} " << total << "\n";
+                    }
+                }
+
+                s << "# TYPE lisa_wait_seconds summary\n";
+                for (std::size_t w = 0; (w < bands.size()) && (w < STATS_MAX_BANDS); ++w)
+                {
+                    boost::uint64_t total = 0;
+                    for (std::size_t i = 0; i < waits[w].size(); ++i)
+                        total += waits[w][i];
+
+                    std::string labels = "band=\"" + bands[w] + "\"";
+                    for (std::size_t q = 0; q < quantile_count; ++q)
+                        s << "lisa_wait_seconds{" << labels << ",quantile=\"" << quantiles[q] << "\"} "
+                          << histogram::quantile(waits[w], total, quantiles[q]) / 1e6 << "\n";
+                    s << "lisa_wait_seconds_sum{" << labels << "} " << wait_sums[w] / 1e6 << "\n"
+                      << "lisa_wait_seconds_count{" << labels << "} " << total << "\n";
+                }
+            }
+            else
+            {
+                s << "uptime " << std::fixed << std::setprecision(0) << uptime << "s\n"
+                  << "connections " << connections_.load() << "\n"
+                  << "bytes_in " << in << "\n"
+                  << "bytes_out " << sent << "\n"
+                  << "timeouts";
+                for (int d = 0; d < deadlines; ++d)
+                    s << " " << deadline_names[d] << "=" << timeouts[d];
+                s << "\n";
+                for (std::size_t i = 0; i < STATS_MAX_STATUS; ++i)
+                    if (statuses[i])
+                        s << "status " << i << " " << statuses[i] << "\n";
+                for (std::size_t i = 0; i < priorities.size(); ++i)
+                    s << "depth " << priorities[i] << " " << depths[i] << "\n";
+
+                for (int o = 0; o < operations; ++o)
+                {
+                    for (int p = 0; p < phases; ++p)
+                    {
+                        boost::uint64_t total = 0;
+                        for (std::size_t i = 0; i < counts[o][p].size(); ++i)
+                            total += counts[o][p][i];
+                        if (total == 0)
+                            continue;
+
+                        s << "latency " << operation_names[o] << " " << phase_names[p]
+                          << " count=" << total
+                          << " mean=" << sums[o][p] / total << "us";
+                        for (std::size_t q = 0; q < quantile_count; ++q)
+                            s << " " << quantile_names[q] << "="
+                              << histogram::quantile(counts[o][p], total, quantiles[q]) << "us";
+                        s << " max=" << histogram::quantile(counts[o][p], total, 1.0) << "us\n";
+                    }
+                }
+
+                for (std::size_t w = 0; (w < bands.size()) && (w < STATS_MAX_BANDS); ++w)
+                {
+                    boost::uint64_t total = 0;
+                    for (std::size_t i = 0; i < waits[w].size(); ++i)
+                        total += waits[w][i];
+                    if (total == 0)
+                        continue;
+
+                    s << "wait " << bands[w]
+                      << " count=" << total
+                      << " mean=" << wait_sums[w] / total << "us";
+                    for (std::size_t q = 0; q < quantile_count; ++q)
+                        s << " " << quantile_names[q] << "="
+                          << histogram::quantile(waits[w], total, quantiles[q]) << "us";
+                    s << " max=" << histogram::quantile(waits[w], total, 1.0) << "us\n";
+                }
+            }
+
+            out = s.str();
+        }
+
+    } // namespace server3
+} // namespace http
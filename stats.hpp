@@ -0,0 +1,200 @@
+//
+// stats.hpp
+// ~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_STATS_HPP
+#define HTTP_SERVER3_STATS_HPP
+
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+#define STATS_SUB_BUCKET_BITS   5
+#define STATS_BUCKETS           608
+#define STATS_MAX_STATUS        600
+#define STATS_MAX_BANDS         16
+
+namespace http {
+    namespace server3 {
+
+/// Log-linear (HDR-style) latency histogram in microseconds: exact below 32us,
+/// then 16 buckets per power of two, i.e. about 6% relative error up to days.
+/// Each instance has a single writer; readers may load concurrently.
+        class histogram
+            : private boost::noncopyable
+        {
+        public:
+            histogram();
+
+            /// Record one value (single writer).
+            void record(boost::uint64_t us);
+
+            /// Add the counts of this histogram into a plain snapshot.
+            void merge(std::vector<boost::uint64_t>& counts, boost::uint64_t& sum) const;
+
+            /// Bucket index of a value.
+            static std::size_t index(boost::uint64_t us);
+
+            /// Highest value that falls in a bucket.
+            static boost::uint64_t upper_bound(std::size_t index);
+
+            /// Value at quantile q (0..1) of a snapshot.
+            static boost::uint64_t quantile(const std::vector<boost::uint64_t>& counts,
+                                            boost::uint64_t total, double q);
+
+        private:
+            boost::atomic<boost::uint64_t> counts_[STATS_BUCKETS];
+            boost::atomic<boost::uint64_t> sum_;
+        };
+
+/// Server-wide instrumentation. Latency histograms, status codes and byte
+/// counters live in per-thread blocks written without locks or shared cache
+/// lines; they are only summed when a report is requested.
+        class stats
+            : private boost::noncopyable
+        {
+        public:
+            enum operation { enqueue, dequeue, spy, count, operations };
+            enum phase { parse, pool_wait, database, write, total, phases };
+            enum deadline { idle_deadline, header_deadline, body_deadline, write_deadline, deadlines };
+
+            /// The timings of one request, filled in as it moves along.
+            struct sample
+            {
+                sample()
+                {
+                    clear();
+                }
+
+                void clear()
+                {
+                    op = -1;
+                    for (int i = 0; i < phases; ++i)
+                        ns[i] = 0;
+                }
+
+                /// The operation served, or -1 when the request was rejected.
+                int op;
+
+                /// Nanoseconds spent in each phase.
+                boost::uint64_t ns[phases];
+            };
+
+            /// Adds the time elapsed during its lifetime to one phase of a sample.
+            class stopwatch
+                : private boost::noncopyable
+            {
+            public:
+                stopwatch(sample& s, phase p)
+                    : sample_(s), phase_(p), start_(now())
+                {
+                }
+
+                ~stopwatch()
+                {
+                    sample_.ns[phase_] += now() - start_;
+                }
+
+            private:
+                sample& sample_;
+                phase phase_;
+                boost::uint64_t start_;
+            };
+
+            stats();
+
+            ~stats();
+
+            /// Monotonic clock in nanoseconds.
+            static boost::uint64_t now();
+
+            /// Record the phases of a finished request.
+            void record(const sample& s);
+
+            /// Record how long a dequeued item waited in the queue, per priority
+            /// band.
+            void wait(std::size_t band, boost::uint64_t us);
+
+            /// Count a reply status code.
+            void status(int code);
+
+            /// Count bytes received from clients.
+            void bytes_in(std::size_t n);
+
+            /// Count bytes sent to clients.
+            void bytes_out(std::size_t n);
+
+            /// Track client connections.
+            void connection_opened();
+            void connection_closed();
+
+            /// Client connections open now.
+            long connections() const;
+
+            /// Count a connection closed because a deadline passed.
+            void timed_out(deadline d);
+
+            /// Render every metric, followed by the given per-priority queue
+            /// depths, as plain text or in the Prometheus exposition format.
+            /// Band wait times are labelled with the names in bands.
+            void report(std::string& out, bool prometheus,
+                        const std::vector<int>& priorities, const std::vector<int>& depths,
+                        const std::vector<std::string>& bands) const;
+
+        private:
+            /// Everything a single thread writes.
+            struct block
+            {
+                block();
+
+                histogram latency[operations][phases];
+                histogram waits[STATS_MAX_BANDS];
+                boost::atomic<boost::uint64_t> statuses[STATS_MAX_STATUS];
+                boost::atomic<boost::uint64_t> bytes_in;
+                boost::atomic<boost::uint64_t> bytes_out;
+                boost::atomic<boost::uint64_t> timeouts[deadlines];
+            };
+
+            /// The calling thread's block, created on first use.
+            block& local();
+
+            /// Thread exit cleanup of local_: blocks are not deleted there.
+            static void keep(block* b);
+
+            /// Add to a single-writer counter.
+            static void add(boost::atomic<boost::uint64_t>& counter, boost::uint64_t n)
+            {
+                counter.store(counter.load(boost::memory_order_relaxed) + n,
+                              boost::memory_order_relaxed);
+            }
+
+            /// The calling thread's block (not owned).
+            boost::thread_specific_ptr<block> local_;
+
+            /// Protects blocks_.
+            mutable boost::mutex mutex_;
+
+            /// Every block ever created, owned.
+            std::vector<block*> blocks_;
+
+            /// Open client connections.
+            boost::atomic<long> connections_;
+
+            /// Start of the process, for uptime.
+            boost::uint64_t started_;
+        };
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_STATS_HPP
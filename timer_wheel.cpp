@@ -0,0 +1,146 @@
+//
+// timer_wheel.cpp
+// ~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <boost/bind.hpp>
+#include "stats.hpp"
+#include "timer_wheel.hpp"
+
+#define TIMER_WHEEL_TICK_NS (TIMER_WHEEL_TICK * 1000000ULL)
+
+namespace http {
+    namespace server3 {
+
+        timer_wheel::timer_wheel(boost::asio::io_service& io_service)
+            : timer_(io_service),
+              slots_(TIMER_WHEEL_SLOTS),
+              origin_(stats::now()),
+              tick_(0)
+        {
+            timer_.expires_from_now(boost::posix_time::milliseconds(TIMER_WHEEL_TICK));
+            timer_.async_wait(boost::bind(&timer_wheel::handle_tick, this,
+                                          boost::asio::placeholders::error));
+        }
+
+        std::size_t timer_wheel::set(const boost::shared_ptr<client>& c, long ms)
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+
+            ++c->armed_;
+            if (ms <= 0)
+            {
+                c->deadline_ = 0;
+                return c->armed_;
+            }
+
+            c->deadline_ = stats::now() + ms * 1000000ULL;
+
+            // A client already due to be looked at earlier is put back where
+            // its deadline falls then.
+            boost::uint64_t at = tick_for(c->deadline_);
+            if ((c->at_ == 0) || (at < c->at_))
+            {
+                entry e;
+                e.c = c;
+                e.at = at;
+                slots_[at % TIMER_WHEEL_SLOTS].push_back(e);
+                c->at_ = at;
+            }
+            return c->armed_;
+        }
+
+        void timer_wheel::drain()
+        {
+            std::vector<boost::shared_ptr<client> > clients;
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                for (std::size_t i = 0; i < slots_.size(); ++i)
+                {
+                    for (std::size_t j = 0; j < slots_[i].size(); ++j)
+                    {
+                        // Each client once, from the slot it waits in.
+                        boost::shared_ptr<client> c = slots_[i][j].c.lock();
+                        if (c && (c->at_ == slots_[i][j].at) && (c->deadline_ != 0))
+                            clients.push_back(c);
+                    }
+                }
+            }
+
+            for (std::size_t i = 0; i < clients.size(); ++i)
+                clients[i]->drain();
+        }
+
+        boost::uint64_t timer_wheel::tick_for(boost::uint64_t deadline) const
+        {
+            boost::uint64_t at = (deadline - origin_ + TIMER_WHEEL_TICK_NS - 1) / TIMER_WHEEL_TICK_NS;
+            if (at <= tick_)
+                return tick_ + 1;
+            if (at >= tick_ + TIMER_WHEEL_SLOTS)
+                return tick_ + TIMER_WHEEL_SLOTS - 1;
+            return at;
+        }
+
+        void timer_wheel::handle_tick(const boost::system::error_code& e)
+        {
+            if (e)
+                return;
+
+            std::vector<boost::shared_ptr<client> > expired;
+            std::vector<std::size_t> armed;
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+
+                // Catch up with the ticks a busy io_service made us miss.
+                boost::uint64_t now = stats::now();
+                std::vector<entry> due;
+                while (origin_ + (tick_ + 1) * TIMER_WHEEL_TICK_NS <= now)
+                {
+                    ++tick_;
+                    due.swap(slots_[tick_ % TIMER_WHEEL_SLOTS]);
+                    for (std::size_t i = 0; i < due.size(); ++i)
+                    {
+                        // Gone, or also waiting in an earlier slot.
+                        boost::shared_ptr<client> c = due[i].c.lock();
+                        if (!c || (c->at_ != due[i].at))
+                            continue;
+
+                        if (c->deadline_ == 0)
+                        {
+                            c->at_ = 0;
+                        }
+                        else if (c->deadline_ > now)
+                        {
+                            entry later;
+                            later.c = c;
+                            later.at = tick_for(c->deadline_);
+                            slots_[later.at % TIMER_WHEEL_SLOTS].push_back(later);
+                            c->at_ = later.at;
+                        }
+                        else
+                        {
+                            c->deadline_ = 0;
+                            c->at_ = 0;
+                            expired.push_back(c);
+                            armed.push_back(c->armed_);
+                        }
+                    }
+                    due.clear();
+                }
+            }
+
+            for (std::size_t i = 0; i < expired.size(); ++i)
+                expired[i]->expire(armed[i]);
+
+            timer_.expires_at(timer_.expires_at() + boost::posix_time::milliseconds(TIMER_WHEEL_TICK));
+            timer_.async_wait(boost::bind(&timer_wheel::handle_tick, this,
+                                          boost::asio::placeholders::error));
+        }
+
+    } // namespace server3
+} // namespace http
@@ -0,0 +1,134 @@
+//
+// timer_wheel.hpp
+// ~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_TIMER_WHEEL_HPP
+#define HTTP_SERVER3_TIMER_WHEEL_HPP
+
+#include <cstddef>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/weak_ptr.hpp>
+
+#define TIMER_WHEEL_TICK    250     // ms per slot
+#define TIMER_WHEEL_SLOTS   512     // slots; one turn is 128s
+
+#define DEADLINE_IDLE       60      // s a connection may wait for a request
+#define DEADLINE_HEADER     10      // s from the first byte to the end of the headers
+#define DEADLINE_BODY       30      // s from the end of the headers to the end of the body
+#define DEADLINE_WRITE      30      // s for a reply to be written
+
+namespace http {
+    namespace server3 {
+
+/// Deadlines of the connections of one io_service, checked by a single
+/// periodic timer instead of one timer per socket. A connection is put in
+/// the slot of the tick its deadline falls on, and only looked at when that
+/// slot comes up: moving a deadline later costs nothing, the connection is
+/// just put back in a later slot when its old one comes up. Deadlines are
+/// therefore enforced up to one tick late.
+        class timer_wheel
+            : private boost::noncopyable
+        {
+        public:
+            /// Something with a deadline.
+            class client
+            {
+            public:
+                client()
+                    : deadline_(0), at_(0), armed_(0)
+                {
+                }
+
+                /// The deadline passed while armed() was the given value. Called
+                /// from the wheel's timer, on any thread of its io_service.
+                virtual void expire(std::size_t armed) = 0;
+
+                /// The server is handing over to its successor. Called like
+                /// expire(), for the clients with a deadline set.
+                virtual void drain()
+                {
+                }
+
+            protected:
+                /// Virtual, as connections are deleted through their own
+                /// type by the connection_cache.
+                virtual ~client()
+                {
+                }
+
+                /// Changes on every timer_wheel::set.
+                std::size_t armed() const
+                {
+                    return armed_;
+                }
+
+                /// Forget the wheel, for an object reused once its last
+                /// reference is gone.
+                void forget()
+                {
+                    deadline_ = 0;
+                    at_ = 0;
+                }
+
+            private:
+                friend class timer_wheel;
+
+                /// Monotonic deadline in nanoseconds, 0 for none, and the tick the
+                /// wheel looks at it next (0 for never); guarded by the wheel.
+                boost::uint64_t deadline_;
+                boost::uint64_t at_;
+                std::size_t armed_;
+            };
+
+            /// Start ticking on the given io_service.
+            explicit timer_wheel(boost::asio::io_service& io_service);
+
+            /// Set the deadline of c to ms milliseconds from now, or clear it if
+            /// ms is 0. Returns the new value of c->armed().
+            std::size_t set(const boost::shared_ptr<client>& c, long ms);
+
+            /// Call drain() on every client with a deadline set.
+            void drain();
+
+        private:
+            struct entry
+            {
+                boost::weak_ptr<client> c;
+                boost::uint64_t at;
+            };
+
+            /// The tick a deadline falls on, at most one turn ahead.
+            boost::uint64_t tick_for(boost::uint64_t deadline) const;
+
+            /// Look at the slots of the ticks elapsed.
+            void handle_tick(const boost::system::error_code& e);
+
+            boost::asio::deadline_timer timer_;
+
+            /// Protects everything below, and the wheel fields of the clients.
+            boost::mutex mutex_;
+
+            std::vector<std::vector<entry> > slots_;
+
+            /// Start of tick 0, and the last tick looked at.
+            boost::uint64_t origin_;
+            boost::uint64_t tick_;
+        };
+
+        typedef boost::shared_ptr<timer_wheel> timer_wheel_ptr;
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_TIMER_WHEEL_HPP
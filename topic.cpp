@@ -0,0 +1,282 @@
+//
+// topic.cpp
+// ~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <sstream>
+#include <string>
+#include <exception>
+#include "queue.hpp"
+#include "request_handler.hpp"
+#include "services.hpp"
+#include "topic.hpp"
+#include "soci.h"
+#include "soci-mysql.h"
+
+namespace http {
+    namespace server3 {
+
+        bool topic::match(const std::string& path)
+        {
+            return path.compare(0, sizeof(TOPIC_URI) - 1, TOPIC_URI) == 0;
+        }
+
+        int topic::operator() (const request& req, reply& rep) const
+        {
+            if ((req.method != "GET") && (req.method != "POST"))
+            {
+                rep = reply::stock_reply(reply::method_not_allowed);
+                return request_handler::finished;
+            }
+
+            std::string name, subscriber, action;
+            bool post = (req.method == "POST");
+            bool valid = split(req.path, name, subscriber, action) &&
+                (post ? (action.empty() || (action == "unsubscribe"))
+                      : (!subscriber.empty() && (action.empty() || (action == "spy") || (action == "count"))));
+
+            // In cluster mode the topic may live on another member.
+            if (valid && req.svc->shard.forward(req, name, rep))
+                return request_handler::finished;
+
+            queue q;
+            std::string stored;
+            if (!valid || (post && subscriber.empty() && !q.payload(req, stored)))
+            {
+                rep = reply::stock_reply(reply::bad_request);
+                return request_handler::finished;
+            }
+
+            // Topics are not replicated; a replica has none to serve.
+            if (req.svc->replicate.read_only())
+            {
+                rep = reply::stock_reply(reply::forbidden);
+                return request_handler::finished;
+            }
+
+            if (post)
+                req.timing.op = subscriber.empty() ? stats::enqueue : -1;
+            else if (action.empty())
+                req.timing.op = stats::dequeue;
+            else if (action == "spy")
+                req.timing.op = stats::spy;
+            else
+                req.timing.op = stats::count;
+
+            boost::uint64_t waited = stats::now();
+            lease db(req.svc->database_pool, &req.svc->admit, &req.svc->connect);
+            req.timing.ns[stats::pool_wait] = stats::now() - waited;
+
+            if (!db.acquired())
+            {
+                q.busy(req, rep);
+                return request_handler::finished;
+            }
+
+            soci::session& sql = db.session();
+            stats::stopwatch database(req.timing, stats::database);
+            bool rollback = false;
+            long long published = 0;
+
+            try
+            {
+                if (post)
+                {
+                    sql.begin();
+                    rollback = true;
+
+                    if (subscriber.empty())
+                    {
+                        published = publish(sql, name, stored);
+                    }
+                    else if (action.empty())
+                    {
+                        // New subscribers start after the last published item.
+                        sql << "INSERT IGNORE INTO t(topic, head) VALUES (:t, 0)",
+                            soci::use(name);
+                        sql << "INSERT IGNORE INTO c(topic, subscriber, pos) "
+                            "SELECT topic, :c, head FROM t WHERE topic = :t",
+                            soci::use(subscriber), soci::use(name);
+                    }
+                    else
+                    {
+                        sql << "DELETE FROM c WHERE topic = :t AND subscriber = :c",
+                            soci::use(name), soci::use(subscriber);
+                    }
+
+                    sql.commit();
+                    rollback = false;
+
+                    q.content(rep);
+                }
+                else if (action == "count")
+                {
+                    long long left = 0;
+                    soci::indicator ind;
+                    sql << "SELECT t.head - c.pos FROM c JOIN t ON t.topic = c.topic "
+                        "WHERE c.topic = :t AND c.subscriber = :c",
+                        soci::use(name), soci::use(subscriber), soci::into(left, ind);
+
+                    if (sql.got_data() && (ind == soci::i_ok))
+                    {
+                        std::stringstream sleft;
+                        sleft << left;
+                        rep.content = sleft.str();
+                        q.content(rep);
+                    }
+                    else
+                    {
+                        rep = reply::stock_reply(reply::not_found);
+                    }
+                }
+                else
+                {
+                    sql.begin();
+                    rollback = true;
+
+                    std::string d;
+                    soci::indicator ind;
+                    soci::statement st = (sql.prepare << "SELECT n(:t, :c, :a)",
+                                          soci::use(name), soci::use(subscriber),
+                                          soci::use((action.empty() ? 1 : 0)),
+                                          soci::into(d, ind));
+                    st.execute(true);
+
+                    sql.commit();
+                    rollback = false;
+
+                    if (!sql.got_data())
+                    {
+                        throw std::runtime_error("soci: no data from SELECT n(:t, :c, :a)");
+                    }
+
+                    switch (ind)
+                    {
+                        case soci::i_ok:
+                            q.item(req, d, rep);
+                            break;
+                        case soci::i_null:
+                            rep = reply::stock_reply(reply::not_found);
+                            break;
+                        default:
+                            throw std::runtime_error("soci: error retrieving data from SELECT n(:t, :c, :a)");
+                    }
+                }
+            }
+            catch (std::exception const &e)
+            {
+                if (rollback)
+                {
+                    try
+                    {
+                        sql.rollback();
+                    }
+                    catch (std::exception const &ex)
+                    {
+                        LIERR(ex.what());
+                    }
+                }
+
+                db.failed(e);
+
+                rep = reply::stock_reply(reply::internal_server_error);
+
+                LIERR(e.what());
+
+                return request_handler::finished;
+            }
+
+            if ((published > 0) && (published % TOPIC_RECLAIM_EVERY == 0))
+                reclaim(sql, name);
+
+            return request_handler::finished;
+        }
+
+        bool topic::split(const std::string& path, std::string& name,
+                          std::string& subscriber, std::string& action)
+        {
+            std::string* parts[] = { &name, &subscriber, &action };
+            std::string::size_type begin = sizeof(TOPIC_URI) - 1;
+
+            for (std::size_t i = 0; i < 3; ++i)
+            {
+                std::string::size_type end = path.find('/', begin);
+                if (end == std::string::npos)
+                    end = path.size();
+
+                parts[i]->assign(path, begin, end - begin);
+                if (parts[i]->empty() || (parts[i]->size() > TOPIC_MAX_NAME))
+                    return false;
+
+                if (end == path.size())
+                    return true;
+                begin = end + 1;
+            }
+
+            return false;
+        }
+
+        long long topic::publish(soci::session& sql, const std::string& name,
+                                 const std::string& stored) const
+        {
+            // The topic row stays locked until commit, so publishers of a topic
+            // take numbers and commit in the same order: a reader never sees
+            // item n + 1 before item n, and cursors can move one by one.
+            sql << "INSERT INTO t(topic, head) VALUES (:t, LAST_INSERT_ID(1)) "
+                "ON DUPLICATE KEY UPDATE head = LAST_INSERT_ID(head + 1)",
+                soci::use(name);
+
+            long long s = 0;
+            sql << "SELECT LAST_INSERT_ID()", soci::into(s);
+
+            sql << "INSERT INTO l(topic, s, d) VALUES (:t, :s, :d)",
+                soci::use(name), soci::use(s), soci::use(stored);
+
+            return s;
+        }
+
+        void topic::reclaim(soci::session& sql, const std::string& name) const
+        {
+            // Without subscribers everything up to the head is done with. The
+            // bound is read before deleting, so a subscriber arriving meanwhile
+            // (starting at the head or later) loses nothing.
+            try
+            {
+                sql.begin();
+
+                long long pos = 0;
+                soci::indicator ind;
+                sql << "SELECT COALESCE(MIN(c.pos), t.head) FROM t LEFT JOIN c ON c.topic = t.topic "
+                    "WHERE t.topic = :t GROUP BY t.head",
+                    soci::use(name), soci::into(pos, ind);
+
+                if (sql.got_data() && (ind == soci::i_ok))
+                {
+                    sql << "DELETE FROM l WHERE topic = :t AND s <= :s",
+                        soci::use(name), soci::use(pos);
+                }
+
+                sql.commit();
+            }
+            catch (std::exception const &e)
+            {
+                try
+                {
+                    sql.rollback();
+                }
+                catch (std::exception const &ex)
+                {
+                    LIERR(ex.what());
+                }
+
+                LIERR(e.what());
+            }
+        }
+
+    } // namespace server3
+} // namespace http
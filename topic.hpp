@@ -0,0 +1,68 @@
+//
+// topic.hpp
+// ~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_TOPIC_HPP
+#define HTTP_SERVER3_TOPIC_HPP
+
+#include <string>
+#include <boost/noncopyable.hpp>
+#include "globals.hpp"
+#include "reply.hpp"
+#include "request.hpp"
+
+#include "soci.h"
+
+#define TOPIC_URI           "/t/"
+#define TOPIC_MAX_NAME      64
+#define TOPIC_RECLAIM_EVERY 256
+
+namespace http {
+    namespace server3 {
+
+/// The fan-out service. Every item published to a topic is stored once, in
+/// a per-topic log numbered 1, 2, 3... Each subscriber has a cursor, the
+/// number of the last item it read, and reading only moves the cursor.
+/// Items all cursors have passed are deleted every TOPIC_RECLAIM_EVERY
+/// publications.
+///
+///   POST /t/<topic>                         publish (same body as an enqueue)
+///   POST /t/<topic>/<subscriber>            subscribe, from the next item on
+///   POST /t/<topic>/<subscriber>/unsubscribe
+///   GET  /t/<topic>/<subscriber>            read the next item
+///   GET  /t/<topic>/<subscriber>/spy        look at the next item
+///   GET  /t/<topic>/<subscriber>/count      items left to read
+        class topic
+            : private boost::noncopyable
+        {
+        public:
+            /// Whether the decoded request path belongs to this service.
+            static bool match(const std::string& path);
+
+            int operator() (const request& req, reply& rep) const;
+
+        private:
+            /// Split a path into topic, subscriber and action. Returns false if
+            /// it is malformed.
+            static bool split(const std::string& path, std::string& name,
+                              std::string& subscriber, std::string& action);
+
+            /// Append an item to a topic, returning its number. The caller owns
+            /// the transaction.
+            long long publish(soci::session& sql, const std::string& name,
+                              const std::string& stored) const;
+
+            /// Delete the items every subscriber of a topic has read.
+            void reclaim(soci::session& sql, const std::string& name) const;
+        };
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_TOPIC_HPP
@@ -0,0 +1,783 @@
+//
+// uring.cpp
+// ~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <boost/bind.hpp>
+#include "uring.hpp"
+
+#ifdef LISA_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// What a completion is about, in the low bits of its user data; the rest is
+// the address of the stream or acceptor.
+#define URING_NONE      0
+#define URING_RECV      1
+#define URING_SEND      2
+#define URING_ACCEPT    3
+#define URING_TAGS      3
+
+#define URING_GROUP     0       // id of the receive buffers
+
+namespace http {
+    namespace server3 {
+
+        namespace {
+
+            int setup(unsigned entries, io_uring_params* p)
+            {
+                return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+            }
+
+            int enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+            {
+                return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                                                  flags, static_cast<void*>(0), 0));
+            }
+
+            int register_ring(int fd, unsigned opcode, void* arg, unsigned nr_args)
+            {
+                return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+            }
+
+            unsigned load_acquire(const unsigned* p)
+            {
+                return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+            }
+
+            template <typename T>
+            void store_release(T* p, T v)
+            {
+                __atomic_store_n(p, v, __ATOMIC_RELEASE);
+            }
+
+            void* map(int fd, std::size_t size, off_t offset)
+            {
+                void* p = ::mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+                return (p == MAP_FAILED) ? 0 : p;
+            }
+
+            std::runtime_error failure(const std::string& what)
+            {
+                return std::runtime_error("io_uring: " + what + ": " + std::strerror(errno));
+            }
+
+        } // namespace
+
+        class uring::stream
+        {
+        public:
+            /// Bytes received into a buffer and not read yet.
+            struct segment
+            {
+                unsigned short bid;
+                unsigned offset;
+                unsigned size;
+            };
+
+            void clear()
+            {
+                fd = -1;
+                receiving = false;
+                starved = false;
+                sending = false;
+                ended = false;
+                error = 0;
+                released = false;
+                received.clear();
+                reader = 0;
+                read_data = 0;
+                read_size = 0;
+                writer = 0;
+                iov.clear();
+                iov_next = 0;
+                written = 0;
+            }
+
+            int fd;
+
+            /// Whether the multishot recv is in flight, or waits for buffers.
+            bool receiving;
+            bool starved;
+
+            /// Whether a send is in flight.
+            bool sending;
+
+            /// Whether the peer closed (error 0) or the socket failed.
+            bool ended;
+            int error;
+
+            /// Whether the connection gave the socket up.
+            bool released;
+
+            std::vector<segment> received;
+
+            /// The read waiting for bytes.
+            completion* reader;
+            char* read_data;
+            std::size_t read_size;
+
+            /// The write in flight, iov_next being the first buffer not sent.
+            completion* writer;
+            std::vector<iovec> iov;
+            std::size_t iov_next;
+            std::size_t written;
+            msghdr msg;
+        };
+
+        uring::uring(boost::asio::io_service& io_service)
+            : io_service_(io_service),
+              fd_(-1),
+              rings_(0),
+              rings_size_(0),
+              sqes_(0),
+              sqes_size_(0),
+              unsubmitted_(0),
+              submit_scheduled_(false),
+              buffers_(0),
+              buffer_ring_(0),
+              buffer_ring_size_(0),
+              buffer_tail_(0),
+              event_count_(0)
+        {
+            io_uring_params p;
+            std::memset(&p, 0, sizeof(p));
+            p.flags = IORING_SETUP_CQSIZE;
+            p.cq_entries = URING_ENTRIES * 4;
+            fd_ = setup(URING_ENTRIES, &p);
+            if (fd_ < 0)
+                throw failure("setup");
+
+            // Multishot accept and recv, and buffer rings, came with 6.0.
+            const unsigned features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |
+                IORING_FEAT_SUBMIT_STABLE | IORING_FEAT_FAST_POLL;
+            if ((p.features & features) != features)
+            {
+                ::close(fd_);
+                errno = ENOSYS;
+                throw failure("kernel too old");
+            }
+
+            rings_size_ = std::max(p.sq_off.array + p.sq_entries * sizeof(unsigned),
+                                   p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+            rings_ = map(fd_, rings_size_, IORING_OFF_SQ_RING);
+            sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+            sqes_ = map(fd_, sqes_size_, IORING_OFF_SQES);
+            if (!rings_ || !sqes_)
+                throw failure("mmap");
+
+            char* base = static_cast<char*>(rings_);
+            sq_head_ = reinterpret_cast<unsigned*>(base + p.sq_off.head);
+            sq_tail_ = reinterpret_cast<unsigned*>(base + p.sq_off.tail);
+            sq_mask_ = reinterpret_cast<unsigned*>(base + p.sq_off.ring_mask);
+            sq_array_ = reinterpret_cast<unsigned*>(base + p.sq_off.array);
+            sq_flags_ = reinterpret_cast<unsigned*>(base + p.sq_off.flags);
+            cq_head_ = reinterpret_cast<unsigned*>(base + p.cq_off.head);
+            cq_tail_ = reinterpret_cast<unsigned*>(base + p.cq_off.tail);
+            cq_mask_ = reinterpret_cast<unsigned*>(base + p.cq_off.ring_mask);
+            cqes_ = base + p.cq_off.cqes;
+
+            // The receive buffers are registered once as a ring the kernel
+            // picks from, and given back as soon as their bytes are read.
+            buffer_ring_size_ = URING_BUFFERS * sizeof(io_uring_buf);
+            buffer_ring_ = ::mmap(0, buffer_ring_size_, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            void* buffers = ::mmap(0, URING_BUFFERS * URING_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if ((buffer_ring_ == MAP_FAILED) || (buffers == MAP_FAILED))
+                throw failure("mmap");
+            buffers_ = static_cast<char*>(buffers);
+
+            io_uring_buf_reg reg;
+            std::memset(&reg, 0, sizeof(reg));
+            reg.ring_addr = reinterpret_cast<boost::uint64_t>(buffer_ring_);
+            reg.ring_entries = URING_BUFFERS;
+            reg.bgid = URING_GROUP;
+            if (register_ring(fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+                throw failure("register buffers");
+            for (unsigned i = 0; i < URING_BUFFERS; ++i)
+                recycle(static_cast<unsigned short>(i));
+
+            int efd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+            if (efd < 0)
+                throw failure("eventfd");
+            event_.reset(new boost::asio::posix::stream_descriptor(io_service_, efd));
+            if (register_ring(fd_, IORING_REGISTER_EVENTFD, &efd, 1) < 0)
+                throw failure("register eventfd");
+            start_wait();
+        }
+
+        uring::~uring()
+        {
+            // Closing the ring cancels everything in flight.
+            event_.reset();
+            if (fd_ >= 0)
+                ::close(fd_);
+
+            for (std::size_t i = 0; i < streams_.size(); ++i)
+            {
+                stream* s = streams_[i];
+                if (s->reader)
+                    s->reader->destroy();
+                if (s->writer)
+                    s->writer->destroy();
+                if (s->fd >= 0)
+                    ::close(s->fd);
+                delete s;
+            }
+            for (std::size_t i = 0; i < acceptors_.size(); ++i)
+                delete acceptors_[i];
+
+            if (rings_)
+                ::munmap(rings_, rings_size_);
+            if (sqes_)
+                ::munmap(sqes_, sqes_size_);
+            if (buffer_ring_ && (buffer_ring_ != MAP_FAILED))
+                ::munmap(buffer_ring_, buffer_ring_size_);
+            if (buffers_)
+                ::munmap(buffers_, URING_BUFFERS * URING_BUFFER_SIZE);
+        }
+
+        bool uring::available()
+        {
+            return true;
+        }
+
+        void uring::accept(int fd, accept_handler handler)
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            acceptor* a = new acceptor;
+            a->fd = fd;
+            a->handler = handler;
+            a->cancelled = false;
+            acceptors_.push_back(a);
+            submit_accept(a);
+        }
+
+        void uring::cancel_accept(int fd)
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            for (std::size_t i = 0; i < acceptors_.size(); ++i)
+            {
+                acceptor* a = acceptors_[i];
+                if ((a->fd == fd) && !a->cancelled)
+                {
+                    a->cancelled = true;
+                    submit_cancel(reinterpret_cast<boost::uint64_t>(a) | URING_ACCEPT);
+                }
+            }
+        }
+
+        uring::stream* uring::open(int fd)
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            stream* s = 0;
+            if (!free_.empty())
+            {
+                s = free_.back();
+                free_.pop_back();
+            }
+            else
+            {
+                s = new stream;
+                s->clear();
+                streams_.push_back(s);
+            }
+            s->fd = fd;
+            submit_recv(s);
+            return s;
+        }
+
+        void uring::shutdown(stream* s)
+        {
+            ::shutdown(s->fd, SHUT_RDWR);
+        }
+
+        void uring::release(stream* s)
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            s->released = true;
+            for (std::size_t i = 0; i < s->received.size(); ++i)
+                recycle(s->received[i].bid);
+            s->received.clear();
+
+            // The multishot recv ends once the socket is shut down.
+            if (s->receiving && !s->starved)
+            {
+                ::shutdown(s->fd, SHUT_RDWR);
+                submit_cancel(reinterpret_cast<boost::uint64_t>(s) | URING_RECV);
+            }
+            finish(s);
+        }
+
+        void uring::start_read(stream* s, char* data, std::size_t size, completion* c)
+        {
+            std::vector<result> ready;
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                s->reader = c;
+                s->read_data = data;
+                s->read_size = size;
+                fill_read(s, ready);
+            }
+
+            // Handlers are never called from the function starting them.
+            for (std::size_t i = 0; i < ready.size(); ++i)
+                io_service_.post(boost::bind(&uring::deliver, ready[i].c, ready[i].e, ready[i].n));
+        }
+
+        std::vector<iovec>& uring::write_buffers(stream* s)
+        {
+            s->iov.clear();
+            return s->iov;
+        }
+
+        void uring::start_write(stream* s, completion* c)
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            s->writer = c;
+            s->iov_next = 0;
+            s->written = 0;
+            if (s->iov.empty())
+            {
+                s->writer = 0;
+                io_service_.post(boost::bind(&uring::deliver, c, boost::system::error_code(), 0));
+                return;
+            }
+            submit_send(s);
+        }
+
+        void uring::deliver(completion* c, boost::system::error_code e, std::size_t n)
+        {
+            c->complete(e, n);
+        }
+
+        void uring::fill_read(stream* s, std::vector<result>& ready)
+        {
+            if (!s->reader || (s->received.empty() && !s->ended))
+                return;
+
+            std::size_t n = 0;
+            while ((n < s->read_size) && !s->received.empty())
+            {
+                stream::segment& seg = s->received.front();
+                std::size_t size = std::min(static_cast<std::size_t>(seg.size), s->read_size - n);
+                std::memcpy(s->read_data + n,
+                            buffers_ + static_cast<std::size_t>(seg.bid) * URING_BUFFER_SIZE + seg.offset,
+                            size);
+                n += size;
+                seg.offset += size;
+                seg.size -= size;
+                if (seg.size == 0)
+                {
+                    recycle(seg.bid);
+                    s->received.erase(s->received.begin());
+                }
+            }
+
+            // Bytes first, then the end of the stream.
+            result r;
+            r.c = s->reader;
+            r.n = n;
+            if (!n)
+                r.e = s->error ? error(s->error) : boost::system::error_code(boost::asio::error::eof);
+            s->reader = 0;
+            ready.push_back(r);
+        }
+
+        void* uring::next_sqe()
+        {
+            // A full batch goes out without waiting for the end of the pass.
+            if (unsubmitted_ >= URING_BATCH)
+                submit();
+
+            unsigned tail = *sq_tail_;
+            if (tail - load_acquire(sq_head_) > *sq_mask_)
+            {
+                submit();
+                if (tail - load_acquire(sq_head_) > *sq_mask_)
+                    throw failure("submission queue full");
+            }
+
+            unsigned index = tail & *sq_mask_;
+            io_uring_sqe* sqe = static_cast<io_uring_sqe*>(sqes_) + index;
+            std::memset(sqe, 0, sizeof(*sqe));
+            sq_array_[index] = index;
+            store_release(sq_tail_, tail + 1);
+            ++unsubmitted_;
+            schedule_submit();
+            return sqe;
+        }
+
+        void uring::submit_accept(acceptor* a)
+        {
+            io_uring_sqe* sqe = static_cast<io_uring_sqe*>(next_sqe());
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = a->fd;
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->accept_flags = SOCK_CLOEXEC;
+            sqe->user_data = reinterpret_cast<boost::uint64_t>(a) | URING_ACCEPT;
+        }
+
+        void uring::submit_recv(stream* s)
+        {
+            s->receiving = true;
+            s->starved = false;
+            io_uring_sqe* sqe = static_cast<io_uring_sqe*>(next_sqe());
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = s->fd;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = URING_GROUP;
+            sqe->user_data = reinterpret_cast<boost::uint64_t>(s) | URING_RECV;
+        }
+
+        void uring::submit_send(stream* s)
+        {
+            std::memset(&s->msg, 0, sizeof(s->msg));
+            s->msg.msg_iov = &s->iov[s->iov_next];
+            s->msg.msg_iovlen = std::min(s->iov.size() - s->iov_next,
+                                         static_cast<std::size_t>(URING_IOV_MAX));
+            s->sending = true;
+            io_uring_sqe* sqe = static_cast<io_uring_sqe*>(next_sqe());
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = s->fd;
+            sqe->addr = reinterpret_cast<boost::uint64_t>(&s->msg);
+            sqe->len = 1;
+            sqe->msg_flags = MSG_NOSIGNAL;
+            sqe->user_data = reinterpret_cast<boost::uint64_t>(s) | URING_SEND;
+        }
+
+        void uring::submit_cancel(boost::uint64_t data)
+        {
+            io_uring_sqe* sqe = static_cast<io_uring_sqe*>(next_sqe());
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = data;
+            sqe->user_data = URING_NONE;
+        }
+
+        void uring::schedule_submit()
+        {
+            if (submit_scheduled_)
+                return;
+            submit_scheduled_ = true;
+            io_service_.post(boost::bind(&uring::handle_submit, this));
+        }
+
+        void uring::handle_submit()
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            submit_scheduled_ = false;
+            submit();
+        }
+
+        void uring::submit()
+        {
+            while (unsubmitted_)
+            {
+                int n = enter(fd_, unsubmitted_, 0, 0);
+                if (n < 0)
+                {
+                    // Busy with completions not harvested yet: the next
+                    // harvest submits again.
+                    if (errno == EINTR)
+                        continue;
+                    return;
+                }
+                unsubmitted_ -= static_cast<unsigned>(n);
+            }
+        }
+
+        void uring::start_wait()
+        {
+            event_->async_read_some(boost::asio::buffer(&event_count_, sizeof(event_count_)),
+                                    boost::bind(&uring::handle_wait, this,
+                                                boost::asio::placeholders::error));
+        }
+
+        void uring::handle_wait(const boost::system::error_code& e)
+        {
+            if (e == boost::asio::error::operation_aborted)
+                return;
+
+            std::vector<result> ready;
+            std::vector<std::pair<acceptor*, int> > accepted;
+            {
+                boost::mutex::scoped_lock lock(mutex_);
+                for (;;)
+                {
+                    unsigned head = *cq_head_;
+                    unsigned tail = load_acquire(cq_tail_);
+                    for (; head != tail; ++head)
+                    {
+                        const io_uring_cqe& cqe = static_cast<io_uring_cqe*>(cqes_)[head & *cq_mask_];
+                        handle_completion(cqe.user_data, cqe.res, cqe.flags, ready, accepted);
+                    }
+                    store_release(cq_head_, head);
+
+                    // Completions the ring had no room for are kept by the
+                    // kernel until asked for.
+                    if (!(load_acquire(sq_flags_) & IORING_SQ_CQ_OVERFLOW))
+                        break;
+                    enter(fd_, 0, 0, IORING_ENTER_GETEVENTS);
+                }
+            }
+            start_wait();
+
+            for (std::size_t i = 0; i < accepted.size(); ++i)
+                accepted[i].first->handler(accepted[i].second);
+            for (std::size_t i = 0; i < ready.size(); ++i)
+                ready[i].c->complete(ready[i].e, ready[i].n);
+
+            // What the handlers started goes out with a single call rather
+            // than behind every handler queued meanwhile.
+            boost::mutex::scoped_lock lock(mutex_);
+            submit();
+        }
+
+        void uring::handle_completion(boost::uint64_t data, int res, unsigned flags,
+                                      std::vector<result>& ready,
+                                      std::vector<std::pair<acceptor*, int> >& accepted)
+        {
+            bool more = (flags & IORING_CQE_F_MORE) != 0;
+            switch (data & URING_TAGS)
+            {
+            case URING_ACCEPT:
+            {
+                acceptor* a = reinterpret_cast<acceptor*>(data & ~static_cast<boost::uint64_t>(URING_TAGS));
+                if (res >= 0)
+                {
+                    if (a->cancelled)
+                        ::close(res);
+                    else
+                        accepted.push_back(std::make_pair(a, res));
+                }
+
+                // A failed accept stops accepting, as on the epoll transport.
+                if (!more && !a->cancelled && (res >= 0))
+                    submit_accept(a);
+                break;
+            }
+            case URING_RECV:
+            {
+                stream* s = reinterpret_cast<stream*>(data & ~static_cast<boost::uint64_t>(URING_TAGS));
+                if (!more)
+                    s->receiving = false;
+                if ((res > 0) && (flags & IORING_CQE_F_BUFFER))
+                {
+                    stream::segment seg;
+                    seg.bid = static_cast<unsigned short>(flags >> IORING_CQE_BUFFER_SHIFT);
+                    seg.offset = 0;
+                    seg.size = static_cast<unsigned>(res);
+                    if (s->released || s->ended)
+                        recycle(seg.bid);
+                    else
+                        s->received.push_back(seg);
+                }
+                else if (res == -ENOBUFS)
+                {
+                    // Every buffer waits to be read: receive again once one
+                    // is given back.
+                    if (!s->released && !s->ended && !s->receiving)
+                    {
+                        s->receiving = true;
+                        s->starved = true;
+                        starved_.push_back(s);
+                    }
+                }
+                else if (res <= 0)
+                {
+                    s->ended = true;
+                    s->error = -res;
+                }
+
+                if (!s->receiving && !s->ended && !s->released)
+                    submit_recv(s);
+                fill_read(s, ready);
+                finish(s);
+                break;
+            }
+            case URING_SEND:
+            {
+                stream* s = reinterpret_cast<stream*>(data & ~static_cast<boost::uint64_t>(URING_TAGS));
+                s->sending = false;
+                if (!s->writer)
+                {
+                    finish(s);
+                    break;
+                }
+
+                if (res <= 0)
+                {
+                    result r;
+                    r.c = s->writer;
+                    r.e = res ? error(-res) : boost::system::error_code(boost::asio::error::broken_pipe);
+                    r.n = s->written;
+                    s->writer = 0;
+                    ready.push_back(r);
+                    break;
+                }
+
+                s->written += res;
+                std::size_t left = static_cast<std::size_t>(res);
+                while (left && (s->iov_next < s->iov.size()))
+                {
+                    iovec& v = s->iov[s->iov_next];
+                    if (left < v.iov_len)
+                    {
+                        v.iov_base = static_cast<char*>(v.iov_base) + left;
+                        v.iov_len -= left;
+                        left = 0;
+                    }
+                    else
+                    {
+                        left -= v.iov_len;
+                        ++s->iov_next;
+                    }
+                }
+
+                if (s->iov_next < s->iov.size())
+                {
+                    submit_send(s);
+                    break;
+                }
+
+                result r;
+                r.c = s->writer;
+                r.n = s->written;
+                s->writer = 0;
+                ready.push_back(r);
+                break;
+            }
+            default:
+                break;
+            }
+        }
+
+        void uring::recycle(unsigned short bid)
+        {
+            io_uring_buf* ring = static_cast<io_uring_buf*>(buffer_ring_);
+            io_uring_buf& buf = ring[buffer_tail_ & (URING_BUFFERS - 1)];
+            buf.addr = reinterpret_cast<boost::uint64_t>(buffers_ + static_cast<std::size_t>(bid) * URING_BUFFER_SIZE);
+            buf.len = URING_BUFFER_SIZE;
+            buf.bid = bid;
+
+            // The tail overlays the reserved field of the first entry.
+            ++buffer_tail_;
+            store_release(&ring[0].resv, static_cast<__u16>(buffer_tail_));
+
+            if (starved_.empty())
+                return;
+            std::vector<stream*> starved;
+            starved.swap(starved_);
+            for (std::size_t i = 0; i < starved.size(); ++i)
+            {
+                if (starved[i]->released)
+                    starved_.push_back(starved[i]);
+                else
+                    submit_recv(starved[i]);
+            }
+        }
+
+        void uring::finish(stream* s)
+        {
+            if (!s->released || (s->receiving && !s->starved) || s->sending)
+                return;
+
+            if (s->starved)
+                starved_.erase(std::find(starved_.begin(), starved_.end(), s));
+            ::close(s->fd);
+            s->clear();
+            free_.push_back(s);
+        }
+
+        boost::system::error_code uring::error(int err)
+        {
+            return boost::system::error_code(err, boost::asio::error::get_system_category());
+        }
+
+    } // namespace server3
+} // namespace http
+
+#else // LISA_IO_URING
+
+namespace http {
+    namespace server3 {
+
+        // Without <linux/io_uring.h> the transport cannot be selected, and
+        // nothing below is reached.
+
+        class uring::stream
+        {
+        public:
+            std::vector<iovec> iov;
+        };
+
+        uring::uring(boost::asio::io_service& io_service)
+            : io_service_(io_service)
+        {
+            throw std::runtime_error("io_uring: not built in");
+        }
+
+        uring::~uring()
+        {
+        }
+
+        bool uring::available()
+        {
+            return false;
+        }
+
+        void uring::accept(int, accept_handler)
+        {
+        }
+
+        void uring::cancel_accept(int)
+        {
+        }
+
+        uring::stream* uring::open(int)
+        {
+            return 0;
+        }
+
+        void uring::shutdown(stream*)
+        {
+        }
+
+        void uring::release(stream*)
+        {
+        }
+
+        void uring::start_read(stream*, char*, std::size_t, completion*)
+        {
+        }
+
+        std::vector<iovec>& uring::write_buffers(stream* s)
+        {
+            return s->iov;
+        }
+
+        void uring::start_write(stream*, completion*)
+        {
+        }
+
+    } // namespace server3
+} // namespace http
+
+#endif // LISA_IO_URING
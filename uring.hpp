@@ -0,0 +1,287 @@
+//
+// uring.hpp
+// ~~~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_URING_HPP
+#define HTTP_SERVER3_URING_HPP
+
+#include <new>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+#include "handler_allocator.hpp"
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define URING_ENTRIES       4096    // submission queue entries (completions: 4 times more)
+#define URING_BUFFERS       4096    // receive buffers shared by the connections of a ring
+#define URING_BUFFER_SIZE   4096    // bytes per receive buffer
+#define URING_IOV_MAX       1024    // buffers per send
+#define URING_BATCH         64      // submissions sent at once at most
+
+namespace http {
+    namespace server3 {
+
+/// HTTP transport on io_uring, as an alternative to Asio's epoll reactor for
+/// the connections of one io_service. A listening socket gets one multishot
+/// accept and every connection one multishot recv, which picks its buffers
+/// from a ring of buffers registered with the kernel; writes are gathered
+/// sends. The submissions made by the handlers of one pass of the io_service
+/// go to the kernel in a single system call, and the completions come back
+/// through an eventfd the io_service watches, so handlers, strands and timers
+/// work as with Asio sockets.
+        class uring
+            : private boost::noncopyable
+        {
+        public:
+            /// Called with each accepted socket.
+            typedef boost::function<void (int)> accept_handler;
+
+            /// A connected socket.
+            class stream;
+
+            /// Set up a ring for the connections of io_service. Throws if the
+            /// kernel lacks what the transport needs.
+            explicit uring(boost::asio::io_service& io_service);
+
+            /// Close the ring, every socket it still holds and the handlers
+            /// still waiting, without calling them.
+            ~uring();
+
+            /// Whether lisa was built with the transport.
+            static bool available();
+
+            /// Accept connections on the listening socket fd until
+            /// cancel_accept(fd), calling handler with each one.
+            void accept(int fd, accept_handler handler);
+
+            /// Stop accepting on fd. The socket is left open.
+            void cancel_accept(int fd);
+
+            /// Take over the connected socket fd and start receiving from it.
+            stream* open(int fd);
+
+            /// Shut the socket down: the reads and writes in flight complete.
+            void shutdown(stream* s);
+
+            /// Give the socket up once nothing of it is in flight; no operation
+            /// may be started on it after this.
+            void release(stream* s);
+
+            /// Read some bytes into data, like socket::async_read_some. The
+            /// handler is kept in storage from allocator until it is called.
+            template <typename Handler>
+            void async_read_some(stream* s, char* data, std::size_t size,
+                                 handler_allocator& allocator, Handler handler)
+            {
+                start_read(s, data, size, handler_completion<Handler>::create(allocator, handler));
+            }
+
+            /// Write all of buffers, like asio::async_write.
+            template <typename Buffers, typename Handler>
+            void async_write(stream* s, const Buffers& buffers,
+                             handler_allocator& allocator, Handler handler)
+            {
+                std::vector<iovec>& iov = write_buffers(s);
+                for (typename Buffers::const_iterator i = buffers.begin(); i != buffers.end(); ++i)
+                {
+                    iovec v;
+                    v.iov_base = const_cast<void*>(boost::asio::buffer_cast<const void*>(*i));
+                    v.iov_len = boost::asio::buffer_size(*i);
+                    if (v.iov_len)
+                        iov.push_back(v);
+                }
+                start_write(s, handler_completion<Handler>::create(allocator, handler));
+            }
+
+        private:
+            /// A handler waiting for a read or a write, whatever its type.
+            class completion
+            {
+            public:
+                /// Call the handler, once the completion is freed.
+                virtual void complete(const boost::system::error_code& e, std::size_t n) = 0;
+
+                /// Free the completion without calling the handler.
+                virtual void destroy() = 0;
+
+            protected:
+                ~completion()
+                {
+                }
+            };
+
+            template <typename Handler>
+            class handler_completion
+                : public completion
+            {
+            public:
+                static completion* create(handler_allocator& allocator, Handler handler)
+                {
+                    void* p = allocator.allocate(sizeof(handler_completion));
+                    return new (p) handler_completion(allocator, handler);
+                }
+
+                void complete(const boost::system::error_code& e, std::size_t n)
+                {
+                    // The storage is free again when the handler runs, as with
+                    // Asio, so that it can start the next operation in it.
+                    Handler handler(handler_);
+                    destroy();
+                    handler(e, n);
+                }
+
+                void destroy()
+                {
+                    handler_allocator& allocator = allocator_;
+                    this->~handler_completion();
+                    allocator.deallocate(this);
+                }
+
+            private:
+                handler_completion(handler_allocator& allocator, Handler handler)
+                    : allocator_(allocator), handler_(handler)
+                {
+                }
+
+                handler_allocator& allocator_;
+                Handler handler_;
+            };
+
+            /// A completion ready to be called.
+            struct result
+            {
+                completion* c;
+                boost::system::error_code e;
+                std::size_t n;
+            };
+
+            /// A multishot accept.
+            struct acceptor
+            {
+                int fd;
+                accept_handler handler;
+                bool cancelled;
+            };
+
+            /// Start a read, completing it right away with bytes already received.
+            void start_read(stream* s, char* data, std::size_t size, completion* c);
+
+            /// The buffers of the next write of s, emptied.
+            std::vector<iovec>& write_buffers(stream* s);
+
+            /// Start the write of write_buffers(s).
+            void start_write(stream* s, completion* c);
+
+            /// Post the completion of a read found data already received.
+            static void deliver(completion* c, boost::system::error_code e, std::size_t n);
+
+            /// Fill the read waiting on s from the bytes received, if any or at
+            /// the end of the stream. Called with mutex_ held.
+            void fill_read(stream* s, std::vector<result>& ready);
+
+            /// Queue the submissions. Called with mutex_ held.
+            void submit_accept(acceptor* a);
+            void submit_recv(stream* s);
+            void submit_send(stream* s);
+            void submit_cancel(boost::uint64_t data);
+
+            /// A free submission queue entry, submitting those queued first when
+            /// a batch or the queue is full. The caller fills it before
+            /// anything else is submitted.
+            void* next_sqe();
+
+            /// Have the queued submissions sent by the io_service, after the
+            /// handlers already waiting.
+            void schedule_submit();
+            void handle_submit();
+
+            /// Send the queued submissions. Called with mutex_ held.
+            void submit();
+
+            /// Handle the completions signaled through the eventfd.
+            void start_wait();
+            void handle_wait(const boost::system::error_code& e);
+
+            /// Process one completion. Called with mutex_ held.
+            void handle_completion(boost::uint64_t data, int res, unsigned flags,
+                                   std::vector<result>& ready,
+                                   std::vector<std::pair<acceptor*, int> >& accepted);
+
+            /// Give receive buffer bid back to the kernel. Called with mutex_ held.
+            void recycle(unsigned short bid);
+
+            /// Close and reuse s if it is released and nothing is in flight.
+            /// Called with mutex_ held.
+            void finish(stream* s);
+
+            /// Map an error number to an error code.
+            static boost::system::error_code error(int err);
+
+            boost::asio::io_service& io_service_;
+
+            /// The ring.
+            int fd_;
+
+            /// The rings shared with the kernel.
+            void* rings_;
+            std::size_t rings_size_;
+            void* sqes_;
+            std::size_t sqes_size_;
+            unsigned* sq_head_;
+            unsigned* sq_tail_;
+            unsigned* sq_mask_;
+            unsigned* sq_array_;
+            unsigned* sq_flags_;
+            unsigned* cq_head_;
+            unsigned* cq_tail_;
+            unsigned* cq_mask_;
+            void* cqes_;
+
+            /// Entries queued and not submitted yet.
+            unsigned unsubmitted_;
+
+            /// Whether handle_submit() is posted.
+            bool submit_scheduled_;
+
+            /// Receive buffers, and the ring through which the kernel takes them.
+            char* buffers_;
+            void* buffer_ring_;
+            std::size_t buffer_ring_size_;
+            unsigned short buffer_tail_;
+
+            /// Streams whose recv stopped for lack of buffers, until some are given back.
+            std::vector<stream*> starved_;
+
+            /// Signaled by the kernel when completions are posted.
+            boost::scoped_ptr<boost::asio::posix::stream_descriptor> event_;
+            boost::uint64_t event_count_;
+
+            /// Every stream and acceptor of the ring, and the streams to reuse.
+            std::vector<stream*> streams_;
+            std::vector<stream*> free_;
+            std::vector<acceptor*> acceptors_;
+
+            /// Protects the rings, the buffers and the streams, for the
+            /// io_service shared by every thread.
+            boost::mutex mutex_;
+        };
+
+        typedef boost::shared_ptr<uring> uring_ptr;
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_URING_HPP
@@ -0,0 +1,139 @@
+//
+// url.cpp
+// ~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include <cstring>
+#include "url.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace http {
+    namespace server3 {
+
+        const signed char url::hex_[256] = {
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+             0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+            -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+        };
+
+        std::size_t url::scan(const char* data, std::size_t from, std::size_t size)
+        {
+#ifdef __SSE2__
+            // Sixteen bytes at a time: most of a path or payload has no escapes.
+            const __m128i percent = _mm_set1_epi8('%');
+            const __m128i plus = _mm_set1_epi8('+');
+            for (; from + 16 <= size; from += 16)
+            {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + from));
+                int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, percent),
+                                                          _mm_cmpeq_epi8(v, plus)));
+                if (mask)
+                    return from + __builtin_ctz(mask);
+            }
+#endif
+            while ((from < size) && (data[from] != '%') && (data[from] != '+'))
+                ++from;
+            return from;
+        }
+
+        bool url::decode(char* data, std::size_t& size)
+        {
+            std::size_t in = scan(data, 0, size);
+            std::size_t out = in;
+
+            while (in < size)
+            {
+                if (data[in] == '+')
+                {
+                    data[out++] = ' ';
+                    ++in;
+                }
+                else
+                {
+                    if (in + 3 > size)
+                        return false;
+                    int high = hex_[static_cast<unsigned char>(data[in + 1])];
+                    int low = hex_[static_cast<unsigned char>(data[in + 2])];
+                    if ((high | low) < 0)
+                        return false;
+                    data[out++] = static_cast<char>((high << 4) | low);
+                    in += 3;
+                }
+
+                // Move the following run of plain bytes down in one go.
+                std::size_t next = scan(data, in, size);
+                if (out != in)
+                    std::memmove(data + out, data + in, next - in);
+                out += next - in;
+                in = next;
+            }
+
+            size = out;
+            return true;
+        }
+
+        bool url::decode(std::string& s)
+        {
+            if (s.empty())
+                return true;
+
+            std::size_t size = s.size();
+            if (!decode(&s[0], size))
+                return false;
+            s.resize(size);
+            return true;
+        }
+
+        bool url::decode_fields(char* begin, char* end, field_vector& fields)
+        {
+            while (begin < end)
+            {
+                char* amp = static_cast<char*>(std::memchr(begin, '&', end - begin));
+                if (!amp)
+                    amp = end;
+
+                if (amp != begin)
+                {
+                    char* eq = static_cast<char*>(std::memchr(begin, '=', amp - begin));
+
+                    // Both shrink as they decode, each within its own bytes.
+                    std::size_t name_size = (eq ? eq : amp) - begin;
+                    std::size_t value_size = eq ? amp - eq - 1 : 0;
+                    if (!decode(begin, name_size) || (eq && !decode(eq + 1, value_size)))
+                        return false;
+
+                    field f;
+                    f.name = boost::string_ref(begin, name_size);
+                    if (eq)
+                        f.value = boost::string_ref(eq + 1, value_size);
+                    fields.push_back(f);
+                }
+
+                begin = amp + 1;
+            }
+            return true;
+        }
+
+    } // namespace server3
+} // namespace http
@@ -0,0 +1,49 @@
+//
+// url.hpp
+// ~~~~~~~
+//
+// Copyright (c) 2010 Ivan Ribeiro Rocha (ivanribeiro at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_SERVER3_URL_HPP
+#define HTTP_SERVER3_URL_HPP
+
+#include <cstddef>
+#include <string>
+#include "header.hpp"
+
+namespace http {
+    namespace server3 {
+
+/// URL and application/x-www-form-urlencoded decoding.
+        class url
+        {
+        public:
+            /// Decode %XX escapes and '+' (as a space) in place. Returns false if an
+            /// escape is malformed, leaving the string unspecified.
+            static bool decode(std::string& s);
+
+            /// Decode the first size bytes of data in place; size is updated to the
+            /// decoded length.
+            static bool decode(char* data, std::size_t& size);
+
+            /// Decode the name=value pairs of a query string or form body in place
+            /// and append them to fields, which point into [begin, end). Empty
+            /// pairs are skipped; a pair without '=' has an empty value.
+            static bool decode_fields(char* begin, char* end, field_vector& fields);
+
+        private:
+            /// Offset of the first '%' or '+' at or after from, or size.
+            static std::size_t scan(const char* data, std::size_t from, std::size_t size);
+
+            /// Value of a hexadecimal digit, -1 for any other byte.
+            static const signed char hex_[256];
+        };
+
+    } // namespace server3
+} // namespace http
+
+#endif // HTTP_SERVER3_URL_HPP